@@ -0,0 +1,760 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+// Parameterized benchmark of CreateDir / RemoveDir / CopyDir over synthetic trees.
+//
+//   bench_fileio [--shape [KIND:]F,D,N,S,B]... [--warmup W] [--trials T]
+//                [--filter SUBSTR] [--root DIR | --tmpfs] [--threads N]
+//                [--json FILE] [--baseline FILE] [--threshold PCT]
+//                [--contention N,N,... [--ops N] [--procs]]
+//
+// A shape is a TreeFixture kind (balanced, skewed, chain or flat, default
+// balanced) with fanout F, depth D, N files per directory, S symlinks per
+// file and B bytes per file. Every benchmark runs W untimed warmup trials
+// and T timed trials on a fresh fixture each, and reports min / median /
+// p99 and entries per second of the median. Results can be written as JSON and
+// compared against a saved JSON baseline, the exit code is 1 if a median
+// got slower than the threshold.
+//
+// --contention replaces the tree benchmarks with N workers, threads or with
+// --procs processes, mixing CreateDir and RemoveDir of siblings below one
+// shared parent or one parent per worker, see RunContention.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <climits>
+#include <cmath>
+#include <cstdlib>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <sstream>
+#include <random>
+#include <sched.h>
+#include <string>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <thread>
+#include <unistd.h>
+#include <vector>
+#include "file_utils.h"
+#include "TreeFixture.h"
+
+struct Options {
+    std::vector<FixtureOptions> vShapes;
+    int iWarmup = 1;
+    int iTrials = 5;
+    unsigned int nThreads = 0;  // RemoveDirParallel and fixture building
+    std::string szFilter;
+    std::string szRoot = "bench_tmp";
+    bool bTmpfs = false;
+    std::string szJson;
+    std::string szBaseline;
+    double dThreshold = 10.0;   // percent
+    std::vector<unsigned int> vContention;  // worker counts, empty runs the tree benchmarks
+    size_t ulOps = 20000;       // operations per contention worker and trial
+    bool bProcesses = false;    // contention workers are processes instead of threads
+};
+
+struct BenchResult {
+    std::string szName;
+    size_t ulEntries;
+    std::vector<double> vNs;    // one per timed trial, sorted
+    double dMin;
+    double dMedian;
+    double dP99;
+    double dEntriesPerSec;
+};
+
+// A benchmark times fn on the fixture at szPath. prepare builds the
+// fixture before each trial, both untimed.
+struct Benchmark {
+    std::string szName;
+    std::function<size_t(const std::string&)> prepare;
+    std::function<bool(const std::string&)> run;
+};
+
+#define CONTENTION_GROUPS       8       // shared subdirectories of every parent
+#define CONTENTION_WINDOW       64      // live leaves per worker
+#define CONTENTION_EXISTING_PCT 10      // CreateDir of an existing group, EEXIST for MkdirFirst
+
+namespace {
+const struct {
+    const char* szName;
+    FixtureShape eShape;
+} g_shapeKinds[] = {
+    { "balanced", FixtureShape::Balanced },
+    { "skewed", FixtureShape::Skewed },
+    { "chain", FixtureShape::DeepChain },
+    { "flat", FixtureShape::Flat },
+};
+
+bool ParseShape(const char* szArg, FixtureOptions& shape)
+{
+    const char* szColon = strchr(szArg, ':');
+    if (szColon) {
+        std::string szKind(szArg, szColon - szArg);
+        auto it = std::find_if(std::begin(g_shapeKinds), std::end(g_shapeKinds),
+                               [&szKind](const auto& kind) { return szKind == kind.szName; });
+        if (it == std::end(g_shapeKinds)) {
+            return false;
+        }
+        shape.eShape = it->eShape;
+        szArg = szColon + 1;
+    }
+    return sscanf(szArg, "%d,%d,%d,%lf,%zu", &shape.iFanout, &shape.iDepth, &shape.iFiles,
+                  &shape.dSymlinkRatio, &shape.ulFileSize) == 5 &&
+           shape.iFanout >= 0 && shape.iDepth >= 0 && shape.iFiles >= 0 && shape.dSymlinkRatio >= 0;
+}
+
+std::string GetShapeName(const FixtureOptions& shape)
+{
+    std::ostringstream os;
+    if (shape.eShape != FixtureShape::Balanced) {
+        for (const auto& kind : g_shapeKinds) {
+            if (kind.eShape == shape.eShape) {
+                os << kind.szName << "_";
+            }
+        }
+    }
+    os << "f" << shape.iFanout << "_d" << shape.iDepth << "_n" << shape.iFiles << "_s" << shape.dSymlinkRatio
+       << "_b" << shape.ulFileSize;
+    return os.str();
+}
+
+void PrintUsage(const char* szProgram)
+{
+    std::cerr << "Usage: " << szProgram << " [--shape [balanced|skewed|chain|flat:]fanout,depth,files,symlink_ratio,file_size]...\n"
+              << "       [--warmup N] [--trials N] [--filter SUBSTR] [--root DIR | --tmpfs] [--threads N]\n"
+              << "       [--json FILE] [--baseline FILE] [--threshold PERCENT]\n"
+              << "       [--contention workers,... [--ops N] [--procs]]" << std::endl;
+}
+
+bool ParseOptions(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string szArg = argv[i];
+        if (szArg == "--tmpfs") {
+            options.bTmpfs = true;
+            continue;
+        }
+        if (szArg == "--procs") {
+            options.bProcesses = true;
+            continue;
+        }
+        if (szArg == "--help" || szArg == "-h" || i + 1 >= argc) {
+            return false;
+        }
+        const char* szValue = argv[++i];
+        if (szArg == "--shape") {
+            FixtureOptions shape;
+            if (!ParseShape(szValue, shape)) {
+                std::cerr << "Invalid shape: " << szValue << std::endl;
+                return false;
+            }
+            options.vShapes.push_back(shape);
+        } else if (szArg == "--warmup") {
+            options.iWarmup = std::max(0, atoi(szValue));
+        } else if (szArg == "--trials") {
+            options.iTrials = std::max(1, atoi(szValue));
+        } else if (szArg == "--threads") {
+            options.nThreads = std::max(0, atoi(szValue));
+        } else if (szArg == "--filter") {
+            options.szFilter = szValue;
+        } else if (szArg == "--root") {
+            options.szRoot = szValue;
+        } else if (szArg == "--json") {
+            options.szJson = szValue;
+        } else if (szArg == "--baseline") {
+            options.szBaseline = szValue;
+        } else if (szArg == "--threshold") {
+            options.dThreshold = atof(szValue);
+        } else if (szArg == "--contention") {
+            std::stringstream ss(szValue);
+            std::string szCount;
+            while (std::getline(ss, szCount, ',')) {
+                int iCount = atoi(szCount.c_str());
+                if (iCount <= 0) {
+                    std::cerr << "Invalid worker count: " << szCount << std::endl;
+                    return false;
+                }
+                options.vContention.push_back(iCount);
+            }
+        } else if (szArg == "--ops") {
+            options.ulOps = std::max(1, atoi(szValue));
+        } else {
+            std::cerr << "Unknown option: " << szArg << std::endl;
+            return false;
+        }
+    }
+
+    if (options.vShapes.empty()) {
+        // Wide and shallow, narrow and deep, one huge flat directory, and
+        // the TestFileIO shape with 4 KB files
+        const char* szDefaults[] = { "10,2,10,0.5,0", "2,8,4,0.5,0", "flat:5000,1,0,0,0", "10,2,10,0.5,4096" };
+        for (const char* szDefault : szDefaults) {
+            FixtureOptions shape;
+            ParseShape(szDefault, shape);
+            options.vShapes.push_back(shape);
+        }
+    }
+    for (auto& shape : options.vShapes) {
+        shape.nThreads = options.nThreads;
+    }
+    return true;
+}
+
+// Directories of a balanced shape below szRoot, parents before children
+void CollectDirs(const FixtureOptions& shape, const std::string& szRoot, int iLevel, std::vector<std::string>& vDirs)
+{
+    if (iLevel == shape.iDepth) {
+        return;
+    }
+    for (int i = 0; i < shape.iFanout; ++i) {
+        std::string szDir = szRoot + "/dir_" + std::to_string(i);
+        vDirs.push_back(szDir);
+        CollectDirs(shape, szDir, iLevel + 1, vDirs);
+    }
+}
+
+std::string GetCopyPath(const std::string& szPath)
+{
+    return szPath + ".copy";
+}
+
+// Remove the fixture and the copy a CopyDir benchmark made of it
+void RemoveTree(const std::string& szPath)
+{
+    for (const std::string& szTree : { szPath, GetCopyPath(szPath) }) {
+        struct stat st;
+        if (lstat(szTree.c_str(), &st) == 0 && !RemoveDir(szTree, false)) {
+            std::cerr << __FUNCTION__ << ": Failed to remove " << szTree << std::endl;
+        }
+    }
+}
+
+std::vector<Benchmark> MakeBenchmarks(const FixtureOptions& shape, unsigned int nThreads)
+{
+    std::vector<Benchmark> vBenchmarks;
+    std::string szShape = GetShapeName(shape);
+
+    // Only directories, the same calls TestCreateDir makes
+    if (shape.eShape == FixtureShape::Balanced) {
+        auto pDirs = std::make_shared<std::vector<std::string>>();
+        vBenchmarks.push_back({ "CreateDir/" + szShape,
+            [shape, pDirs](const std::string& szPath) {
+                pDirs->clear();
+                CollectDirs(shape, szPath, 0, *pDirs);
+                return pDirs->size();
+            },
+            [pDirs](const std::string&) {
+                for (const auto& szDir : *pDirs) {
+                    if (!CreateDir(szDir)) {
+                        return false;
+                    }
+                }
+                return true;
+            } });
+    }
+
+    auto build = [shape](const std::string& szPath) -> size_t {
+        FixtureStats stats;
+        return CreateFixture(szPath, shape, &stats) ? stats.getEntries() : 0;
+    };
+    vBenchmarks.push_back({ "RemoveDir/PathBased/" + szShape, build,
+        [](const std::string& szPath) { return RemoveDir(szPath, false, RemoveDirMode::PathBased); } });
+    vBenchmarks.push_back({ "RemoveDir/FdRelative/" + szShape, build,
+        [](const std::string& szPath) { return RemoveDir(szPath, false, RemoveDirMode::FdRelative); } });
+    vBenchmarks.push_back({ "RemoveDir/Streaming/" + szShape, build,
+        [](const std::string& szPath) { return RemoveDir(szPath, false, RemoveDirMode::Streaming); } });
+    nThreads = nThreads ? nThreads : std::max(1u, std::thread::hardware_concurrency());
+    vBenchmarks.push_back({ "RemoveDirParallel/" + szShape, build,
+        [nThreads](const std::string& szPath) { return RemoveDirParallel(szPath, false, nThreads); } });
+
+    // Copies go next to the fixture, see GetCopyPath
+    vBenchmarks.push_back({ "CopyDir/" + szShape, build,
+        [nThreads](const std::string& szPath) {
+            CopyDirOptions options;
+            options.nThreads = nThreads;
+            return CopyDir(szPath, GetCopyPath(szPath), options);
+        } });
+    vBenchmarks.push_back({ "CopyDir/cp -r/" + szShape, build,
+        [](const std::string& szPath) {
+            return system(("cp -r '" + szPath + "' '" + GetCopyPath(szPath) + "'").c_str()) == 0;
+        } });
+    return vBenchmarks;
+}
+
+// Nearest rank percentile of sorted samples
+double Percentile(const std::vector<double>& vSorted, double dQuantile)
+{
+    size_t ulRank = static_cast<size_t>(std::ceil(dQuantile * vSorted.size()));
+    return vSorted[std::min(vSorted.size() - 1, ulRank > 0 ? ulRank - 1 : 0)];
+}
+
+bool RunBenchmark(const Benchmark& benchmark, const Options& options, const std::string& szPath, BenchResult& result)
+{
+    result.szName = benchmark.szName;
+    result.vNs.clear();
+    for (int i = 0; i < options.iWarmup + options.iTrials; ++i) {
+        RemoveTree(szPath);
+        result.ulEntries = benchmark.prepare(szPath);
+        if (result.ulEntries == 0) {
+            return false;
+        }
+
+        auto start = std::chrono::steady_clock::now();
+        bool bSucceeded = benchmark.run(szPath);
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        if (!bSucceeded) {
+            std::cerr << __FUNCTION__ << ": " << benchmark.szName << " failed" << std::endl;
+            return false;
+        }
+        if (i >= options.iWarmup) {
+            result.vNs.push_back(std::chrono::duration<double, std::nano>(elapsed).count());
+        }
+    }
+    RemoveTree(szPath);
+
+    std::sort(result.vNs.begin(), result.vNs.end());
+    result.dMin = result.vNs.front();
+    result.dMedian = Percentile(result.vNs, 0.5);
+    result.dP99 = Percentile(result.vNs, 0.99);
+    result.dEntriesPerSec = result.ulEntries / (result.dMedian / 1e9);
+    return true;
+}
+
+// Lives in a MAP_SHARED mapping, so forked workers report through it too
+struct ContentionWorker {
+    uint64_t ulFailures;
+    uint64_t ulOps;
+};
+
+struct ContentionShared {
+    std::atomic<unsigned int> nReady;
+    std::atomic<bool> bGo;
+    ContentionWorker workers[];         // nWorkers, followed by nWorkers * ulOps latencies in ns
+};
+
+struct ContentionConfig {
+    bool bShared;                       // one parent for every worker
+    CreateDirMode eMode;
+    unsigned int nWorkers;
+    bool bProcesses;
+    size_t ulOps;
+};
+
+struct ContentionResult {
+    BenchResult bench;                  // wall time of every trial
+    std::vector<uint64_t> vLatencyNs;   // every operation of the timed trials, sorted
+    uint64_t ulFailures;
+    uint64_t ulLeaked;
+};
+
+std::string GetContentionParent(const std::string& szPath, const ContentionConfig& config, unsigned int iWorker)
+{
+    return config.bShared ? szPath + "/shared" : szPath + "/worker_" + std::to_string(iWorker);
+}
+
+// One worker of RunContention. A tenth of the operations create a group
+// directory that already exists, the rest create a leaf of its own or remove
+// one, up to CONTENTION_WINDOW live leaves. Every call has to succeed.
+void RunContentionWorker(const std::string& szParent, unsigned int iWorker, const ContentionConfig& config,
+                         ContentionShared* pShared, uint64_t* pLatencies, unsigned int uSeed)
+{
+    std::minstd_rand rng(uSeed);
+    std::vector<std::string> vLive;
+    uint64_t ulSeq = 0;
+    ContentionWorker& worker = pShared->workers[iWorker];
+    const std::string szPrefix = "/w" + std::to_string(iWorker) + "_";
+
+    pShared->nReady.fetch_add(1);
+    while (!pShared->bGo.load(std::memory_order_acquire)) {
+        sched_yield();
+    }
+    for (size_t i = 0; i < config.ulOps; ++i) {
+        uint32_t uDice = rng() % 100;
+        std::string szGroup = szParent + "/group_" + std::to_string(rng() % CONTENTION_GROUPS);
+        bool bSucceeded;
+        std::chrono::steady_clock::time_point start;
+        if (uDice < CONTENTION_EXISTING_PCT) {
+            start = std::chrono::steady_clock::now();
+            bSucceeded = CreateDir(szGroup, config.eMode);
+        } else if (vLive.size() < CONTENTION_WINDOW && (vLive.empty() || uDice % 2 == 0)) {
+            std::string szLeaf = szGroup + szPrefix + std::to_string(ulSeq++);
+            start = std::chrono::steady_clock::now();
+            bSucceeded = CreateDir(szLeaf, config.eMode);
+            if (bSucceeded) {
+                vLive.push_back(std::move(szLeaf));
+            }
+        } else {
+            std::swap(vLive[rng() % vLive.size()], vLive.back());
+            start = std::chrono::steady_clock::now();
+            bSucceeded = RemoveDir(vLive.back(), false);
+            vLive.pop_back();
+        }
+        pLatencies[i] = std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now() - start).count();
+        worker.ulFailures += bSucceeded ? 0 : 1;
+    }
+    worker.ulOps = config.ulOps;
+
+    // Untimed, a worker that succeeded leaves nothing behind
+    for (const auto& szLeaf : vLive) {
+        worker.ulFailures += RemoveDir(szLeaf, false) ? 0 : 1;
+    }
+}
+
+// Entries left in the groups of every parent
+uint64_t CountContentionLeaks(const std::string& szPath, const ContentionConfig& config)
+{
+    uint64_t ulLeaked = 0;
+    for (unsigned int i = 0; i < (config.bShared ? 1 : config.nWorkers); ++i) {
+        for (int iGroup = 0; iGroup < CONTENTION_GROUPS; ++iGroup) {
+            std::string szGroup = GetContentionParent(szPath, config, i) + "/group_" + std::to_string(iGroup);
+            DIR* pDir = opendir(szGroup.c_str());
+            if (pDir == nullptr) {
+                std::cerr << __FUNCTION__ << ": Failed to open " << szGroup << ", err: " << std::strerror(errno)
+                          << std::endl;
+                ++ulLeaked;
+                continue;
+            }
+            while (struct dirent* pDirent = readdir(pDir)) {
+                if (strcmp(pDirent->d_name, ".") != 0 && strcmp(pDirent->d_name, "..") != 0) {
+                    ++ulLeaked;
+                }
+            }
+            closedir(pDir);
+        }
+    }
+    return ulLeaked;
+}
+
+// nWorkers threads or processes run RunContentionWorker at once, released
+// together once all of them are up. Every trial starts from empty groups.
+bool RunContention(const ContentionConfig& config, const Options& options, const std::string& szPath,
+                   ContentionResult& result)
+{
+    size_t ulSize = sizeof(ContentionShared) + config.nWorkers * sizeof(ContentionWorker) +
+                    config.nWorkers * config.ulOps * sizeof(uint64_t);
+    void* pMap = mmap(nullptr, ulSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (pMap == MAP_FAILED) {
+        std::cerr << __FUNCTION__ << ": Failed to map " << ulSize << " bytes, err: " << std::strerror(errno)
+                  << std::endl;
+        return false;
+    }
+    ContentionShared* pShared = static_cast<ContentionShared*>(pMap);
+    uint64_t* pLatencies = reinterpret_cast<uint64_t*>(pShared->workers + config.nWorkers);
+
+    result.bench.vNs.clear();
+    result.bench.ulEntries = config.nWorkers * config.ulOps;
+    result.vLatencyNs.clear();
+    result.ulFailures = 0;
+    result.ulLeaked = 0;
+    bool bSucceeded = true;
+    for (int iTrial = 0; bSucceeded && iTrial < options.iWarmup + options.iTrials; ++iTrial) {
+        RemoveTree(szPath);
+        for (unsigned int i = 0; i < (config.bShared ? 1 : config.nWorkers); ++i) {
+            for (int iGroup = 0; iGroup < CONTENTION_GROUPS; ++iGroup) {
+                bSucceeded = CreateDir(GetContentionParent(szPath, config, i) + "/group_" + std::to_string(iGroup)) &&
+                             bSucceeded;
+            }
+        }
+        if (!bSucceeded) {
+            break;
+        }
+        memset(pMap, 0, ulSize);
+
+        std::vector<std::thread> vThreads;
+        std::vector<pid_t> vPids;
+        for (unsigned int i = 0; i < config.nWorkers; ++i) {
+            std::string szParent = GetContentionParent(szPath, config, i);
+            uint64_t* pWorkerLatencies = pLatencies + i * config.ulOps;
+            unsigned int uSeed = iTrial * config.nWorkers + i + 1;
+            if (!config.bProcesses) {
+                vThreads.emplace_back(RunContentionWorker, szParent, i, std::cref(config), pShared,
+                                      pWorkerLatencies, uSeed);
+                continue;
+            }
+            pid_t iPid = fork();
+            if (iPid == 0) {
+                RunContentionWorker(szParent, i, config, pShared, pWorkerLatencies, uSeed);
+                _exit(0);
+            }
+            if (iPid < 0) {
+                std::cerr << __FUNCTION__ << ": Failed to fork, err: " << std::strerror(errno) << std::endl;
+                bSucceeded = false;
+                break;
+            }
+            vPids.push_back(iPid);
+        }
+
+        // A failed fork still releases the workers already running
+        size_t ulStarted = vThreads.size() + vPids.size();
+        while (pShared->nReady.load() < ulStarted) {
+            sched_yield();
+        }
+        auto start = std::chrono::steady_clock::now();
+        pShared->bGo.store(true, std::memory_order_release);
+        for (auto& thread : vThreads) {
+            thread.join();
+        }
+        for (pid_t iPid : vPids) {
+            int iStatus = 0;
+            if (waitpid(iPid, &iStatus, 0) != iPid || !WIFEXITED(iStatus) || WEXITSTATUS(iStatus) != 0) {
+                std::cerr << __FUNCTION__ << ": Worker " << iPid << " did not exit cleanly" << std::endl;
+                bSucceeded = false;
+            }
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+
+        for (unsigned int i = 0; i < config.nWorkers; ++i) {
+            result.ulFailures += pShared->workers[i].ulFailures;
+            bSucceeded = bSucceeded && pShared->workers[i].ulOps == config.ulOps;
+        }
+        result.ulLeaked += CountContentionLeaks(szPath, config);
+        if (iTrial >= options.iWarmup) {
+            result.bench.vNs.push_back(std::chrono::duration<double, std::nano>(elapsed).count());
+            result.vLatencyNs.insert(result.vLatencyNs.end(), pLatencies,
+                                     pLatencies + config.nWorkers * config.ulOps);
+        }
+    }
+    RemoveTree(szPath);
+    munmap(pMap, ulSize);
+    if (!bSucceeded || result.bench.vNs.empty()) {
+        std::cerr << __FUNCTION__ << ": " << result.bench.szName << " failed" << std::endl;
+        return false;
+    }
+
+    std::sort(result.bench.vNs.begin(), result.bench.vNs.end());
+    std::sort(result.vLatencyNs.begin(), result.vLatencyNs.end());
+    result.bench.dMin = result.bench.vNs.front();
+    result.bench.dMedian = Percentile(result.bench.vNs, 0.5);
+    result.bench.dP99 = Percentile(result.bench.vNs, 0.99);
+    result.bench.dEntriesPerSec = result.bench.ulEntries / (result.bench.dMedian / 1e9);
+    return true;
+}
+
+// Latency percentile in microseconds
+double LatencyUs(const std::vector<uint64_t>& vSorted, double dQuantile)
+{
+    size_t ulRank = static_cast<size_t>(std::ceil(dQuantile * vSorted.size()));
+    return vSorted[std::min(vSorted.size() - 1, ulRank > 0 ? ulRank - 1 : 0)] / 1e3;
+}
+
+// Every worker count of --contention, shared and disjoint parents, both
+// CreateDir strategies that differ on EEXIST. Returns false if any call
+// failed or left entries behind.
+bool RunContentionSweep(const Options& options, const std::string& szPath, std::vector<BenchResult>& vResults)
+{
+    bool bCorrect = true;
+    std::cout << std::left << std::setw(40) << "benchmark" << std::right << std::setw(12) << "ops/s"
+              << std::setw(10) << "p50 us" << std::setw(10) << "p90 us" << std::setw(10) << "p99 us"
+              << std::setw(10) << "max us" << std::setw(10) << "failures" << std::setw(8) << "leaked" << std::endl;
+    for (bool bShared : { true, false }) {
+        for (CreateDirMode eMode : { CreateDirMode::StatFirst, CreateDirMode::MkdirFirst }) {
+            for (unsigned int nWorkers : options.vContention) {
+                ContentionConfig config{ bShared, eMode, nWorkers, options.bProcesses, options.ulOps };
+                ContentionResult result;
+                result.bench.szName = std::string("Contention/") + (bShared ? "shared/" : "disjoint/") +
+                                      (eMode == CreateDirMode::StatFirst ? "StatFirst/" : "MkdirFirst/") +
+                                      std::to_string(nWorkers) + (options.bProcesses ? " procs" : " threads");
+                if (!options.szFilter.empty() && result.bench.szName.find(options.szFilter) == std::string::npos) {
+                    continue;
+                }
+                if (!RunContention(config, options, szPath, result)) {
+                    bCorrect = false;
+                    continue;
+                }
+                std::cout << std::left << std::setw(40) << result.bench.szName << std::right << std::fixed
+                          << std::setprecision(0) << std::setw(12) << result.bench.dEntriesPerSec
+                          << std::setprecision(1) << std::setw(10) << LatencyUs(result.vLatencyNs, 0.5)
+                          << std::setw(10) << LatencyUs(result.vLatencyNs, 0.9) << std::setw(10)
+                          << LatencyUs(result.vLatencyNs, 0.99) << std::setw(10)
+                          << result.vLatencyNs.back() / 1e3 << std::setw(10) << result.ulFailures << std::setw(8)
+                          << result.ulLeaked << std::endl;
+                bCorrect = bCorrect && result.ulFailures == 0 && result.ulLeaked == 0;
+                vResults.push_back(result.bench);
+            }
+        }
+    }
+    return bCorrect;
+}
+
+bool WriteJson(const std::string& szFile, const Options& options, const std::vector<BenchResult>& vResults)
+{
+    std::ofstream file(szFile);
+    if (!file) {
+        std::cerr << __FUNCTION__ << ": Failed to open " << szFile << std::endl;
+        return false;
+    }
+
+    // One benchmark per line, ReadBaseline relies on it
+    file << std::fixed << std::setprecision(1);
+    file << "{\n  \"warmup\": " << options.iWarmup << ",\n  \"trials\": " << options.iTrials
+         << ",\n  \"benchmarks\": [\n";
+    for (size_t i = 0; i < vResults.size(); ++i) {
+        const BenchResult& result = vResults[i];
+        file << "    {\"name\": \"" << result.szName << "\", \"entries\": " << result.ulEntries
+             << ", \"min_ns\": " << result.dMin << ", \"median_ns\": " << result.dMedian
+             << ", \"p99_ns\": " << result.dP99 << ", \"entries_per_sec\": " << result.dEntriesPerSec
+             << ", \"samples_ns\": [";
+        for (size_t j = 0; j < result.vNs.size(); ++j) {
+            file << (j ? ", " : "") << result.vNs[j];
+        }
+        file << "]}" << (i + 1 < vResults.size() ? "," : "") << "\n";
+    }
+    file << "  ]\n}\n";
+    return static_cast<bool>(file);
+}
+
+// Benchmark name to median_ns of a file written by WriteJson
+bool ReadBaseline(const std::string& szFile, std::map<std::string, double>& mapMedians)
+{
+    std::ifstream file(szFile);
+    if (!file) {
+        std::cerr << __FUNCTION__ << ": Failed to open " << szFile << std::endl;
+        return false;
+    }
+
+    static const std::string szNameKey = "\"name\": \"";
+    static const std::string szMedianKey = "\"median_ns\": ";
+    std::string szLine;
+    while (std::getline(file, szLine)) {
+        size_t ulName = szLine.find(szNameKey);
+        size_t ulMedian = szLine.find(szMedianKey);
+        if (ulName == std::string::npos || ulMedian == std::string::npos) {
+            continue;
+        }
+        ulName += szNameKey.size();
+        size_t ulNameEnd = szLine.find('"', ulName);
+        if (ulNameEnd == std::string::npos) {
+            continue;
+        }
+        mapMedians[szLine.substr(ulName, ulNameEnd - ulName)] = atof(szLine.c_str() + ulMedian + szMedianKey.size());
+    }
+    return true;
+}
+
+// Print the change of every median, returns the number of regressions
+int CompareBaseline(const std::map<std::string, double>& mapBaseline, const std::vector<BenchResult>& vResults,
+                    double dThreshold)
+{
+    int iRegressions = 0;
+    std::cout << "\nCompared with baseline (threshold " << dThreshold << "%):" << std::endl;
+    for (const auto& result : vResults) {
+        auto it = mapBaseline.find(result.szName);
+        if (it == mapBaseline.end() || it->second <= 0) {
+            std::cout << "  " << std::left << std::setw(48) << result.szName << "not in baseline" << std::endl;
+            continue;
+        }
+        double dChange = (result.dMedian / it->second - 1.0) * 100.0;
+        bool bRegressed = dChange > dThreshold;
+        iRegressions += bRegressed ? 1 : 0;
+        std::cout << "  " << std::left << std::setw(48) << result.szName << std::right << std::showpos
+                  << std::fixed << std::setprecision(1) << std::setw(8) << dChange << "%" << std::noshowpos
+                  << (bRegressed ? "  REGRESSION" : "") << std::endl;
+    }
+    return iRegressions;
+}
+}
+
+int main(int argc, char* argv[]) {
+    Options options;
+    if (!ParseOptions(argc, argv, options)) {
+        PrintUsage(argv[0]);
+        return 2;
+    }
+
+    if (options.bTmpfs) {
+        std::string szTmpfs = FindTmpfsDir();
+        if (szTmpfs.empty()) {
+            std::cerr << "No writable tmpfs found, set $TMPFS_DIR" << std::endl;
+            return 2;
+        }
+        options.szRoot = szTmpfs + "/bench_fileio." + std::to_string(getpid());
+    }
+
+    // RemoveDir takes absolute paths
+    if (mkdir(options.szRoot.c_str(), 0755) != 0 && errno != EEXIST) {
+        std::cerr << "Failed to create " << options.szRoot << ", err: " << std::strerror(errno) << std::endl;
+        return 2;
+    }
+    char absPath[PATH_MAX];
+    if (realpath(options.szRoot.c_str(), absPath) == nullptr) {
+        std::cerr << "Failed to resolve " << options.szRoot << ", err: " << std::strerror(errno) << std::endl;
+        return 2;
+    }
+    const std::string szFixture = std::string(absPath) + "/fixture";
+
+    std::vector<BenchResult> vResults;
+    bool bCorrect = true;
+    if (!options.vContention.empty()) {
+        bCorrect = RunContentionSweep(options, szFixture, vResults);
+    } else {
+        std::cout << std::left << std::setw(48) << "benchmark" << std::right << std::setw(10) << "entries"
+                  << std::setw(12) << "min ms" << std::setw(12) << "median ms" << std::setw(12) << "p99 ms"
+                  << std::setw(14) << "entries/s" << std::endl;
+        for (const auto& shape : options.vShapes) {
+            for (const auto& benchmark : MakeBenchmarks(shape, options.nThreads)) {
+                if (!options.szFilter.empty() && benchmark.szName.find(options.szFilter) == std::string::npos) {
+                    continue;
+                }
+                BenchResult result;
+                if (!RunBenchmark(benchmark, options, szFixture, result)) {
+                    RemoveTree(szFixture);
+                    continue;
+                }
+                std::cout << std::left << std::setw(48) << result.szName << std::right << std::setw(10)
+                          << result.ulEntries << std::fixed << std::setprecision(3) << std::setw(12)
+                          << result.dMin / 1e6 << std::setw(12) << result.dMedian / 1e6 << std::setw(12)
+                          << result.dP99 / 1e6 << std::setprecision(0) << std::setw(14) << result.dEntriesPerSec
+                          << std::endl;
+                vResults.push_back(result);
+            }
+        }
+    }
+    rmdir(absPath);
+
+    if (!options.szJson.empty() && !WriteJson(options.szJson, options, vResults)) {
+        return 2;
+    }
+    if (!options.szBaseline.empty()) {
+        std::map<std::string, double> mapBaseline;
+        if (!ReadBaseline(options.szBaseline, mapBaseline)) {
+            return 2;
+        }
+        if (CompareBaseline(mapBaseline, vResults, options.dThreshold) > 0) {
+            return 1;
+        }
+    }
+    if (!bCorrect) {
+        std::cerr << "Contention: failed calls or leaked entries" << std::endl;
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,345 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "DirCache.h"
+#include <cerrno>
+#include <climits>
+#include <cstring>
+#include <dirent.h>
+#include <fcntl.h>
+#include <iostream>
+#include <mutex>
+#include <poll.h>
+#include <sys/inotify.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <vector>
+
+#define DIR_CACHE_EVENT_BUFFER      65536
+#define DIR_CACHE_MASK              (IN_CREATE | IN_DELETE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE_SELF | \
+                                     IN_MOVE_SELF | IN_ONLYDIR | IN_DONT_FOLLOW)
+
+// Never destroyed: removals on threads that outlive the static destructors,
+// such as the TrashReclaimer workers, still sync it. Its thread sleeps in
+// poll until the process exits.
+DirCache& DirCache::Instance() {
+    static DirCache* pCache = new DirCache();
+    return *pCache;
+}
+
+DirCache::DirCache()
+    : m_iFd(-1), m_ulRootComponents(0), m_ulMaxWatches(DIR_CACHE_WATCHES), m_bValid(false),
+      m_pRoot(nullptr), m_ulLookups(0), m_ulUnknown(0) {
+}
+
+std::atomic<bool> DirCache::s_bWatching(false);
+
+bool DirCache::watch(const std::string& szRoot, size_t ulMaxWatches) {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    char szReal[PATH_MAX];
+    if (realpath(szRoot.c_str(), szReal) == nullptr) {
+        std::cerr << __FUNCTION__ << ": Failed to resolve '" << szRoot << "', err: " << strerror(errno) << std::endl;
+        return false;
+    }
+    if (m_iFd < 0) {
+        m_iFd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+        if (m_iFd < 0) {
+            std::cerr << __FUNCTION__ << ": Failed to init inotify, err: " << strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    if (!m_thread.joinable()) {
+        m_thread = std::thread(&DirCache::run, this);
+    }
+
+    m_szRoot = szReal;
+    m_ulRootComponents = 0;
+    for (size_t i = 0; i < m_szRoot.size(); ++i) {
+        if (m_szRoot[i] != '/' && (i == 0 || m_szRoot[i - 1] == '/')) {
+            ++m_ulRootComponents;
+        }
+    }
+    m_ulMaxWatches = ulMaxWatches;
+    m_stats = DirCacheStats();
+    m_ulLookups = 0;
+    m_ulUnknown = 0;
+    s_bWatching.store(true, std::memory_order_release);
+    return rescanLocked();
+}
+
+void DirCache::unwatch() {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    resetLocked();
+    m_szRoot.clear();
+    s_bWatching.store(false, std::memory_order_release);
+}
+
+void DirCache::sync() {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (m_iFd >= 0) {
+        drainLocked();
+    }
+}
+
+int DirCache::lookup(std::string_view szPath) const {
+    std::shared_lock<std::shared_mutex> lock(m_mutex);
+    m_ulLookups.fetch_add(1, std::memory_order_relaxed);
+
+    const size_t ulRootLength = m_szRoot == "/" ? 0 : m_szRoot.size();
+    if (!m_bValid || szPath.compare(0, ulRootLength, m_szRoot, 0, ulRootLength) != 0 ||
+        (szPath.size() > ulRootLength && szPath[ulRootLength] != '/')) {
+        m_ulUnknown.fetch_add(1, std::memory_order_relaxed);
+        return -1;
+    }
+
+    // Walk the components below the root
+    int iExisting = static_cast<int>(m_ulRootComponents);
+    const TrieNode* pNode = m_pRoot;
+    size_t ulPos = ulRootLength;
+    while (ulPos < szPath.size()) {
+        size_t ulStart = ulPos + 1;
+        size_t ulEnd = szPath.find('/', ulStart);
+        if (ulEnd == std::string_view::npos) {
+            ulEnd = szPath.size();
+        }
+        if (!findEntry(pNode)->bComplete) {
+            m_ulUnknown.fetch_add(1, std::memory_order_relaxed);
+            return -1;
+        }
+        const TrieNode* pChild = pNode->getChild(szPath.substr(ulStart, ulEnd - ulStart));
+        if (pChild == nullptr || !findEntry(pChild)->bExists) {
+            break;
+        }
+        pNode = pChild;
+        ++iExisting;
+        ulPos = ulEnd;
+    }
+    return iExisting;
+}
+
+DirCacheStats DirCache::getStats() {
+    std::unique_lock<std::shared_mutex> lock(m_mutex);
+    if (m_iFd >= 0) {
+        drainLocked();
+    }
+    DirCacheStats stats = m_stats;
+    stats.ulLookups = m_ulLookups.load(std::memory_order_relaxed);
+    stats.ulUnknown = m_ulUnknown.load(std::memory_order_relaxed);
+    stats.ulWatches = m_mapWatches.size();
+    stats.ulDirs = 0;
+    for (const Entry& entry : m_entries) {
+        stats.ulDirs += entry.bExists ? 1 : 0;
+    }
+    return stats;
+}
+
+// Every node gets its entry from the writer that inserts it
+const DirCache::Entry* DirCache::findEntry(const TrieNode* pNode) {
+    return static_cast<const Entry*>(pNode->getData());
+}
+
+DirCache::Entry& DirCache::getEntry(TrieNode* pNode) {
+    if (pNode->getData() == nullptr) {
+        m_entries.emplace_back();
+        pNode->setData(&m_entries.back());
+    }
+    return *static_cast<Entry*>(pNode->getData());
+}
+
+void DirCache::resetLocked() {
+    for (const auto& watch : m_mapWatches) {
+        inotify_rm_watch(m_iFd, watch.first);
+    }
+    m_mapWatches.clear();
+    m_pTrie.reset();
+    m_entries.clear();
+    m_pRoot = nullptr;
+    m_bValid = false;
+}
+
+bool DirCache::rescanLocked() {
+    resetLocked();
+    m_pTrie.reset(new PathTrie());
+    m_pRoot = m_pTrie->insert(m_szRoot);
+    m_bValid = scanLocked(m_pRoot);
+    if (!m_bValid) {
+        std::cerr << "DirCache: Failed to watch '" << m_szRoot << "'" << std::endl;
+    }
+    return m_bValid;
+}
+
+// Watch and list pNode and every directory below it, as far as the budget
+// goes. The watch comes first, so nothing created during the listing is
+// missed. Returns false if pNode could not be watched.
+bool DirCache::scanLocked(TrieNode* pNode) {
+    std::vector<TrieNode*> vStack(1, pNode);
+    TrieNode* pFirst = pNode;
+    std::string szPath;
+    while (!vStack.empty()) {
+        pNode = vStack.back();
+        vStack.pop_back();
+        Entry& entry = getEntry(pNode);
+        entry.bExists = true;
+        if (entry.bComplete) {
+            continue;
+        }
+        if (entry.iWd < 0) {
+            if (m_mapWatches.size() >= m_ulMaxWatches) {
+                continue;
+            }
+            TrieNode::getFullPath(pNode, szPath);
+            int iWd = inotify_add_watch(m_iFd, szPath.c_str(), DIR_CACHE_MASK);
+            if (iWd < 0) {
+                // ENOSPC is the system wide watch limit, the budget runs out early
+                if (errno == ENOENT || errno == ENOTDIR) {
+                    entry.bExists = false;
+                }
+                continue;
+            }
+            entry.iWd = iWd;
+            m_mapWatches[iWd] = pNode;
+        }
+
+        // Children recorded before are stale, e.g. after an unmount
+        pNode->forEachChild([this](TrieNode* pChild) { markGoneLocked(pChild); });
+
+        TrieNode::getFullPath(pNode, szPath);
+        DIR* pDir = opendir(szPath.c_str());
+        if (pDir == nullptr) {
+            continue;
+        }
+        int iDirFd = dirfd(pDir);
+        while (struct dirent* pDirent = readdir(pDir)) {
+            const char* szName = pDirent->d_name;
+            if (szName[0] == '.' && (szName[1] == '\0' || (szName[1] == '.' && szName[2] == '\0'))) {
+                continue;
+            }
+            unsigned char ucType = pDirent->d_type;
+            if (ucType == DT_UNKNOWN) {
+                struct stat st;
+                if (fstatat(iDirFd, szName, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    continue;
+                }
+                ucType = IFTODT(st.st_mode);
+            }
+            if (ucType == DT_DIR) {
+                TrieNode* pChild = m_pTrie->insertChild(pNode, szName);
+                getEntry(pChild).bExists = true;
+                vStack.push_back(pChild);
+            }
+        }
+        closedir(pDir);
+        entry.bComplete = true;
+    }
+    return getEntry(pFirst).bComplete;
+}
+
+// pNode and everything below it is gone
+void DirCache::markGoneLocked(TrieNode* pNode) {
+    std::vector<TrieNode*> vStack(1, pNode);
+    while (!vStack.empty()) {
+        pNode = vStack.back();
+        vStack.pop_back();
+        Entry& entry = getEntry(pNode);
+        entry.bExists = false;
+        unwatchLocked(entry);
+        pNode->forEachChild([&vStack](TrieNode* pChild) { vStack.push_back(pChild); });
+    }
+}
+
+void DirCache::unwatchLocked(Entry& entry) {
+    if (entry.iWd >= 0) {
+        // Fails with EINVAL if the kernel dropped the watch already
+        inotify_rm_watch(m_iFd, entry.iWd);
+        m_mapWatches.erase(entry.iWd);
+        entry.iWd = -1;
+    }
+    entry.bComplete = false;
+}
+
+void DirCache::drainLocked() {
+    alignas(struct inotify_event) char buffer[DIR_CACHE_EVENT_BUFFER];
+    while (true) {
+        ssize_t lRead = read(m_iFd, buffer, sizeof(buffer));
+        if (lRead <= 0) {
+            if (lRead < 0 && errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+
+        for (ssize_t lPos = 0; lPos < lRead; ) {
+            const struct inotify_event* pEvent = reinterpret_cast<const struct inotify_event*>(buffer + lPos);
+            lPos += sizeof(struct inotify_event) + pEvent->len;
+            ++m_stats.ulEvents;
+
+            if (pEvent->mask & IN_Q_OVERFLOW) {
+                // Events were lost, nothing in the mirror can be trusted
+                ++m_stats.ulRescans;
+                rescanLocked();
+                continue;
+            }
+            auto it = m_mapWatches.find(pEvent->wd);
+            if (it == m_mapWatches.end()) {
+                continue;   // a watch removed meanwhile
+            }
+            TrieNode* pNode = it->second;
+
+            if (pEvent->mask & (IN_IGNORED | IN_DELETE_SELF | IN_MOVE_SELF)) {
+                // The parent reports the delete or move, only the watch goes here
+                if (pNode == m_pRoot) {
+                    m_bValid = false;
+                }
+                unwatchLocked(getEntry(pNode));
+                continue;
+            }
+            if (!(pEvent->mask & IN_ISDIR) || pEvent->len == 0) {
+                continue;
+            }
+            if (pEvent->mask & (IN_CREATE | IN_MOVED_TO)) {
+                // A moved in directory brings its subtree along
+                TrieNode* pChild = m_pTrie->insertChild(pNode, pEvent->name);
+                unwatchLocked(getEntry(pChild));
+                scanLocked(pChild);
+            } else if (pEvent->mask & (IN_DELETE | IN_MOVED_FROM)) {
+                TrieNode* pChild = pNode->getChild(pEvent->name);
+                if (pChild) {
+                    markGoneLocked(pChild);
+                }
+            }
+        }
+    }
+}
+
+// Applies events as they arrive, the lock is only taken while there are some
+void DirCache::run() {
+    struct pollfd fd = { m_iFd, POLLIN, 0 };
+    while (true) {
+        if (poll(&fd, 1, -1) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "DirCache: Failed to poll, err: " << strerror(errno) << std::endl;
+            return;
+        }
+        if (fd.revents != 0) {
+            std::unique_lock<std::shared_mutex> lock(m_mutex);
+            drainLocked();
+        }
+    }
+}
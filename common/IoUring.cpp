@@ -0,0 +1,298 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "IoUring.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "syscall_stats.h"
+
+namespace {
+int SysIoUringSetup(unsigned int iEntries, struct io_uring_params* pParams)
+{
+    return static_cast<int>(syscall(__NR_io_uring_setup, iEntries, pParams));
+}
+
+int SysIoUringEnter(int iRingFd, unsigned int iToSubmit, unsigned int iMinComplete, unsigned int iFlags)
+{
+    SYSCALL_COUNT(IoUringEnter);
+    return static_cast<int>(syscall(__NR_io_uring_enter, iRingFd, iToSubmit, iMinComplete, iFlags, nullptr, 0));
+}
+
+int SysIoUringRegister(int iRingFd, unsigned int iOpcode, void* pArg, unsigned int iArgs)
+{
+    return static_cast<int>(syscall(__NR_io_uring_register, iRingFd, iOpcode, pArg, iArgs));
+}
+
+unsigned int* RingField(void* pRing, unsigned int iOffset)
+{
+    return reinterpret_cast<unsigned int*>(static_cast<char*>(pRing) + iOffset);
+}
+
+// Ask the kernel which opcodes it knows about
+bool ProbeIoUring()
+{
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    int iFd = SysIoUringSetup(1, &params);
+    if (iFd < 0) {
+        return false;
+    }
+    size_t ulProbeSize = sizeof(struct io_uring_probe) + IORING_OP_LAST * sizeof(struct io_uring_probe_op);
+    struct io_uring_probe* pProbe = static_cast<struct io_uring_probe*>(calloc(1, ulProbeSize));
+    bool bSupported = false;
+    if (pProbe && SysIoUringRegister(iFd, IORING_REGISTER_PROBE, pProbe, IORING_OP_LAST) == 0) {
+        const int ops[] = { IORING_OP_MKDIRAT, IORING_OP_UNLINKAT, IORING_OP_STATX };
+        bSupported = true;
+        for (int iOp : ops) {
+            if (iOp > pProbe->last_op || !(pProbe->ops[iOp].flags & IO_URING_OP_SUPPORTED)) {
+                bSupported = false;
+            }
+        }
+    }
+    free(pProbe);
+    close(iFd);
+    return bSupported;
+}
+}
+
+IoUring::IoUring()
+    : m_iRingFd(-1), m_pSqRing(MAP_FAILED), m_pCqRing(MAP_FAILED),
+      m_ulSqRingSize(0), m_ulCqRingSize(0), m_pSqes(nullptr), m_ulSqesSize(0),
+      m_pSqHead(nullptr), m_pSqTail(nullptr), m_pSqMask(nullptr), m_pSqArray(nullptr),
+      m_pCqHead(nullptr), m_pCqTail(nullptr), m_pCqMask(nullptr), m_pCqes(nullptr),
+      m_iEntries(0), m_iQueued(0) {}
+
+IoUring::~IoUring() {
+    release();
+}
+
+bool IoUring::init(unsigned int iEntries) {
+    release();
+
+    struct io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    m_iRingFd = SysIoUringSetup(iEntries, &params);
+    if (m_iRingFd < 0) {
+        return false;
+    }
+
+    m_ulSqRingSize = params.sq_off.array + params.sq_entries * sizeof(unsigned int);
+    m_ulCqRingSize = params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe);
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_ulSqRingSize = m_ulCqRingSize = std::max(m_ulSqRingSize, m_ulCqRingSize);
+    }
+
+    m_pSqRing = mmap(nullptr, m_ulSqRingSize, PROT_READ | PROT_WRITE,
+                     MAP_SHARED | MAP_POPULATE, m_iRingFd, IORING_OFF_SQ_RING);
+    if (m_pSqRing == MAP_FAILED) {
+        release();
+        return false;
+    }
+    if (params.features & IORING_FEAT_SINGLE_MMAP) {
+        m_pCqRing = m_pSqRing;
+    } else {
+        m_pCqRing = mmap(nullptr, m_ulCqRingSize, PROT_READ | PROT_WRITE,
+                         MAP_SHARED | MAP_POPULATE, m_iRingFd, IORING_OFF_CQ_RING);
+        if (m_pCqRing == MAP_FAILED) {
+            release();
+            return false;
+        }
+    }
+
+    m_ulSqesSize = params.sq_entries * sizeof(struct io_uring_sqe);
+    void* pSqes = mmap(nullptr, m_ulSqesSize, PROT_READ | PROT_WRITE,
+                       MAP_SHARED | MAP_POPULATE, m_iRingFd, IORING_OFF_SQES);
+    if (pSqes == MAP_FAILED) {
+        release();
+        return false;
+    }
+    m_pSqes = static_cast<struct io_uring_sqe*>(pSqes);
+
+    m_pSqHead = RingField(m_pSqRing, params.sq_off.head);
+    m_pSqTail = RingField(m_pSqRing, params.sq_off.tail);
+    m_pSqMask = RingField(m_pSqRing, params.sq_off.ring_mask);
+    m_pSqArray = RingField(m_pSqRing, params.sq_off.array);
+    m_pCqHead = RingField(m_pCqRing, params.cq_off.head);
+    m_pCqTail = RingField(m_pCqRing, params.cq_off.tail);
+    m_pCqMask = RingField(m_pCqRing, params.cq_off.ring_mask);
+    m_pCqes = reinterpret_cast<struct io_uring_cqe*>(static_cast<char*>(m_pCqRing) + params.cq_off.cqes);
+
+    m_iEntries = params.sq_entries;
+    m_iQueued = 0;
+    return true;
+}
+
+bool IoUring::isReady() const {
+    return m_iRingFd >= 0;
+}
+
+bool IoUring::IsSupported() {
+    static const bool bSupported = ProbeIoUring();
+    return bSupported;
+}
+
+unsigned int IoUring::freeSlots() const {
+    return m_iEntries - m_iQueued;
+}
+
+unsigned int IoUring::capacity() const {
+    return m_iEntries;
+}
+
+io_uring_sqe* IoUring::getSqe() {
+    if (!isReady() || m_iQueued >= m_iEntries) {
+        return nullptr;
+    }
+
+    // Only this thread produces, the kernel consumes up to the tail we publish
+    unsigned int iTail = *m_pSqTail + m_iQueued;
+    unsigned int iIndex = iTail & *m_pSqMask;
+    struct io_uring_sqe* pSqe = &m_pSqes[iIndex];
+    memset(pSqe, 0, sizeof(*pSqe));
+    m_pSqArray[iIndex] = iIndex;
+    ++m_iQueued;
+    return pSqe;
+}
+
+bool IoUring::prepMkdirat(int iDirFd, const char* szPath, mode_t mode,
+                          uint64_t ulUserData, unsigned int iSqeFlags) {
+    struct io_uring_sqe* pSqe = getSqe();
+    if (!pSqe) {
+        return false;
+    }
+    pSqe->opcode = IORING_OP_MKDIRAT;
+    pSqe->fd = iDirFd;
+    pSqe->addr = reinterpret_cast<uint64_t>(szPath);
+    pSqe->len = mode;
+    pSqe->flags = static_cast<uint8_t>(iSqeFlags);
+    pSqe->user_data = ulUserData;
+    return true;
+}
+
+bool IoUring::prepUnlinkat(int iDirFd, const char* szPath, int iFlags,
+                           uint64_t ulUserData, unsigned int iSqeFlags) {
+    struct io_uring_sqe* pSqe = getSqe();
+    if (!pSqe) {
+        return false;
+    }
+    pSqe->opcode = IORING_OP_UNLINKAT;
+    pSqe->fd = iDirFd;
+    pSqe->addr = reinterpret_cast<uint64_t>(szPath);
+    pSqe->unlink_flags = static_cast<uint32_t>(iFlags);
+    pSqe->flags = static_cast<uint8_t>(iSqeFlags);
+    pSqe->user_data = ulUserData;
+    return true;
+}
+
+bool IoUring::prepStatx(int iDirFd, const char* szPath, int iFlags, unsigned int iMask,
+                        struct statx* pStatx, uint64_t ulUserData, unsigned int iSqeFlags) {
+    struct io_uring_sqe* pSqe = getSqe();
+    if (!pSqe) {
+        return false;
+    }
+    pSqe->opcode = IORING_OP_STATX;
+    pSqe->fd = iDirFd;
+    pSqe->addr = reinterpret_cast<uint64_t>(szPath);
+    pSqe->len = iMask;
+    pSqe->off = reinterpret_cast<uint64_t>(pStatx);
+    pSqe->statx_flags = static_cast<uint32_t>(iFlags);
+    pSqe->flags = static_cast<uint8_t>(iSqeFlags);
+    pSqe->user_data = ulUserData;
+    return true;
+}
+
+bool IoUring::submitAndWait(const std::function<void(uint64_t, int)>& onComplete) {
+    if (!isReady()) {
+        errno = EBADF;
+        return false;
+    }
+
+    unsigned int iInflight = m_iQueued;
+    if (iInflight == 0) {
+        return true;
+    }
+
+    // Publish the new tail before entering the kernel
+    __atomic_store_n(m_pSqTail, *m_pSqTail + m_iQueued, __ATOMIC_RELEASE);
+    m_iQueued = 0;
+
+    // Once io_uring_enter failed, the operations already submitted still
+    // write to the caller's buffers, so they are waited for before returning.
+    // The rest stays in the SQ, the ring is released and set up again later.
+    int iErrno = 0;
+    unsigned int iToSubmit = iInflight;
+    while (iInflight > 0) {
+        int iRet = SysIoUringEnter(m_iRingFd, iToSubmit, iInflight, IORING_ENTER_GETEVENTS);
+        if (iRet < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            iErrno = errno;
+            if (iToSubmit == 0) {
+                break;
+            }
+            // Nothing of this submit went in, wait for the earlier ones only
+            iInflight -= iToSubmit;
+            iToSubmit = 0;
+            continue;
+        }
+        iToSubmit -= std::min(iToSubmit, static_cast<unsigned int>(iRet));
+
+        unsigned int iHead = *m_pCqHead;
+        unsigned int iTail = __atomic_load_n(m_pCqTail, __ATOMIC_ACQUIRE);
+        for (; iHead != iTail; ++iHead) {
+            const struct io_uring_cqe& cqe = m_pCqes[iHead & *m_pCqMask];
+            onComplete(cqe.user_data, cqe.res);
+            --iInflight;
+        }
+        __atomic_store_n(m_pCqHead, iHead, __ATOMIC_RELEASE);
+    }
+    if (iErrno != 0) {
+        release();
+        errno = iErrno;
+        return false;
+    }
+    return true;
+}
+
+void IoUring::release() {
+    if (m_pSqes) {
+        munmap(m_pSqes, m_ulSqesSize);
+        m_pSqes = nullptr;
+    }
+    if (m_pCqRing != MAP_FAILED && m_pCqRing != m_pSqRing) {
+        munmap(m_pCqRing, m_ulCqRingSize);
+    }
+    if (m_pSqRing != MAP_FAILED) {
+        munmap(m_pSqRing, m_ulSqRingSize);
+    }
+    m_pSqRing = m_pCqRing = MAP_FAILED;
+    if (m_iRingFd >= 0) {
+        close(m_iRingFd);
+        m_iRingFd = -1;
+    }
+    m_iEntries = 0;
+    m_iQueued = 0;
+}
@@ -20,50 +20,248 @@
 #include "TrieNode.h"
 #include <algorithm>
 #include <iostream>
-#include <sstream>
 
-PathTrie::PathTrie() : root(std::make_unique<TrieNode>("/")) {}
+namespace {
+// Walk the components of a relative path without allocating, false on an
+// empty component. The visitor returns false to stop early.
+template <typename Visitor>
+bool ForEachRelativeComponent(std::string_view path, Visitor visit) {
+    while (!path.empty()) {
+        size_t pos = path.find('/');
+        std::string_view part = path.substr(0, pos);
+        if (part.empty()) {
+            return false;
+        }
+        if (!visit(part)) {
+            return true;
+        }
+        path.remove_prefix(pos == std::string_view::npos ? path.size() : pos + 1);
+    }
+    return true;
+}
 
-PathTrie::~PathTrie() = default;
+// Strip the leading '/' and a single trailing '/' of an absolute path.
+// Returns false if the path is empty or relative.
+bool TrimAbsolutePath(std::string_view& path) {
+    if (path.empty() || path.front() != '/') {
+        return false;
+    }
+    path.remove_prefix(1);
+    if (path.size() > 1 && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+    return true;
+}
 
-TrieNode* PathTrie::insert(const std::string& path) {
-    TrieNode* node = root.get();
-    std::istringstream ss(path);
-    std::string part;
+// Walk the components of an absolute path, false on an invalid path
+template <typename Visitor>
+bool ForEachComponent(std::string_view path, Visitor visit) {
+    return TrimAbsolutePath(path) && ForEachRelativeComponent(path, visit);
+}
 
-    // Validate the input path
-    if(path == "") {
-        return nullptr;
+// Length of the longest common prefix of edge and rest that ends on a
+// component boundary of both
+size_t CommonComponentPrefix(std::string_view edge, std::string_view rest) {
+    size_t common = 0;
+    size_t i = 0;
+    while (i < edge.size() && i < rest.size() && edge[i] == rest[i]) {
+        ++i;
+        if (i < edge.size() && edge[i] == '/' && (i == rest.size() || rest[i] == '/')) {
+            common = i;
+        }
+    }
+    if (i == edge.size() && (i == rest.size() || rest[i] == '/')) {
+        common = i;
+    }
+    return common;
+}
+}
+
+PathTrie::PathTrie(PathTrieMode mode)
+    : root(nullptr), radix(mode == PathTrieMode::Radix), nodeCount(1) {
+    if (mode == PathTrieMode::Arena || mode == PathTrieMode::Radix) {
+        arena = std::make_unique<TrieArena>();
+        root = TrieNode::Create(arena.get(), "/");
+    } else {
+        root = new TrieNode("/");
+    }
+    if (mode == PathTrieMode::Concurrent) {
+        locks = std::make_unique<std::mutex[]>(LOCK_STRIPES);
+    }
+}
+
+PathTrie::~PathTrie() {
+    // Arena nodes are released together with the arena
+    if (!arena) {
+        delete root;
+    }
+}
+
+TrieNode* PathTrie::createChild(TrieNode* parent, std::string_view part) {
+    TrieNode* node = arena ? TrieNode::Create(arena.get(), part) : new TrieNode(std::string(part));
+    node->setParent(parent);
+    parent->addChild(node);
+    nodeCount.fetch_add(1, std::memory_order_relaxed);
+    return node;
+}
+
+TrieNode* PathTrie::insertShared(TrieNode* parent, std::string_view part, bool& bInserted) {
+    TrieNode* node = parent->findShared(part);
+    if (node) {
+        return node;
+    }
+
+    std::lock_guard<std::mutex> lock(locks[std::hash<TrieNode*>()(parent) % LOCK_STRIPES]);
+    // Another writer may have won the race while we waited for the lock
+    node = parent->findShared(part);
+    if (node) {
+        return node;
+    }
+    node = new TrieNode(std::string(part));
+    node->setParent(parent);
+    parent->linkShared(node);
+    nodeCount.fetch_add(1, std::memory_order_relaxed);
+    bInserted = true;
+    return node;
+}
+
+// Cut the value of node after length characters. The head keeps the place
+// of node below its parent, node keeps the tail and moves below the head, so
+// pointers to node stay valid and still denote the same path.
+TrieNode* PathTrie::splitEdge(TrieNode* node, size_t length) {
+    const std::string& value = node->getNodeValue();
+    TrieNode* parent = node->getParent();
+    TrieNode* head = TrieNode::Create(arena.get(), std::string_view(value).substr(0, length));
+    head->setParent(parent);
+    parent->replaceChild(node, head);
+    node->setNodeValue(std::string_view(value).substr(length + 1));
+    node->setParent(head);
+    head->addChild(node);
+    nodeCount.fetch_add(1, std::memory_order_relaxed);
+    return head;
+}
+
+TrieNode* PathTrie::insertRadix(TrieNode* node, std::string_view rest) {
+    while (!rest.empty()) {
+        TrieNode* child = node->getChild(rest.substr(0, rest.find('/')));
+        if (!child) {
+            // The whole remainder becomes one edge
+            return createChild(node, rest);
+        }
+
+        const std::string& edge = child->getNodeValue();
+        size_t common = CommonComponentPrefix(edge, rest);
+        node = common == edge.size() ? child : splitEdge(child, common);
+        rest.remove_prefix(common == rest.size() ? common : common + 1);
     }
-    if(path == "/") {
-        return root.get();
+    return node;
+}
+
+TrieNode* PathTrie::insert(std::string_view path, bool* pInserted) {
+    TrieNode* node = root;
+    bool bInserted = false;
+    bool valid;
+    if (radix) {
+        // Validate every component up front, insertRadix takes them as one string
+        size_t ulCount = nodeCount.load(std::memory_order_relaxed);
+        valid = TrimAbsolutePath(path) &&
+                ForEachRelativeComponent(path, [](std::string_view) { return true; });
+        node = valid ? insertRadix(root, path) : nullptr;
+        // Any new node on the way means the last one is new as well
+        bInserted = nodeCount.load(std::memory_order_relaxed) != ulCount;
+    } else if (locks) {
+        valid = ForEachComponent(path, [this, &node, &bInserted](std::string_view part) {
+            bInserted = false;
+            node = insertShared(node, part, bInserted);
+            return true;
+        });
+    } else {
+        valid = ForEachComponent(path, [this, &node, &bInserted](std::string_view part) {
+            TrieNode* child = node->getChild(part);
+            bInserted = !child;
+            node = child ? child : createChild(node, part);
+            return true;
+        });
+    }
+
+    if (pInserted) {
+        *pInserted = valid && bInserted;
+    }
+    return valid ? node : nullptr;
+}
+
+TrieNode* PathTrie::insertChild(TrieNode* parent, std::string_view part, bool* pInserted) {
+    if (pInserted) {
+        *pInserted = false;
     }
-    // Path does not start with '/'
-    if(!path.empty() && path.front() != '/') {
+    if (!parent || part.empty() || part.find('/') != std::string_view::npos) {
         return nullptr;
     }
-    // Exclude the first empty string before the '/'
-    std::getline(ss, part, '/');
-    while (std::getline(ss, part, '/')) {
-        if (part.empty()) {
-            // Error log
+
+    TrieNode* node;
+    bool bInserted = false;
+    if (radix) {
+        size_t ulCount = nodeCount.load(std::memory_order_relaxed);
+        node = insertRadix(parent, part);
+        bInserted = nodeCount.load(std::memory_order_relaxed) != ulCount;
+    } else if (locks) {
+        node = insertShared(parent, part, bInserted);
+    } else {
+        node = parent->getChild(part);
+        bInserted = !node;
+        node = node ? node : createChild(parent, part);
+    }
+
+    if (pInserted) {
+        *pInserted = bInserted;
+    }
+    return node;
+}
+
+TrieNode* PathTrie::find(std::string_view path) const {
+    if (radix) {
+        if (!TrimAbsolutePath(path)) {
             return nullptr;
         }
-        if (!node->getChild(part)) {
-            auto newNode = std::make_unique<TrieNode>(part);
-            newNode->setParent(node);
-            node->addChild(part, std::move(newNode));
+        TrieNode* node = root;
+        while (node && !path.empty()) {
+            node = node->getChild(path.substr(0, path.find('/')));
+            if (!node) {
+                break;
+            }
+            // The edge has to match whole components of the remainder
+            const std::string& edge = node->getNodeValue();
+            if (path.compare(0, edge.size(), edge) != 0 ||
+                (path.size() > edge.size() && path[edge.size()] != '/')) {
+                return nullptr;
+            }
+            path.remove_prefix(std::min(path.size(), edge.size() + 1));
         }
-        node = node->getChild(part);
+        return node;
     }
 
-    return node;
+    TrieNode* node = root;
+    bool shared = locks != nullptr;
+    bool valid = ForEachComponent(path, [&node, shared](std::string_view part) {
+        node = shared ? node->findShared(part) : node->getChild(part);
+        return node != nullptr;
+    });
+
+    return valid ? node : nullptr;
+}
+
+size_t PathTrie::getNodeCount() const {
+    return nodeCount.load(std::memory_order_relaxed);
+}
+
+bool PathTrie::walk(TrieOrder order, const std::function<TrieVisit(TrieNode*, size_t)>& visit, bool bSorted) {
+    return TrieWalker::Walk(root, order, visit, bSorted);
 }
 
 void PathTrie::print() {
-    root.get()->print();
+    root->print();
 }
 
 TrieNode* PathTrie::GetRoot() {
-    return root.get();
+    return root;
 }
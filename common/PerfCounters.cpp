@@ -0,0 +1,253 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "PerfCounters.h"
+#include <cerrno>
+#include <climits>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <iomanip>
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+#define PERF_EVENT_PARANOID         "/proc/sys/kernel/perf_event_paranoid"
+
+namespace {
+uint64_t MonotonicNs()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ULL + ts.tv_nsec;
+}
+
+int OpenEvent(uint32_t uType, uint64_t ulConfig, bool bUserOnly)
+{
+    struct perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = uType;
+    attr.config = ulConfig;
+    attr.exclude_kernel = bUserOnly ? 1 : 0;
+    attr.exclude_hv = 1;
+    return static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, PERF_FLAG_FD_CLOEXEC));
+}
+
+// One call from two snapshots of the same thread
+PerfStats Difference(const PerfStats& start, const PerfStats& end)
+{
+    PerfStats call;
+    call.ulCalls = 1;
+    call.ulWallNs = end.ulWallNs - start.ulWallNs;
+    for (int i = 0; i < static_cast<int>(PerfEvent::Count); ++i) {
+        call.available[i] = start.available[i] && end.available[i];
+        call.events[i] = call.available[i] ? end.events[i] - start.events[i] : 0;
+    }
+    for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+        call.syscalls[i] = end.syscalls[i] - start.syscalls[i];
+    }
+    return call;
+}
+
+// Start snapshots of the open perf trace scopes of this thread
+std::vector<PerfStats>& ScopeStack()
+{
+    thread_local std::vector<PerfStats> vStack;
+    return vStack;
+}
+}
+
+PerfStats::PerfStats() : ulCalls(0), ulWallNs(0) {
+    for (int i = 0; i < static_cast<int>(PerfEvent::Count); ++i) {
+        events[i] = 0;
+        available[i] = false;
+    }
+    for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+        syscalls[i] = 0;
+    }
+}
+
+uint64_t PerfStats::getTotalSyscalls() const {
+    uint64_t ulTotal = 0;
+    for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+        ulTotal += syscalls[i];
+    }
+    return ulTotal;
+}
+
+void PerfStats::add(const PerfStats& other) {
+    bool bFirst = ulCalls == 0;
+    ulCalls += other.ulCalls;
+    ulWallNs += other.ulWallNs;
+    for (int i = 0; i < static_cast<int>(PerfEvent::Count); ++i) {
+        events[i] += other.events[i];
+        available[i] = (bFirst || available[i]) && other.available[i];
+    }
+    for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+        syscalls[i] += other.syscalls[i];
+    }
+}
+
+void PerfStats::print(std::ostream& os) const {
+    os << "    " << std::left << std::setw(18) << "calls" << std::right << ulCalls << std::endl;
+    os << "    " << std::left << std::setw(18) << "wall-ns" << std::right << ulWallNs << std::endl;
+    for (int i = 0; i < static_cast<int>(PerfEvent::Count); ++i) {
+        os << "    " << std::left << std::setw(18) << Name(static_cast<PerfEvent>(i)) << std::right;
+        if (available[i]) {
+            os << events[i] << std::endl;
+        } else {
+            os << "n/a" << std::endl;
+        }
+    }
+    for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+        if (syscalls[i] != 0) {
+            os << "    " << std::left << std::setw(18) << SyscallStats::name(static_cast<SyscallType>(i))
+               << std::right << syscalls[i] << std::endl;
+        }
+    }
+}
+
+const char* PerfStats::Name(PerfEvent eEvent) {
+    static const char* names[] = {
+        "cycles", "instructions", "context-switches", "page-faults", "task-clock-ns"
+    };
+    return names[static_cast<int>(eEvent)];
+}
+
+PerfCounters& PerfCounters::ForThread() {
+    thread_local PerfCounters counters;
+    return counters;
+}
+
+PerfCounters::PerfCounters() {
+    static const struct { uint32_t uType; uint64_t ulConfig; } events[] = {
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+        { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+        { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    };
+
+    // Report the first refusal only, every thread opens its own counters
+    static std::once_flag warned;
+    for (int i = 0; i < static_cast<int>(PerfEvent::Count); ++i) {
+        // Kernel time is where the file system calls spend their cycles, but
+        // perf_event_paranoid 2 only allows user space counting
+        m_fds[i] = OpenEvent(events[i].uType, events[i].ulConfig, false);
+        m_bUserOnly[i] = false;
+        if (m_fds[i] < 0 && (errno == EACCES || errno == EPERM)) {
+            m_fds[i] = OpenEvent(events[i].uType, events[i].ulConfig, true);
+            m_bUserOnly[i] = m_fds[i] >= 0;
+        }
+        if (m_fds[i] < 0) {
+            int iErrno = errno;
+            std::call_once(warned, [iErrno]() {
+                std::cerr << "PerfCounters: Some events are not counted, err: " << std::strerror(iErrno)
+                          << ", perf_event_paranoid: " << GetParanoid() << std::endl;
+            });
+        }
+    }
+}
+
+PerfCounters::~PerfCounters() {
+    for (int i = 0; i < static_cast<int>(PerfEvent::Count); ++i) {
+        if (m_fds[i] >= 0) {
+            close(m_fds[i]);
+        }
+    }
+}
+
+void PerfCounters::snapshot(PerfStats& stats) const {
+    stats.ulCalls = 1;
+    stats.ulWallNs = MonotonicNs();
+    for (int i = 0; i < static_cast<int>(PerfEvent::Count); ++i) {
+        uint64_t ulValue = 0;
+        stats.available[i] = m_fds[i] >= 0 && read(m_fds[i], &ulValue, sizeof(ulValue)) == sizeof(ulValue);
+        stats.events[i] = stats.available[i] ? ulValue : 0;
+    }
+    const unsigned long* pSyscalls = SyscallStats::ThreadCounters();
+    for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+        stats.syscalls[i] = pSyscalls[i];
+    }
+}
+
+int PerfCounters::GetParanoid() {
+    std::ifstream file(PERF_EVENT_PARANOID);
+    int iParanoid = INT32_MIN;
+    if (!(file >> iParanoid)) {
+        return INT32_MIN;
+    }
+    return iParanoid;
+}
+
+PerfScope::PerfScope(PerfStats& result) : m_result(result) {
+    PerfCounters::ForThread().snapshot(m_start);
+}
+
+PerfScope::~PerfScope() {
+    PerfStats end;
+    PerfCounters::ForThread().snapshot(end);
+    m_result = Difference(m_start, end);
+}
+
+// Never destroyed, like TraceStats: threads may end scopes after the
+// static destructors ran. The report is printed by an atexit hook.
+PerfTrace& PerfTrace::Instance() {
+    static PerfTrace* pPerfTrace = new PerfTrace();
+    return *pPerfTrace;
+}
+
+PerfTrace::PerfTrace() {
+    atexit([] { Instance().report(std::cerr); });
+}
+
+void PerfTrace::begin() {
+    std::vector<PerfStats>& vStack = ScopeStack();
+    vStack.emplace_back();
+    PerfCounters::ForThread().snapshot(vStack.back());
+}
+
+void PerfTrace::end(const char* szName) {
+    std::vector<PerfStats>& vStack = ScopeStack();
+    if (vStack.empty()) {
+        return;
+    }
+
+    PerfStats end;
+    PerfCounters::ForThread().snapshot(end);
+    PerfStats call = Difference(vStack.back(), end);
+    vStack.pop_back();
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_sites[szName].add(call);
+}
+
+void PerfTrace::report(std::ostream& os) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_sites.empty()) {
+        return;
+    }
+    os << "PerfTrace:" << std::endl;
+    for (const auto& site : m_sites) {
+        os << "  " << site.first << std::endl;
+        site.second.print(os);
+    }
+}
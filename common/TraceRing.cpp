@@ -0,0 +1,270 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "TraceRing.h"
+#include <cerrno>
+#include <chrono>
+#include <cinttypes>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iostream>
+#include <unistd.h>
+
+#define TRACE_RING_WRITE_CHUNK      (64 * 1024)
+
+// Single producer (the owning thread), single consumer (whoever holds
+// m_flushMutex). head and tail live on their own cache lines.
+struct TraceRing::Ring {
+    Ring() : events(new Event[TRACE_RING_EVENTS]), head(0), tail(0), bFree(false) {}
+
+    std::unique_ptr<Event[]> events;
+    alignas(64) std::atomic<uint64_t> head;     // next slot to write
+    alignas(64) std::atomic<uint64_t> tail;     // next slot to drain
+    bool bFree;                                 // owner exited, guarded by m_mutex
+};
+
+// Hands the ring of an exiting thread back for reuse
+struct TraceRing::ThreadRing {
+    ~ThreadRing() {
+        if (pRing) {
+            Instance().releaseRing(pRing);
+        }
+    }
+
+    Ring* pRing = nullptr;
+};
+
+// Never destroyed: threads such as the TrashReclaimer workers may record
+// and release their rings after the static destructors ran. The file is
+// finished by an atexit hook instead.
+TraceRing& TraceRing::Instance() {
+    static TraceRing* pTraceRing = new TraceRing();
+    return *pTraceRing;
+}
+
+TraceRing::TraceRing()
+    : m_iFd(-1), m_iPid(getpid()), m_bFirstEvent(true), m_ulDropped(0), m_bStop(false), m_bFinished(false) {
+    const char* szFile = getenv("TRACE_FILE");
+    if (!szFile || !*szFile) {
+        szFile = TRACE_RING_DEFAULT_FILE;
+    }
+    m_iFd = open(szFile, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (m_iFd < 0) {
+        // Keep running untraced rather than failing the process
+        std::cerr << "TraceRing: Failed to open '" << szFile << "', err: "
+                  << std::strerror(errno) << ", tracing is off" << std::endl;
+        return;
+    }
+
+    m_szBuffer = "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+    m_flusher = std::thread(&TraceRing::run, this);
+    // Registered after every static constructed so far, so it runs before
+    // their destructors and events of their threads after it are dropped
+    atexit([] { Instance().finish(); });
+}
+
+void TraceRing::finish() {
+    if (m_flusher.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_bStop = true;
+        }
+        m_cvStop.notify_all();
+        m_flusher.join();
+    }
+    if (m_iFd < 0) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> flushLock(m_flushMutex);
+    drain();
+    m_szBuffer += "\n]}\n";
+    writeBuffer(true);
+    uint64_t ulDropped = m_ulDropped.load(std::memory_order_relaxed);
+    if (ulDropped != 0) {
+        std::cerr << "TraceRing: " << ulDropped << " events dropped, rings were full" << std::endl;
+    }
+    close(m_iFd);
+    m_bFinished = true;
+}
+
+uint64_t TraceRing::Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+TraceRing::Ring* TraceRing::getRing() {
+    thread_local ThreadRing threadRing;
+    if (threadRing.pRing) {
+        return threadRing.pRing;
+    }
+
+    // Reuse the drained ring of an exited thread, or add a new one
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (auto& pRing : m_rings) {
+        if (pRing->bFree && pRing->head.load(std::memory_order_relaxed) ==
+                            pRing->tail.load(std::memory_order_acquire)) {
+            pRing->bFree = false;
+            threadRing.pRing = pRing.get();
+            return threadRing.pRing;
+        }
+    }
+    m_rings.push_back(std::make_unique<Ring>());
+    threadRing.pRing = m_rings.back().get();
+    return threadRing.pRing;
+}
+
+void TraceRing::releaseRing(Ring* pRing) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    pRing->bFree = true;
+}
+
+void TraceRing::push(const char* szName, uint64_t ulTimestampNs, uint64_t ulDurationNs, char cPhase) {
+    if (m_iFd < 0) {
+        return;
+    }
+
+    thread_local pid_t iTid = gettid();
+    Ring* pRing = getRing();
+    uint64_t ulHead = pRing->head.load(std::memory_order_relaxed);
+    if (ulHead - pRing->tail.load(std::memory_order_acquire) >= TRACE_RING_EVENTS) {
+        m_ulDropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+    pRing->events[ulHead & (TRACE_RING_EVENTS - 1)] = Event{ szName, ulTimestampNs, ulDurationNs, iTid, cPhase };
+    pRing->head.store(ulHead + 1, std::memory_order_release);
+}
+
+void TraceRing::begin(const char* szName) {
+    push(szName, Now(), 0, 'B');
+}
+
+void TraceRing::end(const char* szName) {
+    push(szName, Now(), 0, 'E');
+}
+
+void TraceRing::complete(const char* szName, uint64_t ulStartNs) {
+    push(szName, ulStartNs, Now() - ulStartNs, 'X');
+}
+
+void TraceRing::flush() {
+    if (m_iFd < 0) {
+        return;
+    }
+    std::lock_guard<std::mutex> flushLock(m_flushMutex);
+    if (m_bFinished) {
+        return;
+    }
+    drain();
+    writeBuffer(true);
+}
+
+uint64_t TraceRing::getDropped() const {
+    return m_ulDropped.load(std::memory_order_relaxed);
+}
+
+void TraceRing::run() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    while (!m_cvStop.wait_for(lock, std::chrono::milliseconds(TRACE_RING_FLUSH_MS),
+                              [this] { return m_bStop; })) {
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> flushLock(m_flushMutex);
+            drain();
+            writeBuffer(true);
+        }
+        lock.lock();
+    }
+}
+
+// Format everything recorded so far, caller holds m_flushMutex
+void TraceRing::drain() {
+    std::vector<Ring*> vRings;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        for (auto& pRing : m_rings) {
+            vRings.push_back(pRing.get());
+        }
+    }
+
+    for (Ring* pRing : vRings) {
+        uint64_t ulTail = pRing->tail.load(std::memory_order_relaxed);
+        uint64_t ulHead = pRing->head.load(std::memory_order_acquire);
+        for (; ulTail != ulHead; ++ulTail) {
+            writeEvent(pRing->events[ulTail & (TRACE_RING_EVENTS - 1)]);
+            if (m_szBuffer.size() >= TRACE_RING_WRITE_CHUNK) {
+                writeBuffer(false);
+            }
+        }
+        pRing->tail.store(ulTail, std::memory_order_release);
+    }
+}
+
+void TraceRing::writeEvent(const Event& event) {
+    if (!m_bFirstEvent) {
+        m_szBuffer += ',';
+    }
+    m_bFirstEvent = false;
+
+    m_szBuffer += "\n{\"name\":\"";
+    for (const char* p = event.szName; *p; ++p) {
+        if (*p == '"' || *p == '\\') {
+            m_szBuffer += '\\';
+        }
+        m_szBuffer += *p;
+    }
+
+    // Chrome expects microseconds, keep the nanoseconds as fraction
+    char szFields[160];
+    int iLen = snprintf(szFields, sizeof(szFields),
+                        "\",\"ph\":\"%c\",\"pid\":%d,\"tid\":%d,\"ts\":%" PRIu64 ".%03u",
+                        event.cPhase, m_iPid, event.iTid, event.ulTimestampNs / 1000,
+                        static_cast<unsigned int>(event.ulTimestampNs % 1000));
+    if (event.cPhase == 'X') {
+        iLen += snprintf(szFields + iLen, sizeof(szFields) - iLen, ",\"dur\":%" PRIu64 ".%03u",
+                         event.ulDurationNs / 1000, static_cast<unsigned int>(event.ulDurationNs % 1000));
+    }
+    m_szBuffer.append(szFields, iLen);
+    m_szBuffer += '}';
+}
+
+void TraceRing::writeBuffer(bool bForce) {
+    if (m_szBuffer.empty() || (!bForce && m_szBuffer.size() < TRACE_RING_WRITE_CHUNK)) {
+        return;
+    }
+
+    const char* pCursor = m_szBuffer.data();
+    size_t ulSize = m_szBuffer.size();
+    while (ulSize > 0) {
+        ssize_t lWritten = write(m_iFd, pCursor, ulSize);
+        if (lWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            std::cerr << "TraceRing: Failed to write trace, err: " << std::strerror(errno) << std::endl;
+            break;
+        }
+        pCursor += lWritten;
+        ulSize -= lWritten;
+    }
+    m_szBuffer.clear();
+}
@@ -0,0 +1,287 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "TraceStats.h"
+#include <algorithm>
+#include <cerrno>
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fcntl.h>
+#include <iomanip>
+#include <unistd.h>
+
+namespace {
+int g_iSignalFd = -1;                   // write end of the signal pipe
+
+void OnReportSignal(int)
+{
+    if (g_iSignalFd >= 0) {
+        char c = 0;
+        ssize_t lWritten = write(g_iSignalFd, &c, 1);
+        (void)lWritten;
+    }
+}
+}
+
+LatencyHistogram::LatencyHistogram() : m_ulCount(0), m_ulTotal(0), m_ulMax(0) {
+    for (auto& bucket : m_buckets) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+}
+
+int LatencyHistogram::BucketOf(uint64_t ulNs) {
+    if (ulNs < SUB_BUCKETS) {
+        return static_cast<int>(ulNs);
+    }
+    int iExp = 63 - __builtin_clzll(ulNs);
+    return (iExp - 3) * SUB_BUCKETS + static_cast<int>((ulNs >> (iExp - 4)) & (SUB_BUCKETS - 1));
+}
+
+uint64_t LatencyHistogram::BucketUpperBound(int iBucket) {
+    if (iBucket < SUB_BUCKETS) {
+        return iBucket;
+    }
+    int iExp = iBucket / SUB_BUCKETS + 3;
+    uint64_t ulLower = static_cast<uint64_t>(SUB_BUCKETS + iBucket % SUB_BUCKETS) << (iExp - 4);
+    return ulLower + (uint64_t(1) << (iExp - 4)) - 1;
+}
+
+// Only the owning thread records, so plain load + store is enough
+void LatencyHistogram::record(uint64_t ulNs) {
+    std::atomic<uint64_t>& bucket = m_buckets[BucketOf(ulNs)];
+    bucket.store(bucket.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_ulCount.store(m_ulCount.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    m_ulTotal.store(m_ulTotal.load(std::memory_order_relaxed) + ulNs, std::memory_order_relaxed);
+    if (ulNs > m_ulMax.load(std::memory_order_relaxed)) {
+        m_ulMax.store(ulNs, std::memory_order_relaxed);
+    }
+}
+
+void LatencyHistogram::merge(const LatencyHistogram& other) {
+    for (int i = 0; i < BUCKETS; ++i) {
+        m_buckets[i].fetch_add(other.m_buckets[i].load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    m_ulCount.fetch_add(other.getCount(), std::memory_order_relaxed);
+    m_ulTotal.fetch_add(other.getTotal(), std::memory_order_relaxed);
+    m_ulMax.store(std::max(getMax(), other.getMax()), std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getCount() const {
+    return m_ulCount.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getTotal() const {
+    return m_ulTotal.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getMax() const {
+    return m_ulMax.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::getPercentile(double dQuantile) const {
+    uint64_t ulCount = getCount();
+    if (ulCount == 0) {
+        return 0;
+    }
+    uint64_t ulTarget = std::max<uint64_t>(1, static_cast<uint64_t>(dQuantile * ulCount + 0.5));
+    uint64_t ulSeen = 0;
+    for (int i = 0; i < BUCKETS; ++i) {
+        ulSeen += m_buckets[i].load(std::memory_order_relaxed);
+        if (ulSeen >= ulTarget) {
+            return std::min(BucketUpperBound(i), getMax());
+        }
+    }
+    return getMax();
+}
+
+// Histograms of one thread, indexed by site. Folded into m_retired when
+// the thread exits.
+struct TraceStats::ThreadStats {
+    ThreadStats() {
+        TraceStats& traceStats = Instance();
+        std::lock_guard<std::mutex> lock(traceStats.m_mutex);
+        traceStats.m_threads.push_back(this);
+    }
+
+    ~ThreadStats() {
+        Instance().retire(this);
+    }
+
+    std::vector<std::unique_ptr<LatencyHistogram>> vSites;
+    std::vector<std::pair<int, uint64_t>> vOpen;            // TRACE_B without TRACE_E yet
+};
+
+// Never destroyed, threads that exit after the static destructors still
+// retire their histograms into it. The report is printed by an atexit hook.
+TraceStats& TraceStats::Instance() {
+    static TraceStats* pTraceStats = new TraceStats();
+    return *pTraceStats;
+}
+
+TraceStats::TraceStats() : m_signalPipe{ -1, -1 } {
+    // Runs before the destructors of statics constructed earlier, whose
+    // threads are still counted as live then
+    atexit([] { Instance().finish(); });
+    if (pipe2(m_signalPipe, O_CLOEXEC) != 0) {
+        std::cerr << "TraceStats: Failed to create signal pipe, err: " << std::strerror(errno) << std::endl;
+        return;
+    }
+    g_iSignalFd = m_signalPipe[1];
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = OnReportSignal;
+    action.sa_flags = SA_RESTART;
+    sigaction(TRACE_STATS_SIGNAL, &action, nullptr);
+    m_signalWatcher = std::thread(&TraceStats::watchSignal, this);
+}
+
+void TraceStats::finish() {
+    if (m_signalWatcher.joinable()) {
+        signal(TRACE_STATS_SIGNAL, SIG_DFL);
+        g_iSignalFd = -1;
+        close(m_signalPipe[1]);
+        m_signalWatcher.join();
+        close(m_signalPipe[0]);
+    }
+    report(std::cerr);
+}
+
+uint64_t TraceStats::Now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+int TraceStats::registerSite(const std::string& szName) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto it = m_sites.find(szName);
+    if (it != m_sites.end()) {
+        return it->second;
+    }
+    int iSite = static_cast<int>(m_names.size());
+    m_names.push_back(szName);
+    m_sites.emplace(szName, iSite);
+    return iSite;
+}
+
+TraceStats::ThreadStats& TraceStats::getThreadStats() {
+    thread_local ThreadStats stats;
+    return stats;
+}
+
+LatencyHistogram* TraceStats::getHistogram(int iSite) {
+    ThreadStats& stats = getThreadStats();
+    if (static_cast<size_t>(iSite) < stats.vSites.size() && stats.vSites[iSite]) {
+        return stats.vSites[iSite].get();
+    }
+
+    // report() walks vSites of every thread, so grow it under the lock
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (stats.vSites.size() <= static_cast<size_t>(iSite)) {
+        stats.vSites.resize(iSite + 1);
+    }
+    stats.vSites[iSite].reset(new LatencyHistogram());
+    return stats.vSites[iSite].get();
+}
+
+void TraceStats::record(int iSite, uint64_t ulNs) {
+    getHistogram(iSite)->record(ulNs);
+}
+
+void TraceStats::begin(int iSite) {
+    getThreadStats().vOpen.emplace_back(iSite, Now());
+}
+
+void TraceStats::end(int iSite) {
+    uint64_t ulNow = Now();
+    auto& vOpen = getThreadStats().vOpen;
+    for (auto it = vOpen.rbegin(); it != vOpen.rend(); ++it) {
+        if (it->first == iSite) {
+            uint64_t ulStart = it->second;
+            vOpen.erase(std::next(it).base());
+            record(iSite, ulNow - ulStart);
+            return;
+        }
+    }
+}
+
+void TraceStats::retire(ThreadStats* pStats) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (size_t i = 0; i < pStats->vSites.size(); ++i) {
+        if (!pStats->vSites[i]) {
+            continue;
+        }
+        if (m_retired.size() <= i) {
+            m_retired.resize(i + 1);
+        }
+        if (!m_retired[i]) {
+            m_retired[i].reset(new LatencyHistogram());
+        }
+        m_retired[i]->merge(*pStats->vSites[i]);
+    }
+    m_threads.erase(std::remove(m_threads.begin(), m_threads.end(), pStats), m_threads.end());
+}
+
+void TraceStats::report(std::ostream& os) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    os << "TraceStats:" << std::endl;
+    os << "  " << std::left << std::setw(24) << "event" << std::right
+       << std::setw(10) << "calls" << std::setw(14) << "total ms" << std::setw(14) << "p50 us"
+       << std::setw(14) << "p90 us" << std::setw(14) << "p99 us" << std::setw(14) << "max us" << std::endl;
+
+    std::ios::fmtflags flags = os.flags();
+    os << std::fixed << std::setprecision(3);
+    for (size_t i = 0; i < m_names.size(); ++i) {
+        LatencyHistogram merged;
+        if (i < m_retired.size() && m_retired[i]) {
+            merged.merge(*m_retired[i]);
+        }
+        for (ThreadStats* pStats : m_threads) {
+            if (i < pStats->vSites.size() && pStats->vSites[i]) {
+                merged.merge(*pStats->vSites[i]);
+            }
+        }
+        if (merged.getCount() == 0) {
+            continue;
+        }
+        os << "  " << std::left << std::setw(24) << m_names[i] << std::right
+           << std::setw(10) << merged.getCount()
+           << std::setw(14) << merged.getTotal() / 1e6
+           << std::setw(14) << merged.getPercentile(0.50) / 1e3
+           << std::setw(14) << merged.getPercentile(0.90) / 1e3
+           << std::setw(14) << merged.getPercentile(0.99) / 1e3
+           << std::setw(14) << merged.getMax() / 1e3 << std::endl;
+    }
+    os.flags(flags);
+}
+
+void TraceStats::watchSignal() {
+    char c;
+    while (true) {
+        ssize_t lRead = read(m_signalPipe[0], &c, 1);
+        if (lRead < 0 && errno == EINTR) {
+            continue;
+        }
+        if (lRead <= 0) {
+            break;
+        }
+        report(std::cerr);
+    }
+}
@@ -0,0 +1,383 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "TrashReclaimer.h"
+#include "file_utils.h"
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <iostream>
+#include <climits>
+#include <dirent.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#define TRASH_RECLAIM_FDS           64          // fd cap of the RemoveDirStreaming behind each entry
+#define TRASH_CPU_CHECK_ENTRIES     64          // entries between two CPU budget checks
+
+namespace {
+uint64_t ClockNs(clockid_t iClock)
+{
+    struct timespec ts;
+    clock_gettime(iClock, &ts);
+    return static_cast<uint64_t>(ts.tv_sec) * 1000000000ull + ts.tv_nsec;
+}
+
+void SleepNs(uint64_t ulNs)
+{
+    struct timespec ts;
+    ts.tv_sec = ulNs / 1000000000ull;
+    ts.tv_nsec = ulNs % 1000000000ull;
+    while (nanosleep(&ts, &ts) != 0 && errno == EINTR) {
+    }
+}
+
+std::string ParentOf(const std::string& szPath)
+{
+    size_t ulEnd = szPath.find_last_not_of('/');
+    if (ulEnd == std::string::npos) {
+        return "/";
+    }
+    size_t ulSlash = szPath.rfind('/', ulEnd);
+    if (ulSlash == std::string::npos) {
+        return ".";
+    }
+    size_t ulParentEnd = szPath.find_last_not_of('/', ulSlash);
+    return ulParentEnd == std::string::npos ? "/" : szPath.substr(0, ulParentEnd + 1);
+}
+
+std::string JoinPath(const std::string& szDir, const std::string& szName)
+{
+    return szDir == "/" ? "/" + szName : szDir + "/" + szName;
+}
+
+// Entries never replace each other, renameat without RENAME_NOREPLACE is
+// only used by kernels and file systems that lack it.
+int RenameNoReplace(const char* szFrom, const char* szTo)
+{
+    if (renameat2(AT_FDCWD, szFrom, AT_FDCWD, szTo, RENAME_NOREPLACE) == 0) {
+        return 0;
+    }
+    if (errno != EINVAL && errno != ENOSYS) {
+        return -1;
+    }
+    struct stat st;
+    if (lstat(szTo, &st) == 0) {
+        errno = EEXIST;
+        return -1;
+    }
+    return rename(szFrom, szTo);
+}
+
+// Owner pid of a trash entry named <pid>.<seq>, -1 for foreign names
+pid_t EntryOwner(const char* szName)
+{
+    char* pEnd = nullptr;
+    long lPid = strtol(szName, &pEnd, 10);
+    if (pEnd == szName || *pEnd != '.' || lPid <= 0 || lPid > INT_MAX) {
+        return -1;
+    }
+    return static_cast<pid_t>(lPid);
+}
+}
+
+TrashReclaimer& TrashReclaimer::Instance() {
+    static TrashReclaimer reclaimer;
+    return reclaimer;
+}
+
+TrashReclaimer::TrashReclaimer()
+    : m_nThreads(1), m_ulMaxEntriesPerSec(0), m_dCpuBudget(0), m_bStop(false), m_ulSeq(0), m_ulActive(0) {
+}
+
+TrashReclaimer::~TrashReclaimer() {
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_cvWork.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+
+    // Whatever is left stays in the trash for the next process
+    for (Job& job : m_jobs) {
+        job.promise.set_value(false);
+        if (job.fnDone) {
+            job.fnDone(false, ECANCELED);
+        }
+    }
+}
+
+void TrashReclaimer::configure(const TrashOptions& options) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_threads.empty()) {
+        m_nThreads = std::max(options.nThreads, 1u);
+    }
+    m_ulMaxEntriesPerSec = options.ulMaxEntriesPerSec;
+    m_dCpuBudget = options.dCpuBudget;
+}
+
+bool TrashReclaimer::setTrashDir(const std::string& szDir) {
+    struct stat st;
+    if (stat(szDir.c_str(), &st) != 0) {
+        std::cerr << __FUNCTION__ << ": Failed to stat " << szDir << ", err: " << strerror(errno) << std::endl;
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string szTrashDir = JoinPath(szDir, TRASH_DIR_NAME);
+    if (!openTrash(szTrashDir)) {
+        return false;
+    }
+    m_trashDirs[st.st_dev] = szTrashDir;
+    return true;
+}
+
+std::future<bool> TrashReclaimer::remove(const std::string& szPath, std::function<void(bool, int)> fnDone) {
+    Job job;
+    job.fnDone = std::move(fnDone);
+    std::future<bool> future = job.promise.get_future();
+
+    auto fail = [&job](int iErr) {
+        job.promise.set_value(false);
+        if (job.fnDone) {
+            job.fnDone(false, iErr);
+        }
+        errno = iErr;
+    };
+
+    struct stat st;
+    if (lstat(szPath.c_str(), &st) != 0) {
+        fail(errno);
+        return future;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        fail(ENOTDIR);
+        return future;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    std::string szParent = ParentOf(szPath);
+    std::string szTrashDir = trashDirFor(szParent, st.st_dev);
+    if (!moveToTrash(szPath, szTrashDir, job.szPath)) {
+        // Bind mounts share st_dev but not renames, and the trash may lie
+        // inside szPath. A trash next to szPath always works.
+        std::string szLocalTrash = JoinPath(szParent, TRASH_DIR_NAME);
+        if ((errno != EXDEV && errno != EINVAL) || szLocalTrash == szTrashDir ||
+            !moveToTrash(szPath, szLocalTrash, job.szPath)) {
+            int iErr = errno;
+            std::cerr << __FUNCTION__ << ": Failed to move " << szPath << " to trash, err: " << strerror(iErr)
+                      << std::endl;
+            fail(iErr);
+            return future;
+        }
+    }
+    enqueueLocked(std::move(job));
+    return future;
+}
+
+unsigned int TrashReclaimer::recover(const std::string& szTrashDir) {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    if (m_opened.count(szTrashDir) != 0) {
+        return recoverLocked(szTrashDir, false);
+    }
+    m_opened.insert(szTrashDir);
+    return recoverLocked(szTrashDir, true);
+}
+
+void TrashReclaimer::wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cvDone.wait(lock, [this] { return m_jobs.empty() && m_ulActive == 0; });
+}
+
+size_t TrashReclaimer::pending() {
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_jobs.size() + m_ulActive;
+}
+
+// The top-most directory of ulDev that is writable, cached per file system
+std::string TrashReclaimer::trashDirFor(const std::string& szParent, dev_t ulDev) {
+    auto it = m_trashDirs.find(ulDev);
+    if (it != m_trashDirs.end()) {
+        return it->second;
+    }
+
+    char szReal[PATH_MAX];
+    if (realpath(szParent.c_str(), szReal) == nullptr) {
+        return JoinPath(szParent, TRASH_DIR_NAME);
+    }
+    std::string szTop = szReal;
+    std::string szDir = szReal;
+    while (szDir != "/") {
+        std::string szUp = ParentOf(szDir);
+        struct stat st;
+        if (stat(szUp.c_str(), &st) != 0 || st.st_dev != ulDev) {
+            break;
+        }
+        if (access(szUp.c_str(), W_OK) == 0) {
+            szTop = szUp;
+        }
+        szDir = szUp;
+    }
+
+    std::string szTrashDir = JoinPath(szTop, TRASH_DIR_NAME);
+    m_trashDirs[ulDev] = szTrashDir;
+    return szTrashDir;
+}
+
+// Create szTrashDir, and finish what earlier processes left in it the
+// first time it is used
+bool TrashReclaimer::openTrash(const std::string& szTrashDir) {
+    if (m_opened.count(szTrashDir) != 0) {
+        return true;
+    }
+    if (mkdir(szTrashDir.c_str(), 0700) != 0 && errno != EEXIST) {
+        return false;
+    }
+    struct stat st;
+    if (lstat(szTrashDir.c_str(), &st) != 0) {
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        return false;
+    }
+    // Marked first, claiming an entry renames it into szTrashDir again
+    m_opened.insert(szTrashDir);
+    recoverLocked(szTrashDir, true);
+    return true;
+}
+
+// Entries of our own pid belong to an earlier process with the same pid
+// unless this process has used szTrashDir already (bClaimOwn false)
+unsigned int TrashReclaimer::recoverLocked(const std::string& szTrashDir, bool bClaimOwn) {
+    DIR* pDir = opendir(szTrashDir.c_str());
+    if (pDir == nullptr) {
+        return 0;
+    }
+
+    std::vector<std::string> vNames;
+    pid_t iSelf = getpid();
+    while (struct dirent* pEntry = readdir(pDir)) {
+        pid_t iOwner = EntryOwner(pEntry->d_name);
+        if (iOwner < 0 || (iOwner == iSelf && !bClaimOwn)) {
+            continue;
+        }
+        if (iOwner != iSelf && (kill(iOwner, 0) == 0 || errno != ESRCH)) {
+            continue;
+        }
+        vNames.push_back(pEntry->d_name);
+    }
+    closedir(pDir);
+
+    // Renaming claims an entry, a process recovering concurrently loses
+    unsigned int nQueued = 0;
+    for (const std::string& szName : vNames) {
+        Job job;
+        if (moveToTrash(JoinPath(szTrashDir, szName), szTrashDir, job.szPath)) {
+            enqueueLocked(std::move(job));
+            ++nQueued;
+        }
+    }
+    return nQueued;
+}
+
+bool TrashReclaimer::moveToTrash(const std::string& szPath, const std::string& szTrashDir, std::string& szEntry) {
+    if (!openTrash(szTrashDir)) {
+        return false;
+    }
+    szEntry = JoinPath(szTrashDir, std::to_string(getpid()) + "." + std::to_string(m_ulSeq++));
+    return RenameNoReplace(szPath.c_str(), szEntry.c_str()) == 0;
+}
+
+void TrashReclaimer::enqueueLocked(Job job) {
+    m_jobs.push_back(std::move(job));
+    if (m_threads.empty()) {
+        for (unsigned int i = 0; i < m_nThreads; ++i) {
+            m_threads.emplace_back(&TrashReclaimer::run, this);
+        }
+    }
+    m_cvWork.notify_one();
+}
+
+void TrashReclaimer::run() {
+    while (true) {
+        Job job;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_cvWork.wait(lock, [this] { return m_bStop || !m_jobs.empty(); });
+            if (m_bStop) {
+                return;
+            }
+            job = std::move(m_jobs.front());
+            m_jobs.pop_front();
+            ++m_ulActive;
+        }
+
+        uint64_t ulStartNs = ClockNs(CLOCK_MONOTONIC);
+        uint64_t ulStartCpuNs = ClockNs(CLOCK_THREAD_CPUTIME_ID);
+        bool bRemoved = RemoveDirStreaming(job.szPath, false, TRASH_RECLAIM_FDS,
+                                           [&](uint64_t ulRemoved) {
+                                               return throttle(ulRemoved, ulStartNs, ulStartCpuNs);
+                                           });
+        int iErr = bRemoved ? 0 : errno;
+        job.promise.set_value(bRemoved);
+        if (job.fnDone) {
+            job.fnDone(bRemoved, iErr);
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            --m_ulActive;
+        }
+        m_cvDone.notify_all();
+    }
+}
+
+// Sleep as long as the rate or the CPU budget requires, false once stopping
+bool TrashReclaimer::throttle(uint64_t ulRemoved, uint64_t ulStartNs, uint64_t ulStartCpuNs) {
+    if (m_bStop.load(std::memory_order_relaxed)) {
+        return false;
+    }
+
+    uint64_t ulRate = m_ulMaxEntriesPerSec.load(std::memory_order_relaxed);
+    if (ulRate != 0) {
+        // Every thread gets an equal share of the rate
+        uint64_t ulShare = std::max<uint64_t>(ulRate / m_nThreads, 1);
+        uint64_t ulDueNs = ulStartNs + ulRemoved * 1000000000ull / ulShare;
+        uint64_t ulNowNs = ClockNs(CLOCK_MONOTONIC);
+        if (ulDueNs > ulNowNs) {
+            SleepNs(ulDueNs - ulNowNs);
+        }
+    }
+
+    double dBudget = m_dCpuBudget.load(std::memory_order_relaxed);
+    if (dBudget > 0 && ulRemoved % TRASH_CPU_CHECK_ENTRIES == 0) {
+        uint64_t ulCpuNs = ClockNs(CLOCK_THREAD_CPUTIME_ID) - ulStartCpuNs;
+        uint64_t ulWallNs = ClockNs(CLOCK_MONOTONIC) - ulStartNs;
+        uint64_t ulMinWallNs = static_cast<uint64_t>(ulCpuNs / dBudget);
+        if (ulMinWallNs > ulWallNs) {
+            SleepNs(ulMinWallNs - ulWallNs);
+        }
+    }
+    return !m_bStop.load(std::memory_order_relaxed);
+}
@@ -0,0 +1,310 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "TreeFixture.h"
+#include "WorkStealingPool.h"
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <linux/magic.h>
+#include <memory>
+#include <sys/stat.h>
+#include <sys/vfs.h>
+#include <unistd.h>
+
+#define FIXTURE_CHUNK               4096        // entries of one directory created by one task
+
+namespace {
+struct SharedDirFd {
+    explicit SharedDirFd(int iFd) : iFd(iFd) {}
+    ~SharedDirFd() {
+        if (iFd >= 0) {
+            close(iFd);
+        }
+    }
+
+    int iFd;
+};
+
+struct FixtureContext {
+    const FixtureOptions* pOptions;
+    WorkStealingPool* pPool;
+    std::string szData;                 // content of every file
+    std::atomic<uint64_t> ulDirs{0};
+    std::atomic<uint64_t> ulFiles{0};
+    std::atomic<uint64_t> ulSymlinks{0};
+    std::atomic<int> iErrno{0};         // first failure, stops the build
+};
+
+// splitmix64, every directory derives its own seed from its parent's, so
+// the tree does not depend on the order tasks run in
+uint64_t Mix(uint64_t ulSeed, uint64_t ulValue)
+{
+    uint64_t z = ulSeed + (ulValue + 1) * 0x9e3779b97f4a7c15ULL;
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+}
+
+// Uniform in [0, 1)
+double Uniform(uint64_t ulSeed)
+{
+    return (ulSeed >> 11) * (1.0 / 9007199254740992.0);
+}
+
+bool Failed(FixtureContext& ctx)
+{
+    return ctx.iErrno.load(std::memory_order_relaxed) != 0;
+}
+
+// Keep and report only the first failure, the rest are usually its echo
+void Fail(FixtureContext& ctx, const char* szCall, const char* szName)
+{
+    int iErrno = errno;
+    int iExpected = 0;
+    if (ctx.iErrno.compare_exchange_strong(iExpected, iErrno)) {
+        std::cerr << "CreateFixture: Failed to " << szCall << " '" << szName << "', err: "
+                  << std::strerror(iErrno) << std::endl;
+    }
+}
+
+// Sub directories and files of a directory at iLevel (the root is 0)
+void GetDirShape(const FixtureOptions& options, uint64_t ulSeed, int iLevel, int& iDirs, int& iFiles)
+{
+    bool bInner = iLevel < options.iDepth;
+    switch (options.eShape) {
+    case FixtureShape::Balanced:
+        iDirs = bInner ? options.iFanout : 0;
+        iFiles = options.iFiles;
+        break;
+    case FixtureShape::Skewed: {
+        // u^3 has mean 1/4, so 4 * mean * u^3 averages to mean but its tail
+        // reaches 4 * mean. The root always gets a sub directory.
+        double dDirs = Uniform(Mix(ulSeed, 1));
+        double dFiles = Uniform(Mix(ulSeed, 2));
+        iDirs = bInner ? static_cast<int>(4.0 * options.iFanout * dDirs * dDirs * dDirs) : 0;
+        iDirs = iLevel == 0 && bInner ? std::max(iDirs, std::min(options.iFanout, 1)) : iDirs;
+        iFiles = static_cast<int>(4.0 * options.iFiles * dFiles * dFiles * dFiles);
+        break;
+    }
+    case FixtureShape::DeepChain:
+        iDirs = bInner ? 1 : 0;
+        iFiles = options.iFiles;
+        break;
+    case FixtureShape::Flat:
+        iDirs = iLevel == 0 ? options.iFanout : 0;
+        iFiles = iLevel == 0 ? options.iFiles : 0;
+        break;
+    }
+}
+
+int GetSymlinkCount(const FixtureOptions& options, int iFiles)
+{
+    return static_cast<int>(iFiles * options.dSymlinkRatio + 0.5);
+}
+
+// Files [iBegin, iEnd) of a directory, then its symlinks in the same range
+void CreateFiles(FixtureContext& ctx, int iDirFd, int iBegin, int iEnd)
+{
+    char szName[32];
+    int iCreated = 0;
+    for (int i = iBegin; i < iEnd && !Failed(ctx); ++i) {
+        snprintf(szName, sizeof(szName), "file_%d", i);
+        int iFd = openat(iDirFd, szName, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+        if (iFd < 0) {
+            Fail(ctx, "create", szName);
+            break;
+        }
+        size_t ulWritten = 0;
+        while (ulWritten < ctx.szData.size()) {
+            ssize_t lWritten = write(iFd, ctx.szData.data() + ulWritten, ctx.szData.size() - ulWritten);
+            if (lWritten < 0 && errno == EINTR) {
+                continue;
+            }
+            if (lWritten <= 0) {
+                Fail(ctx, "write", szName);
+                break;
+            }
+            ulWritten += lWritten;
+        }
+        close(iFd);
+        ++iCreated;
+    }
+    ctx.ulFiles.fetch_add(iCreated, std::memory_order_relaxed);
+}
+
+void CreateSymlinks(FixtureContext& ctx, int iDirFd, int iBegin, int iEnd, int iFiles)
+{
+    char szName[32];
+    char szTarget[32];
+    int iCreated = 0;
+    for (int i = iBegin; i < iEnd && !Failed(ctx); ++i) {
+        snprintf(szName, sizeof(szName), "link_%d", i);
+        snprintf(szTarget, sizeof(szTarget), "file_%d", i % iFiles);
+        if (symlinkat(szTarget, iDirFd, szName) != 0) {
+            Fail(ctx, "symlink", szName);
+            break;
+        }
+        ++iCreated;
+    }
+    ctx.ulSymlinks.fetch_add(iCreated, std::memory_order_relaxed);
+}
+
+// Run fn over [0, iCount) in chunks, all but the last chunk as new tasks
+template <typename Fn>
+void ForEachChunk(FixtureContext& ctx, int iCount, Fn fn)
+{
+    int iBegin = 0;
+    for (; iCount - iBegin > FIXTURE_CHUNK; iBegin += FIXTURE_CHUNK) {
+        ctx.pPool->submit([fn, iBegin] { fn(iBegin, iBegin + FIXTURE_CHUNK); });
+    }
+    if (iBegin < iCount) {
+        fn(iBegin, iCount);
+    }
+}
+
+void BuildDir(FixtureContext& ctx, std::shared_ptr<SharedDirFd> pDir, int iLevel, uint64_t ulSeed);
+
+// Sub directories [iBegin, iEnd) of pDir. The ones with content of their own
+// become tasks, empty ones are created in place.
+void CreateSubDirs(FixtureContext& ctx, const std::shared_ptr<SharedDirFd>& pDir, int iBegin, int iEnd,
+                   int iLevel, uint64_t ulSeed)
+{
+    char szName[32];
+    int iCreated = 0;
+    for (int i = iBegin; i < iEnd && !Failed(ctx); ++i) {
+        uint64_t ulChildSeed = Mix(ulSeed, 16 + static_cast<uint64_t>(i));
+        int iDirs = 0;
+        int iFiles = 0;
+        GetDirShape(*ctx.pOptions, ulChildSeed, iLevel + 1, iDirs, iFiles);
+        if (iDirs == 0 && iFiles == 0) {
+            snprintf(szName, sizeof(szName), "dir_%d", i);
+            if (mkdirat(pDir->iFd, szName, 0755) != 0) {
+                Fail(ctx, "mkdir", szName);
+                break;
+            }
+            ++iCreated;
+            continue;
+        }
+
+        ctx.pPool->submit([&ctx, pDir, i, iLevel, ulChildSeed] {
+            char szName[32];
+            snprintf(szName, sizeof(szName), "dir_%d", i);
+            if (Failed(ctx)) {
+                return;
+            }
+            if (mkdirat(pDir->iFd, szName, 0755) != 0) {
+                Fail(ctx, "mkdir", szName);
+                return;
+            }
+            ctx.ulDirs.fetch_add(1, std::memory_order_relaxed);
+            int iFd = openat(pDir->iFd, szName, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            if (iFd < 0) {
+                Fail(ctx, "open", szName);
+                return;
+            }
+            BuildDir(ctx, std::make_shared<SharedDirFd>(iFd), iLevel + 1, ulChildSeed);
+        });
+    }
+    ctx.ulDirs.fetch_add(iCreated, std::memory_order_relaxed);
+}
+
+void BuildDir(FixtureContext& ctx, std::shared_ptr<SharedDirFd> pDir, int iLevel, uint64_t ulSeed)
+{
+    int iDirs = 0;
+    int iFiles = 0;
+    GetDirShape(*ctx.pOptions, ulSeed, iLevel, iDirs, iFiles);
+    int iSymlinks = iFiles > 0 ? GetSymlinkCount(*ctx.pOptions, iFiles) : 0;
+
+    // Sub directories first, so the deeper levels start while files are written
+    ForEachChunk(ctx, iDirs, [&ctx, pDir, iLevel, ulSeed](int iBegin, int iEnd) {
+        CreateSubDirs(ctx, pDir, iBegin, iEnd, iLevel, ulSeed);
+    });
+    ForEachChunk(ctx, iFiles, [&ctx, pDir](int iBegin, int iEnd) {
+        CreateFiles(ctx, pDir->iFd, iBegin, iEnd);
+    });
+    ForEachChunk(ctx, iSymlinks, [&ctx, pDir, iFiles](int iBegin, int iEnd) {
+        CreateSymlinks(ctx, pDir->iFd, iBegin, iEnd, iFiles);
+    });
+}
+}
+
+bool CreateFixture(const std::string& szPath, const FixtureOptions& options, FixtureStats* pStats)
+{
+    if (szPath.empty() || options.iFanout < 0 || options.iDepth < 0 || options.iFiles < 0 ||
+        !(options.dSymlinkRatio >= 0)) {
+        errno = EINVAL;
+        return false;
+    }
+
+    if (mkdir(szPath.c_str(), 0755) != 0) {
+        std::cerr << __FUNCTION__ << ": Failed to create '" << szPath << "', err: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    int iRootFd = open(szPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (iRootFd < 0) {
+        std::cerr << __FUNCTION__ << ": Failed to open '" << szPath << "', err: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    FixtureContext ctx;
+    ctx.pOptions = &options;
+    ctx.szData.assign(options.ulFileSize, 'x');
+    {
+        WorkStealingPool pool(options.nThreads);
+        ctx.pPool = &pool;
+        auto pRoot = std::make_shared<SharedDirFd>(iRootFd);
+        pool.submit([&ctx, pRoot, &options] { BuildDir(ctx, pRoot, 0, Mix(options.ulSeed, 0)); });
+        pool.wait();
+    }
+
+    if (pStats) {
+        pStats->ulDirs = ctx.ulDirs.load();
+        pStats->ulFiles = ctx.ulFiles.load();
+        pStats->ulSymlinks = ctx.ulSymlinks.load();
+        pStats->ulBytes = pStats->ulFiles * options.ulFileSize;
+    }
+    if (Failed(ctx)) {
+        errno = ctx.iErrno.load();
+        return false;
+    }
+    return true;
+}
+
+bool IsOnTmpfs(const std::string& szPath)
+{
+    struct statfs st;
+    return statfs(szPath.c_str(), &st) == 0 && st.f_type == TMPFS_MAGIC;
+}
+
+std::string FindTmpfsDir()
+{
+    const char* candidates[] = { getenv("TMPFS_DIR"), "/dev/shm", getenv("XDG_RUNTIME_DIR"), "/tmp" };
+    for (const char* szDir : candidates) {
+        if (szDir && *szDir && IsOnTmpfs(szDir) && access(szDir, W_OK | X_OK) == 0) {
+            return szDir;
+        }
+    }
+    return std::string();
+}
@@ -0,0 +1,61 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "TrieArena.h"
+#include <algorithm>
+#include <cstdint>
+
+#define TRIE_ARENA_MIN_BLOCK        (1 << 10)
+#define TRIE_ARENA_MAX_BLOCK        (1 << 16)
+
+TrieArena::TrieArena()
+    : m_pCursor(nullptr), m_ulRemaining(0),
+      m_ulNextBlockSize(TRIE_ARENA_MIN_BLOCK), m_ulReserved(0) {}
+
+TrieArena::~TrieArena() = default;
+
+void* TrieArena::allocate(size_t ulSize, size_t ulAlign) {
+    size_t ulPadding = (ulAlign - reinterpret_cast<uintptr_t>(m_pCursor) % ulAlign) % ulAlign;
+    if (!m_pCursor || ulPadding + ulSize > m_ulRemaining) {
+        // Blocks grow geometrically so small tries stay small
+        size_t ulBlockSize = std::max(m_ulNextBlockSize, ulSize + ulAlign);
+        m_blocks.emplace_back(new char[ulBlockSize]);
+        m_pCursor = m_blocks.back().get();
+        m_ulRemaining = ulBlockSize;
+        m_ulReserved += ulBlockSize;
+        m_ulNextBlockSize = std::min<size_t>(m_ulNextBlockSize * 2, TRIE_ARENA_MAX_BLOCK);
+        ulPadding = (ulAlign - reinterpret_cast<uintptr_t>(m_pCursor) % ulAlign) % ulAlign;
+    }
+
+    void* p = m_pCursor + ulPadding;
+    m_pCursor += ulPadding + ulSize;
+    m_ulRemaining -= ulPadding + ulSize;
+    return p;
+}
+
+const std::string* TrieArena::intern(std::string_view part) {
+    return &*m_pool.emplace(part).first;
+}
+
+size_t TrieArena::getBytesReserved() const {
+    return m_ulReserved;
+}
+
+size_t TrieArena::getInternedCount() const {
+    return m_pool.size();
+}
@@ -17,23 +17,219 @@
  */
 
 #include "TrieNode.h"
+#include "TrieWalker.h"
+#include <algorithm>
 #include <iostream>
 
-TrieNode::TrieNode(const std::string& part) : nodeValue(part), parent(nullptr) {}
+namespace {
+// No separator is written right after the root "/"
+inline bool IsRootValue(const std::string& value) {
+    return value.size() == 1 && value[0] == '/';
+}
+
+// Children are looked up by the first component of their value. That is the
+// whole value, except for PathTrieMode::Radix edges spanning several
+// components.
+inline std::string_view EdgeKey(std::string_view value) {
+    return value.substr(0, value.find('/'));
+}
+}
+
+// Open addressing table of child pointers. Slots only ever go from nullptr
+// to a child, and a grown table is published as a whole, so readers need no
+// lock. Concurrent nodes keep the tables they outgrew chained behind the
+// current one until the node dies, as a reader may still be probing them.
+struct TrieNode::ChildIndex {
+    size_t capacity;                    // power of two
+    ChildIndex* retired;
+
+    Slot* slots() {
+        return reinterpret_cast<Slot*>(this + 1);
+    }
+
+    const Slot* slots() const {
+        return reinterpret_cast<const Slot*>(this + 1);
+    }
+};
+
+TrieNode::TrieNode(const std::string& part)
+    : nodeValue(new std::string(part)), parent(nullptr), index(nullptr),
+      depth(0), pathLength(part.size()), data(nullptr) {}
 
-TrieNode::~TrieNode() = default;
+TrieNode::TrieNode(TrieArena* arena, const std::string* value)
+    : nodeValue(value), parent(nullptr),
+      children(ArenaAllocator<TrieNode*>(arena)), index(nullptr),
+      depth(0), pathLength(value->size()), data(nullptr) {}
+
+TrieNode::~TrieNode() {
+    if (getArena()) {
+        // Everything belongs to the arena
+        return;
+    }
+
+    // Release the subtree iteratively, so deep tries cannot overflow the stack
+    std::vector<TrieNode*> vPending(children.begin(), children.end());
+    children.clear();
+    while (!vPending.empty()) {
+        TrieNode* node = vPending.back();
+        vPending.pop_back();
+        vPending.insert(vPending.end(), node->children.begin(), node->children.end());
+        node->children.clear();
+        delete node;
+    }
+    for (ChildIndex* table = index.load(std::memory_order_relaxed); table != nullptr; ) {
+        ChildIndex* retired = table->retired;
+        ::operator delete(table);
+        table = retired;
+    }
+    delete nodeValue;
+}
+
+TrieNode* TrieNode::Create(TrieArena* arena, std::string_view part) {
+    void* mem = arena->allocate(sizeof(TrieNode), alignof(TrieNode));
+    return new (mem) TrieNode(arena, arena->intern(part));
+}
 
 void TrieNode::addChild(const std::string& part, std::unique_ptr<TrieNode> child) {
-    children[part] = std::move(child);
+    TrieNode* existing = getChild(part);
+    if (!existing) {
+        linkChild(child.release());
+        return;
+    }
+
+    // Replace the existing child of the same name
+    replaceChild(existing, child.get());
+    child.release();
+    if (!getArena()) {
+        delete existing;
+    }
+}
+
+void TrieNode::addChild(TrieNode* child) {
+    linkChild(child);
+}
+
+void TrieNode::replaceChild(TrieNode* existing, TrieNode* replacement) {
+    // Both share the same key, so the position in the list and index holds
+    std::replace(children.begin(), children.end(), existing, replacement);
+    ChildIndex* table = index.load(std::memory_order_relaxed);
+    if (table) {
+        findSlot(table, EdgeKey(*existing->nodeValue))->store(replacement, std::memory_order_release);
+    }
+}
+
+void TrieNode::setNodeValue(std::string_view value) {
+    TrieArena* arena = getArena();
+    if (arena) {
+        nodeValue = arena->intern(value);
+    } else {
+        delete nodeValue;
+        nodeValue = new std::string(value);
+    }
+}
+
+TrieArena* TrieNode::getArena() const {
+    return children.get_allocator().arena();
+}
+
+void TrieNode::linkChild(TrieNode* child) {
+    ChildIndex* table = index.load(std::memory_order_relaxed);
+    if (!table && children.size() < FLAT_CHILDREN_MAX) {
+        auto it = std::lower_bound(children.begin(), children.end(), child, compareNames);
+        children.insert(it, child);
+        return;
+    }
+
+    children.push_back(child);
+    // Keep the index at most half full
+    if (!table || children.size() * 2 > table->capacity) {
+        rebuildIndex(table ? table->capacity * 2 : FLAT_CHILDREN_MAX * 4, false);
+    } else {
+        findSlot(table, EdgeKey(*child->nodeValue))->store(child, std::memory_order_relaxed);
+    }
+}
+
+bool TrieNode::compareNames(const TrieNode* lhs, const TrieNode* rhs) {
+    return EdgeKey(*lhs->nodeValue) < EdgeKey(*rhs->nodeValue);
+}
+
+bool TrieNode::hasSortedChildren() const {
+    return index.load(std::memory_order_relaxed) == nullptr;
 }
 
-TrieNode* TrieNode::getChild(const std::string& part) const {
-    auto it = children.find(part);
-    return it != children.end() ? it->second.get() : nullptr;
+void TrieNode::linkShared(TrieNode* child) {
+    ChildIndex* table = index.load(std::memory_order_relaxed);
+    children.push_back(child);
+    if (!table || children.size() * 2 > table->capacity) {
+        rebuildIndex(table ? table->capacity * 2 : SHARED_INDEX_MIN, true);
+    } else {
+        // The child is fully built, release makes it visible to findShared
+        findSlot(table, EdgeKey(*child->nodeValue))->store(child, std::memory_order_release);
+    }
+}
+
+void TrieNode::rebuildIndex(size_t capacity, bool bKeepOld) {
+    ChildIndex* old = index.load(std::memory_order_relaxed);
+    TrieArena* arena = getArena();
+    size_t ulSize = sizeof(ChildIndex) + capacity * sizeof(Slot);
+    void* mem = arena ? arena->allocate(ulSize, alignof(ChildIndex)) : ::operator new(ulSize);
+    ChildIndex* table = new (mem) ChildIndex{capacity, bKeepOld ? old : nullptr};
+    Slot* slots = table->slots();
+    for (size_t i = 0; i < capacity; ++i) {
+        new (&slots[i]) Slot(nullptr);
+    }
+    for (TrieNode* node : children) {
+        findSlot(table, EdgeKey(*node->nodeValue))->store(node, std::memory_order_relaxed);
+    }
+
+    index.store(table, std::memory_order_release);
+    if (old && !bKeepOld && !arena) {
+        ::operator delete(old);
+    }
+}
+
+// Slot holding the child named part, or the empty slot where it belongs
+TrieNode::Slot* TrieNode::findSlot(const ChildIndex* table, std::string_view part) {
+    size_t mask = table->capacity - 1;
+    Slot* slots = const_cast<Slot*>(table->slots());
+    for (size_t slot = std::hash<std::string_view>()(part) & mask; ; slot = (slot + 1) & mask) {
+        TrieNode* node = slots[slot].load(std::memory_order_acquire);
+        if (!node || EdgeKey(*node->nodeValue) == part) {
+            return &slots[slot];
+        }
+    }
+}
+
+TrieNode* TrieNode::getChild(std::string_view part) const {
+    ChildIndex* table = index.load(std::memory_order_relaxed);
+    if (table) {
+        return findSlot(table, part)->load(std::memory_order_relaxed);
+    }
+
+    auto it = std::lower_bound(children.begin(), children.end(), part,
+                               [](const TrieNode* lhs, std::string_view rhs) {
+                                   return EdgeKey(*lhs->nodeValue) < rhs;
+                               });
+    return it != children.end() && EdgeKey(*(*it)->nodeValue) == part ? *it : nullptr;
+}
+
+TrieNode* TrieNode::findShared(std::string_view part) const {
+    ChildIndex* table = index.load(std::memory_order_acquire);
+    return table ? findSlot(table, part)->load(std::memory_order_acquire) : nullptr;
+}
+
+size_t TrieNode::getChildCount() const {
+    return children.size();
+}
+
+void TrieNode::forEachChild(const std::function<void(TrieNode*)>& visit) const {
+    for (TrieNode* child : children) {
+        visit(child);
+    }
 }
 
 const std::string& TrieNode::getNodeValue() const {
-    return nodeValue;
+    return *nodeValue;
 }
 
 TrieNode* TrieNode::getParent() const {
@@ -42,28 +238,56 @@ TrieNode* TrieNode::getParent() const {
 
 void TrieNode::setParent(TrieNode* parent) {
     this->parent = parent;
+    // A multi-component edge counts once per component, so splitting an edge
+    // never changes the depth of the nodes below it
+    depth = parent ? parent->depth + 1 + std::count(nodeValue->begin(), nodeValue->end(), '/') : 0;
+    pathLength = nodeValue->size();
+    if (parent) {
+        pathLength += parent->pathLength + (IsRootValue(*parent->nodeValue) ? 0 : 1);
+    }
+}
+
+size_t TrieNode::getDepth() const {
+    return depth;
+}
+
+size_t TrieNode::getPathLength() const {
+    return pathLength;
+}
+
+void TrieNode::setData(void* data) {
+    this->data = data;
+}
+
+void* TrieNode::getData() const {
+    return data;
 }
 
 std::string TrieNode::getFullPath(const TrieNode* node) {
+    std::string path;
+    getFullPath(node, path);
+    return path;
+}
+
+void TrieNode::getFullPath(const TrieNode* node, std::string& path) {
     if (!node) {
-        return "";
+        path.clear();
+        return;
     }
 
-    std::string path;
-    for(const TrieNode * tempNode = node;
+    // Fill the buffer from the back, every component is copied exactly once
+    path.resize(node->pathLength);
+    size_t pos = node->pathLength;
+    for (const TrieNode* tempNode = node;
             tempNode != nullptr;
             tempNode = tempNode->parent) {
-        if(path == "") {
-            path = tempNode->nodeValue;
-            continue;
-        }
-        if(tempNode->nodeValue != "/") {
-            path = tempNode->nodeValue + "/" + path;
-        } else {
-            path = "/" + path;
+        const std::string& value = *tempNode->nodeValue;
+        pos -= value.size();
+        value.copy(&path[pos], value.size());
+        if (tempNode->parent && !IsRootValue(*tempNode->parent->nodeValue)) {
+            path[--pos] = '/';
         }
     }
-    return path;
 }
 
 void TrieNode::print(const TrieNode* node, const std::string& prefix) const {
@@ -71,12 +295,14 @@ void TrieNode::print(const TrieNode* node, const std::string& prefix) const {
         node = this;
     }
 
-    // Print current node
-    std::cout << prefix << "└── " << node->nodeValue << std::endl;
-
-    // Iterator all child nodes
-    for (const auto &it : node->children) {
-        // Print children recursively
-        print(it.second.get(), prefix + "    ");
+    // Iterative, so trees deeper than the call stack print too
+    TrieWalker walker(const_cast<TrieNode*>(node), TrieOrder::PreOrder);
+    while (const TrieNode* current = walker.next()) {
+        std::cout << prefix;
+        for (size_t i = 0; i < walker.getDepth(); ++i) {
+            std::cout << "    ";
+        }
+        std::cout << "└── " << *current->nodeValue << '\n';
     }
+    std::cout << std::flush;
 }
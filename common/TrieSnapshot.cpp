@@ -0,0 +1,331 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "TrieSnapshot.h"
+#include "PathTrie.h"
+#include "TrieNode.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <iostream>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+namespace {
+const char SNAPSHOT_MAGIC[8] = { 'P', 'T', 'R', 'I', 'E', 'S', 'N', 'P' };
+const uint32_t SNAPSHOT_VERSION = 1;
+
+// Children are ordered and looked up by the first component of their value,
+// as in TrieNode
+inline std::string_view EdgeKey(std::string_view value) {
+    return value.substr(0, value.find('/'));
+}
+
+bool WriteAll(int iFd, const void* pData, size_t ulSize) {
+    const char* pCursor = static_cast<const char*>(pData);
+    while (ulSize > 0) {
+        ssize_t lWritten = write(iFd, pCursor, ulSize);
+        if (lWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        pCursor += lWritten;
+        ulSize -= lWritten;
+    }
+    return true;
+}
+}
+
+struct TrieSnapshot::Header {
+    char magic[8];
+    uint32_t version;
+    uint32_t nodeCount;
+    uint64_t namesOffset;
+    uint64_t namesSize;
+};
+
+struct TrieSnapshot::Node {
+    uint32_t parent;                    // INVALID_NODE for the root
+    uint32_t firstChild;
+    uint32_t childCount;
+    uint32_t nameOffset;                // into the name blob
+    uint32_t nameLength;
+    uint32_t depth;
+    uint32_t pathLength;
+};
+
+TrieSnapshot::TrieSnapshot()
+    : m_pMapping(nullptr), m_ulMappingSize(0), m_pNodes(nullptr), m_pNames(nullptr),
+      m_ulNodeCount(0) {}
+
+TrieSnapshot::~TrieSnapshot() {
+    close();
+}
+
+bool TrieSnapshot::Write(PathTrie& pathTrie, const std::string& szPath) {
+    std::vector<Node> vNodes;
+    std::vector<const TrieNode*> vQueue;
+    std::string szNames;
+    std::unordered_map<std::string_view, uint32_t> mapNames;
+    std::vector<TrieNode*> vChildren;
+
+    // Breadth-first numbering, so the children of each node are adjacent
+    vQueue.push_back(pathTrie.GetRoot());
+    vNodes.push_back(Node{ INVALID_NODE, 0, 0, 0, 0, 0, 0 });
+    for (size_t ulIndex = 0; ulIndex < vQueue.size(); ++ulIndex) {
+        const TrieNode* pNode = vQueue[ulIndex];
+        const std::string& value = pNode->getNodeValue();
+        if (vQueue.size() >= INVALID_NODE || szNames.size() + value.size() > UINT32_MAX) {
+            std::cerr << __FUNCTION__ << ": Trie is too large for a snapshot" << std::endl;
+            return false;
+        }
+
+        // Names repeat a lot ("file_0" in every directory), store each once
+        auto it = mapNames.find(value);
+        if (it == mapNames.end()) {
+            it = mapNames.emplace(value, static_cast<uint32_t>(szNames.size())).first;
+            szNames += value;
+        }
+
+        vChildren.clear();
+        pNode->forEachChild([&vChildren](TrieNode* pChild) { vChildren.push_back(pChild); });
+        std::sort(vChildren.begin(), vChildren.end(), [](const TrieNode* lhs, const TrieNode* rhs) {
+            return EdgeKey(lhs->getNodeValue()) < EdgeKey(rhs->getNodeValue());
+        });
+
+        Node& node = vNodes[ulIndex];
+        node.firstChild = static_cast<uint32_t>(vQueue.size());
+        node.childCount = static_cast<uint32_t>(vChildren.size());
+        node.nameOffset = it->second;
+        node.nameLength = static_cast<uint32_t>(value.size());
+        node.depth = static_cast<uint32_t>(pNode->getDepth());
+        node.pathLength = static_cast<uint32_t>(pNode->getPathLength());
+        for (const TrieNode* pChild : vChildren) {
+            vQueue.push_back(pChild);
+            vNodes.push_back(Node{ static_cast<uint32_t>(ulIndex), 0, 0, 0, 0, 0, 0 });
+        }
+    }
+
+    Header header;
+    std::memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(header.magic));
+    header.version = SNAPSHOT_VERSION;
+    header.nodeCount = static_cast<uint32_t>(vNodes.size());
+    header.namesOffset = sizeof(Header) + vNodes.size() * sizeof(Node);
+    header.namesSize = szNames.size();
+
+    std::string szTempPath = szPath + ".tmp";
+    int iFd = ::open(szTempPath.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (iFd < 0) {
+        std::cerr << __FUNCTION__ << ": Failed to create '" << szTempPath
+                  << "', err: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    bool bWritten = WriteAll(iFd, &header, sizeof(header)) &&
+                    WriteAll(iFd, vNodes.data(), vNodes.size() * sizeof(Node)) &&
+                    WriteAll(iFd, szNames.data(), szNames.size());
+    int iErrno = errno;
+    if (::close(iFd) != 0 && bWritten) {
+        bWritten = false;
+        iErrno = errno;
+    }
+    if (!bWritten || rename(szTempPath.c_str(), szPath.c_str()) != 0) {
+        iErrno = bWritten ? errno : iErrno;
+        std::cerr << __FUNCTION__ << ": Failed to write '" << szPath
+                  << "', err: " << std::strerror(iErrno) << std::endl;
+        unlink(szTempPath.c_str());
+        return false;
+    }
+    return true;
+}
+
+bool TrieSnapshot::open(const std::string& szPath) {
+    close();
+
+    int iFd = ::open(szPath.c_str(), O_RDONLY | O_CLOEXEC);
+    if (iFd < 0) {
+        std::cerr << __FUNCTION__ << ": Failed to open '" << szPath
+                  << "', err: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat statBuf;
+    if (fstat(iFd, &statBuf) != 0 || static_cast<size_t>(statBuf.st_size) < sizeof(Header)) {
+        std::cerr << __FUNCTION__ << ": '" << szPath << "' is not a trie snapshot" << std::endl;
+        ::close(iFd);
+        return false;
+    }
+    size_t ulSize = statBuf.st_size;
+    void* pMapping = mmap(nullptr, ulSize, PROT_READ, MAP_PRIVATE, iFd, 0);
+    ::close(iFd);
+    if (pMapping == MAP_FAILED) {
+        std::cerr << __FUNCTION__ << ": Failed to map '" << szPath
+                  << "', err: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+
+    const Header* pHeader = static_cast<const Header*>(pMapping);
+    bool bValid = std::memcmp(pHeader->magic, SNAPSHOT_MAGIC, sizeof(pHeader->magic)) == 0 &&
+                  pHeader->version == SNAPSHOT_VERSION && pHeader->nodeCount > 0 &&
+                  pHeader->namesOffset == sizeof(Header) + uint64_t(pHeader->nodeCount) * sizeof(Node) &&
+                  pHeader->namesOffset + pHeader->namesSize == ulSize;
+    if (!bValid) {
+        std::cerr << __FUNCTION__ << ": '" << szPath << "' is not a trie snapshot" << std::endl;
+        munmap(pMapping, ulSize);
+        return false;
+    }
+
+    m_pMapping = pMapping;
+    m_ulMappingSize = ulSize;
+    m_pNodes = reinterpret_cast<const Node*>(pHeader + 1);
+    m_pNames = static_cast<const char*>(pMapping) + pHeader->namesOffset;
+    m_ulNodeCount = pHeader->nodeCount;
+    return true;
+}
+
+bool TrieSnapshot::isOpen() const {
+    return m_pMapping != nullptr;
+}
+
+void TrieSnapshot::close() {
+    if (m_pMapping) {
+        munmap(m_pMapping, m_ulMappingSize);
+    }
+    m_pMapping = nullptr;
+    m_ulMappingSize = 0;
+    m_pNodes = nullptr;
+    m_pNames = nullptr;
+    m_ulNodeCount = 0;
+}
+
+size_t TrieSnapshot::getNodeCount() const {
+    return m_ulNodeCount;
+}
+
+TrieSnapshot::NodeId TrieSnapshot::getRoot() const {
+    return m_ulNodeCount > 0 ? 0 : INVALID_NODE;
+}
+
+const TrieSnapshot::Node& TrieSnapshot::getNode(NodeId node) const {
+    return m_pNodes[node];
+}
+
+TrieSnapshot::NodeId TrieSnapshot::find(std::string_view path) const {
+    if (!isOpen() || path.empty() || path.front() != '/') {
+        return INVALID_NODE;
+    }
+    path.remove_prefix(1);
+    if (path.size() > 1 && path.back() == '/') {
+        path.remove_suffix(1);
+    }
+
+    NodeId node = getRoot();
+    while (!path.empty()) {
+        std::string_view part = path.substr(0, path.find('/'));
+        if (part.empty()) {
+            return INVALID_NODE;
+        }
+        node = getChild(node, part);
+        if (node == INVALID_NODE) {
+            return INVALID_NODE;
+        }
+        // A PathTrieMode::Radix edge has to match whole components
+        std::string_view edge = getNodeValue(node);
+        if (path.compare(0, edge.size(), edge) != 0 ||
+            (path.size() > edge.size() && path[edge.size()] != '/')) {
+            return INVALID_NODE;
+        }
+        path.remove_prefix(std::min(path.size(), edge.size() + 1));
+    }
+    return node;
+}
+
+TrieSnapshot::NodeId TrieSnapshot::getChild(NodeId node, std::string_view part) const {
+    const Node& parent = getNode(node);
+    const Node* pBegin = m_pNodes + parent.firstChild;
+    const Node* pEnd = pBegin + parent.childCount;
+    const Node* pChild = std::lower_bound(pBegin, pEnd, part, [this](const Node& lhs, std::string_view rhs) {
+        return EdgeKey(std::string_view(m_pNames + lhs.nameOffset, lhs.nameLength)) < rhs;
+    });
+    if (pChild == pEnd || EdgeKey(std::string_view(m_pNames + pChild->nameOffset, pChild->nameLength)) != part) {
+        return INVALID_NODE;
+    }
+    return static_cast<NodeId>(pChild - m_pNodes);
+}
+
+size_t TrieSnapshot::getChildCount(NodeId node) const {
+    return getNode(node).childCount;
+}
+
+TrieSnapshot::NodeId TrieSnapshot::getChild(NodeId node, size_t i) const {
+    const Node& parent = getNode(node);
+    return i < parent.childCount ? parent.firstChild + static_cast<NodeId>(i) : INVALID_NODE;
+}
+
+void TrieSnapshot::forEachChild(NodeId node, const std::function<void(NodeId)>& visit) const {
+    const Node& parent = getNode(node);
+    for (NodeId child = parent.firstChild; child < parent.firstChild + parent.childCount; ++child) {
+        visit(child);
+    }
+}
+
+std::string_view TrieSnapshot::getNodeValue(NodeId node) const {
+    const Node& entry = getNode(node);
+    return std::string_view(m_pNames + entry.nameOffset, entry.nameLength);
+}
+
+TrieSnapshot::NodeId TrieSnapshot::getParent(NodeId node) const {
+    return getNode(node).parent;
+}
+
+size_t TrieSnapshot::getDepth(NodeId node) const {
+    return getNode(node).depth;
+}
+
+size_t TrieSnapshot::getPathLength(NodeId node) const {
+    return getNode(node).pathLength;
+}
+
+std::string TrieSnapshot::getFullPath(NodeId node) const {
+    std::string path;
+    getFullPath(node, path);
+    return path;
+}
+
+void TrieSnapshot::getFullPath(NodeId node, std::string& path) const {
+    if (!isOpen() || node == INVALID_NODE) {
+        path.clear();
+        return;
+    }
+
+    // Fill the buffer from the back, as TrieNode::getFullPath does
+    size_t pos = getNode(node).pathLength;
+    path.resize(pos);
+    for (NodeId current = node; current != INVALID_NODE; current = getNode(current).parent) {
+        const Node& entry = getNode(current);
+        pos -= entry.nameLength;
+        std::memcpy(&path[pos], m_pNames + entry.nameOffset, entry.nameLength);
+        if (entry.parent != INVALID_NODE && entry.parent != getRoot()) {
+            path[--pos] = '/';
+        }
+    }
+}
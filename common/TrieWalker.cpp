@@ -0,0 +1,172 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "TrieWalker.h"
+#include "TrieNode.h"
+#include <algorithm>
+
+TrieWalker::TrieWalker(TrieNode* root, TrieOrder order, bool bSorted)
+    : m_eOrder(order), m_bSorted(bSorted) {
+    reset(root);
+}
+
+void TrieWalker::reset(TrieNode* root) {
+    m_pRoot = root;
+    m_pLast = nullptr;
+    m_bSkip = false;
+    m_ulDepth = 0;
+    m_vStack.clear();
+    m_vSorted.clear();
+    m_vLevel.clear();
+    m_vNextLevel.clear();
+    m_ulPos = 0;
+    if (root == nullptr) {
+        return;
+    }
+    if (m_eOrder == TrieOrder::BreadthFirst) {
+        m_vLevel.push_back(root);
+    } else if (m_eOrder == TrieOrder::PostOrder) {
+        push(root);
+    }
+}
+
+TrieNode* TrieWalker::next() {
+    return m_eOrder == TrieOrder::BreadthFirst ? nextBreadthFirst() : nextDepthFirst();
+}
+
+size_t TrieWalker::getDepth() const {
+    return m_ulDepth;
+}
+
+void TrieWalker::skipChildren() {
+    m_bSkip = true;
+}
+
+bool TrieWalker::Walk(TrieNode* root, TrieOrder order, const std::function<TrieVisit(TrieNode*, size_t)>& visit,
+                      bool bSorted) {
+    TrieWalker walker(root, order, bSorted);
+    while (TrieNode* node = walker.next()) {
+        TrieVisit eVisit = visit(node, walker.getDepth());
+        if (eVisit == TrieVisit::Stop) {
+            return false;
+        }
+        if (eVisit == TrieVisit::SkipChildren) {
+            walker.skipChildren();
+        }
+    }
+    return true;
+}
+
+// Only nodes with a hash index can be out of name order, see linkChild
+void TrieWalker::push(TrieNode* pNode) {
+    TrieNode* const* pBegin = pNode->children.data();
+    TrieNode* const* pEnd = pBegin + pNode->children.size();
+    if (!m_bSorted || pNode->hasSortedChildren()) {
+        m_vStack.push_back(Frame{ pNode, pBegin, pEnd, NOT_SORTED });
+        return;
+    }
+
+    size_t ulSorted = m_vSorted.size();
+    TrieNode* const* pOld = m_vSorted.data();
+    m_vSorted.insert(m_vSorted.end(), pBegin, pEnd);
+    std::sort(m_vSorted.begin() + ulSorted, m_vSorted.end(), TrieNode::compareNames);
+    if (m_vSorted.data() != pOld) {
+        // Grown, move the frames into sorted copies along
+        for (Frame& frame : m_vStack) {
+            if (frame.ulSorted != NOT_SORTED) {
+                frame.pNext = m_vSorted.data() + (frame.pNext - pOld);
+                frame.pEnd = m_vSorted.data() + (frame.pEnd - pOld);
+            }
+        }
+    }
+    m_vStack.push_back(Frame{ pNode, m_vSorted.data() + ulSorted, m_vSorted.data() + m_vSorted.size(), ulSorted });
+}
+
+void TrieWalker::pop() {
+    if (m_vStack.back().ulSorted != NOT_SORTED) {
+        m_vSorted.resize(m_vStack.back().ulSorted);
+    }
+    m_vStack.pop_back();
+}
+
+TrieNode* TrieWalker::nextDepthFirst() {
+    if (m_eOrder == TrieOrder::PreOrder) {
+        // The root first, then descend into the node returned last. Once the
+        // walk is done both are nullptr.
+        if (m_pLast == nullptr) {
+            m_pLast = m_pRoot;
+            m_pRoot = nullptr;
+            m_ulDepth = 0;
+            return m_pLast;
+        }
+        if (!m_bSkip && !m_pLast->children.empty()) {
+            push(m_pLast);
+            m_ulDepth = m_vStack.size();
+            m_pLast = *m_vStack.back().pNext++;
+            return m_pLast;
+        }
+        m_bSkip = false;
+        while (!m_vStack.empty()) {
+            Frame& frame = m_vStack.back();
+            if (frame.pNext != frame.pEnd) {
+                m_pLast = *frame.pNext++;
+                m_ulDepth = m_vStack.size();
+                return m_pLast;
+            }
+            pop();
+        }
+        m_pLast = nullptr;
+        return nullptr;
+    }
+
+    while (!m_vStack.empty()) {
+        Frame& frame = m_vStack.back();
+        if (frame.pNext != frame.pEnd) {
+            push(*frame.pNext++);
+            continue;
+        }
+        m_pLast = frame.pNode;
+        m_ulDepth = m_vStack.size() - 1;
+        pop();
+        return m_pLast;
+    }
+    return nullptr;
+}
+
+TrieNode* TrieWalker::nextBreadthFirst() {
+    if (m_pLast != nullptr && !m_bSkip) {
+        size_t ulFirst = m_vNextLevel.size();
+        m_vNextLevel.insert(m_vNextLevel.end(), m_pLast->children.begin(), m_pLast->children.end());
+        if (m_bSorted && !m_pLast->hasSortedChildren()) {
+            std::sort(m_vNextLevel.begin() + ulFirst, m_vNextLevel.end(), TrieNode::compareNames);
+        }
+    }
+    m_bSkip = false;
+    if (m_ulPos == m_vLevel.size()) {
+        if (m_vNextLevel.empty()) {
+            m_pLast = nullptr;
+            return nullptr;
+        }
+        m_vLevel.swap(m_vNextLevel);
+        m_vNextLevel.clear();
+        m_ulPos = 0;
+        ++m_ulDepth;
+    }
+    m_pLast = m_vLevel[m_ulPos++];
+    return m_pLast;
+}
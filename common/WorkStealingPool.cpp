@@ -0,0 +1,134 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "WorkStealingPool.h"
+
+namespace {
+// Set on worker threads so that submit() can find the calling worker
+thread_local const WorkStealingPool* tl_pPool = nullptr;
+thread_local unsigned int tl_iWorker = 0;
+}
+
+WorkStealingPool::WorkStealingPool(unsigned int nThreads)
+    : m_ulQueued(0), m_ulPending(0), m_iNextWorker(0), m_bStop(false) {
+    if (nThreads == 0) {
+        nThreads = std::thread::hardware_concurrency();
+    }
+    if (nThreads == 0) {
+        nThreads = 1;
+    }
+
+    for (unsigned int i = 0; i < nThreads; ++i) {
+        m_workers.push_back(std::make_unique<Worker>());
+    }
+    for (unsigned int i = 0; i < nThreads; ++i) {
+        m_threads.emplace_back(&WorkStealingPool::run, this, i);
+    }
+}
+
+WorkStealingPool::~WorkStealingPool() {
+    wait();
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_bStop = true;
+    }
+    m_cvWork.notify_all();
+    for (auto& thread : m_threads) {
+        thread.join();
+    }
+}
+
+void WorkStealingPool::submit(std::function<void()> task) {
+    unsigned int iIndex;
+    if (tl_pPool == this) {
+        iIndex = tl_iWorker;
+    } else {
+        iIndex = m_iNextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+    }
+
+    m_ulPending.fetch_add(1);
+    {
+        std::lock_guard<std::mutex> lock(m_workers[iIndex]->mutex);
+        m_workers[iIndex]->tasks.push_back(std::move(task));
+        m_ulQueued.fetch_add(1);
+    }
+
+    // Taking the lock orders the increment above with a sleeping worker's check
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+    }
+    m_cvWork.notify_one();
+}
+
+void WorkStealingPool::wait() {
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_cvDone.wait(lock, [this] { return m_ulPending.load() == 0; });
+}
+
+unsigned int WorkStealingPool::size() const {
+    return static_cast<unsigned int>(m_workers.size());
+}
+
+void WorkStealingPool::run(unsigned int iIndex) {
+    tl_pPool = this;
+    tl_iWorker = iIndex;
+
+    while (true) {
+        std::function<void()> task;
+        if (pop(iIndex, task) || steal(iIndex, task)) {
+            task();
+            if (m_ulPending.fetch_sub(1) == 1) {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_cvDone.notify_all();
+            }
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(m_mutex);
+        m_cvWork.wait(lock, [this] { return m_bStop || m_ulQueued.load() > 0; });
+        if (m_bStop && m_ulQueued.load() == 0) {
+            return;
+        }
+    }
+}
+
+bool WorkStealingPool::pop(unsigned int iIndex, std::function<void()>& task) {
+    Worker& worker = *m_workers[iIndex];
+    std::lock_guard<std::mutex> lock(worker.mutex);
+    if (worker.tasks.empty()) {
+        return false;
+    }
+    task = std::move(worker.tasks.back());
+    worker.tasks.pop_back();
+    m_ulQueued.fetch_sub(1);
+    return true;
+}
+
+bool WorkStealingPool::steal(unsigned int iIndex, std::function<void()>& task) {
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+        Worker& victim = *m_workers[(iIndex + i) % m_workers.size()];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (!victim.tasks.empty()) {
+            task = std::move(victim.tasks.front());
+            victim.tasks.pop_front();
+            m_ulQueued.fetch_sub(1);
+            return true;
+        }
+    }
+    return false;
+}
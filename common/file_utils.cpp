@@ -27,22 +27,43 @@
 #include <vector>
 #include <sstream>
 #include <queue>
+#include <deque>
+#include <chrono>
 #include <stack>
+#include <atomic>
+#include <memory>
+#include <unordered_map>
+#include <mutex>
+#include <set>
+#include <algorithm>
+#include <limits.h>
 #include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <sys/ioctl.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
 #include "TrieNode.h"
 #include "PathTrie.h"
+#include "syscall_stats.h"
+#include "WorkStealingPool.h"
+#include "TrashReclaimer.h"
+#include "DirCache.h"
 #include "trace.h"
+#ifdef IO_URING_ENABLE
+#include <linux/io_uring.h>
+#include "IoUring.h"
+#endif
 
-bool CreateDir(const std::string& szPath)
-{
-    TRACE_FUNCTION();
-    if (szPath.empty()) {
-        errno = EINVAL;
-        std::cerr << __FUNCTION__ << ": Invalid input!" << std::endl;
-        return false;
-    }
+#define IO_URING_ENTRIES            256
+#define REMOVE_DIR_STREAM_BUFFER    32768       // getdents64 buffer of RemoveDirStreaming
+#define REMOVE_DIR_STREAM_FDS       64          // fd cap of RemoveDirMode::Streaming
 
+static bool CreateDirStatFirst(const std::string& szPath)
+{
     struct stat st;
+    SYSCALL_COUNT(Stat);
     if (stat(szPath.c_str(), &st) == 0) {
         if (S_ISDIR(st.st_mode)) {
             return true; // Directory already existed
@@ -75,7 +96,9 @@ bool CreateDir(const std::string& szPath)
         }
         szCurrentPath += part;
 
+        SYSCALL_COUNT(Stat);
         if (stat(szCurrentPath.c_str(), &st) != 0) { // Check if it exists
+            SYSCALL_COUNT(Mkdir);
             if (mkdir(szCurrentPath.c_str(), 0755) != 0) { // Create if missing
                 if (errno != EEXIST) { // Ignore "already exists" error
                     std::cerr << __FUNCTION__ << ": Failed to create directory '"
@@ -92,9 +115,431 @@ bool CreateDir(const std::string& szPath)
     return true;
 }
 
-bool RemoveDir(const std::string& szPath, bool bSaveParentPath)
+// Verify that an existing path is a directory
+static bool CheckIsDir(const std::string& szPath)
+{
+    struct stat st;
+    SYSCALL_COUNT(Stat);
+    if (stat(szPath.c_str(), &st) != 0) {
+        std::cerr << __FUNCTION__ << ": Failed to stat '" << szPath
+                  << "', err: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (!S_ISDIR(st.st_mode)) {
+        errno = ENOTDIR;
+        std::cerr << __FUNCTION__ << ": Path exists but is not a directory!" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+// Try mkdir on the leaf first. Only on ENOENT walk backwards to the deepest
+// existing ancestor and create forward from there, so a missing leaf costs a
+// single mkdir. EEXIST on the way forward means a concurrent creator won the
+// race, which is fine.
+static bool CreateDirMkdirFirst(const std::string& szPath)
+{
+    // Prefixes are cut in place by writing '\0' at their end offset
+    std::string szWork = szPath;
+    std::vector<size_t> vEnds;
+    for (size_t i = 1; i <= szWork.size(); ++i) {
+        if ((i == szWork.size() || szWork[i] == '/') && szWork[i - 1] != '/') {
+            vEnds.push_back(i);
+        }
+    }
+    if (vEnds.empty()) {
+        return CheckIsDir(szPath);
+    }
+
+    auto mkdirPrefix = [&szWork, &vEnds](size_t ulIndex) {
+        size_t ulEnd = vEnds[ulIndex];
+        bool bCut = ulEnd < szWork.size();
+        if (bCut) {
+            szWork[ulEnd] = '\0';
+        }
+        SYSCALL_COUNT(Mkdir);
+        int iRet = mkdir(szWork.c_str(), 0755);
+        int iErrno = errno;
+        if (bCut) {
+            szWork[ulEnd] = '/';
+        }
+        errno = iErrno;
+        return iRet;
+    };
+    auto reportError = [&szWork, &vEnds](size_t ulIndex) {
+        int iErrno = errno;
+        std::cerr << "CreateDirMkdirFirst: Failed to create directory '"
+                  << szWork.substr(0, vEnds[ulIndex]) << "', err: " << std::strerror(iErrno) << std::endl;
+        errno = iErrno;
+        return false;
+    };
+
+    const size_t ulLeaf = vEnds.size() - 1;
+    size_t ulIndex = ulLeaf;
+    while (mkdirPrefix(ulIndex) != 0) {
+        if (errno == EEXIST) {
+            if (ulIndex == ulLeaf) {
+                return CheckIsDir(szPath); // Directory already existed
+            }
+            break;  // Deepest existing ancestor found
+        }
+        if (errno != ENOENT || ulIndex == 0) {
+            return reportError(ulIndex);
+        }
+        --ulIndex;
+    }
+
+    // Create forward from the first missing component
+    for (++ulIndex; ulIndex <= ulLeaf; ++ulIndex) {
+        if (mkdirPrefix(ulIndex) != 0) {
+            if (errno != EEXIST) {
+                return reportError(ulIndex);
+            }
+            if (ulIndex == ulLeaf) {
+                return CheckIsDir(szPath);
+            }
+        }
+    }
+
+    return true;
+}
+
+static const std::string& NormalizeCachedPath(const std::string& szPath, std::string& szBuffer);
+
+// Existing prefixes come from DirCache, so an existing directory costs no
+// syscall and a missing one exactly one mkdir per missing component
+static bool CreateDirCached(const std::string& szPath)
+{
+    std::string szBuffer;
+    const std::string& szFull = NormalizeCachedPath(szPath, szBuffer);
+    int iExisting = szFull.empty() ? -1 : DirCache::Instance().lookup(szFull);
+    if (iExisting < 0) {
+        return CreateDirMkdirFirst(szPath);
+    }
+
+    int iComponent = 0;
+    for (size_t i = 1; i <= szFull.size(); ++i) {
+        if (i < szFull.size() && szFull[i] != '/') {
+            continue;
+        }
+        if (iComponent++ < iExisting) {
+            continue;
+        }
+        std::string szPrefix = szFull.substr(0, i);
+        SYSCALL_COUNT(Mkdir);
+        if (mkdir(szPrefix.c_str(), 0755) != 0) {
+            // Created by someone else meanwhile, or a file in the way
+            if (errno != EEXIST) {
+                int iErrno = errno;
+                std::cerr << __FUNCTION__ << ": Failed to create directory '" << szPrefix
+                          << "', err: " << std::strerror(iErrno) << std::endl;
+                errno = iErrno;
+                return false;
+            }
+            if (!CheckIsDir(szPrefix)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+#ifdef IO_URING_ENABLE
+// Ring shared by the io_uring paths of the calling thread, nullptr if the
+// kernel does not support it
+static IoUring* GetThreadRing()
+{
+    static thread_local IoUring ring;
+    if (!IoUring::IsSupported()) {
+        return nullptr;
+    }
+    if (!ring.isReady() && !ring.init(IO_URING_ENTRIES)) {
+        return nullptr;
+    }
+    return &ring;
+}
+
+static bool CreateDirIoUring(const std::string& szPath)
+{
+    IoUring* pRing = GetThreadRing();
+
+    // Every prefix of the path, kept alive until the batch completes
+    std::vector<std::string> vPrefixes;
+    size_t ulStart = 0;
+    for (size_t i = 0; i <= szPath.size(); ++i) {
+        if (i == szPath.size() || szPath[i] == '/') {
+            if (i > ulStart) {
+                vPrefixes.push_back(szPath.substr(0, i));
+            }
+            ulStart = i + 1;
+        }
+    }
+    if (!pRing || vPrefixes.size() + 1 > pRing->capacity()) {
+        return CreateDirStatFirst(szPath);
+    }
+
+    // Hard links keep the order but let the chain continue past EEXIST
+    struct statx stx;
+    for (size_t i = 0; i < vPrefixes.size(); ++i) {
+        pRing->prepMkdirat(AT_FDCWD, vPrefixes[i].c_str(), 0755, i, IOSQE_IO_HARDLINK);
+    }
+    pRing->prepStatx(AT_FDCWD, szPath.c_str(), 0, STATX_TYPE, &stx, vPrefixes.size());
+
+    std::vector<int> vResults(vPrefixes.size() + 1, 0);
+    if (!pRing->submitAndWait([&vResults](uint64_t ulIndex, int iRes) { vResults[ulIndex] = iRes; })) {
+        return CreateDirStatFirst(szPath);
+    }
+
+    for (size_t i = 0; i < vPrefixes.size(); ++i) {
+        if (vResults[i] < 0 && vResults[i] != -EEXIST) {
+            errno = -vResults[i];
+            std::cerr << __FUNCTION__ << ": Failed to create directory '"
+                      << vPrefixes[i] << "', err: " << std::strerror(errno) << std::endl;
+            return false;
+        }
+    }
+    if (vResults.back() < 0) {
+        errno = -vResults.back();
+        std::cerr << __FUNCTION__ << ": Failed to stat '" << szPath
+                  << "', err: " << std::strerror(errno) << std::endl;
+        return false;
+    }
+    if (!S_ISDIR(stx.stx_mode)) {
+        errno = ENOTDIR;
+        std::cerr << __FUNCTION__ << ": Path exists but is not a directory!" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+#endif
+
+bool CreateDir(const std::string& szPath)
+{
+    return CreateDir(szPath, CreateDirMode::StatFirst);
+}
+
+bool CreateDir(const std::string& szPath, CreateDirMode eMode)
+{
+    TRACE_FUNCTION();
+    if (szPath.empty()) {
+        errno = EINVAL;
+        std::cerr << __FUNCTION__ << ": Invalid input!" << std::endl;
+        return false;
+    }
+
+    switch (eMode) {
+    case CreateDirMode::StatFirst:
+        return CreateDirStatFirst(szPath);
+    case CreateDirMode::MkdirFirst:
+        return CreateDirMkdirFirst(szPath);
+    case CreateDirMode::IoUring:
+#ifdef IO_URING_ENABLE
+        return CreateDirIoUring(szPath);
+#else
+        return CreateDirStatFirst(szPath);
+#endif
+    case CreateDirMode::Cached:
+        return CreateDirCached(szPath);
+    }
+
+    errno = EINVAL;
+    return false;
+}
+
+namespace {
+// Directory fd shared by the tasks creating its children
+struct SharedDirFd {
+    explicit SharedDirFd(int iFd) : iFd(iFd) {}
+    ~SharedDirFd() {
+        if (iFd >= 0) {
+            close(iFd);
+        }
+    }
+
+    int iFd;
+};
+
+struct CreateDirsContext {
+    WorkStealingPool* pPool;
+    std::unordered_map<const TrieNode*, size_t> mapIndex;
+    std::vector<int> vErrors;           // one slot per trie node, written once
+};
+
+// Create (or just open, if it already exists) pNode below pParent. Returns
+// the fd of the new directory when bOpen is set, -1 otherwise or on error.
+int CreateDirsNode(CreateDirsContext& ctx, int iParentFd, const TrieNode* pNode, bool bOpen)
+{
+    const char* szName = pNode->getNodeValue().c_str();
+    int& iError = ctx.vErrors[ctx.mapIndex.at(pNode)];
+
+    if (bOpen) {
+        // Intermediate directories usually exist already, try the open first
+        SYSCALL_COUNT(Openat);
+        int iFd = openat(iParentFd, szName, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        if (iFd >= 0) {
+            return iFd;
+        }
+        if (errno != ENOENT) {
+            iError = errno;
+            return -1;
+        }
+    }
+
+    SYSCALL_COUNT(Mkdirat);
+    if (mkdirat(iParentFd, szName, 0755) != 0) {
+        if (errno != EEXIST) {
+            iError = errno;
+            return -1;
+        }
+        if (!bOpen) {
+            // Lost a race or the target existed, make sure it is a directory
+            struct stat st;
+            SYSCALL_COUNT(Fstatat);
+            if (fstatat(iParentFd, szName, &st, 0) != 0) {
+                iError = errno;
+            } else if (!S_ISDIR(st.st_mode)) {
+                iError = ENOTDIR;
+            }
+            return -1;
+        }
+    }
+
+    if (!bOpen) {
+        return -1;
+    }
+    SYSCALL_COUNT(Openat);
+    int iFd = openat(iParentFd, szName, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (iFd < 0) {
+        iError = errno;
+    }
+    return iFd;
+}
+
+// Create every child of the directory held by pDir. Children with their own
+// children become new tasks, so sibling subtrees are built in parallel.
+void CreateDirsChildren(CreateDirsContext& ctx, const TrieNode* pNode, std::shared_ptr<SharedDirFd> pDir)
+{
+    pNode->forEachChild([&ctx, &pDir](TrieNode* pChild) {
+        if (pChild->getChildCount() == 0) {
+            CreateDirsNode(ctx, pDir->iFd, pChild, false);
+            return;
+        }
+        ctx.pPool->submit([&ctx, pDir, pChild] {
+            int iFd = CreateDirsNode(ctx, pDir->iFd, pChild, true);
+            if (iFd >= 0) {
+                CreateDirsChildren(ctx, pChild, std::make_shared<SharedDirFd>(iFd));
+            }
+        });
+    });
+}
+
+// Turn a path into an absolute one without empty components, as PathTrie
+// expects
+std::string NormalizeCreatePath(const std::string& szPath, const std::string& szCwd)
+{
+    std::string szFull = szPath[0] == '/' ? szPath : szCwd + "/" + szPath;
+    std::string szNormalized;
+    szNormalized.reserve(szFull.size());
+    for (char c : szFull) {
+        if (c == '/' && !szNormalized.empty() && szNormalized.back() == '/') {
+            continue;
+        }
+        szNormalized += c;
+    }
+    if (szNormalized.size() > 1 && szNormalized.back() == '/') {
+        szNormalized.pop_back();
+    }
+    return szNormalized;
+}
+}
+
+// Absolute paths without empty components are used as they are, only
+// relative ones cost a getcwd. The result is szPath or szBuffer, empty if
+// the cwd is unknown.
+static const std::string& NormalizeCachedPath(const std::string& szPath, std::string& szBuffer)
+{
+    if (szPath[0] == '/') {
+        if (szPath.find("//") == std::string::npos && (szPath.size() == 1 || szPath.back() != '/')) {
+            return szPath;
+        }
+        szBuffer = NormalizeCreatePath(szPath, "");
+        return szBuffer;
+    }
+    char szCwd[PATH_MAX];
+    if (getcwd(szCwd, sizeof(szCwd)) != nullptr) {
+        szBuffer = NormalizeCreatePath(szPath, szCwd);
+    }
+    return szBuffer;
+}
+
+std::vector<int> CreateDirs(const std::vector<std::string>& vPaths, unsigned int nThreads)
 {
     TRACE_FUNCTION();
+    std::vector<int> vResults(vPaths.size(), 0);
+    std::vector<const TrieNode*> vTargets(vPaths.size(), nullptr);
+
+    char szCwd[PATH_MAX];
+    bool bHasCwd = getcwd(szCwd, sizeof(szCwd)) != nullptr;
+
+    // Shared prefixes collapse into the same trie nodes
+    PathTrie pathTrie(PathTrieMode::Arena);
+    for (size_t i = 0; i < vPaths.size(); ++i) {
+        if (vPaths[i].empty() || (vPaths[i][0] != '/' && !bHasCwd)) {
+            vResults[i] = EINVAL;
+            continue;
+        }
+        vTargets[i] = pathTrie.insert(NormalizeCreatePath(vPaths[i], szCwd));
+        if (!vTargets[i]) {
+            vResults[i] = EINVAL;
+        }
+    }
+
+    CreateDirsContext ctx;
+    TrieWalker walker(pathTrie.GetRoot(), TrieOrder::BreadthFirst);
+    while (const TrieNode* pNode = walker.next()) {
+        ctx.mapIndex.emplace(pNode, ctx.mapIndex.size());
+    }
+    ctx.vErrors.assign(ctx.mapIndex.size(), 0);
+
+    SYSCALL_COUNT(Open);
+    int iRootFd = open("/", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (iRootFd < 0) {
+        ctx.vErrors[0] = errno;
+    } else {
+        WorkStealingPool pool(nThreads);
+        ctx.pPool = &pool;
+        CreateDirsChildren(ctx, pathTrie.GetRoot(), std::make_shared<SharedDirFd>(iRootFd));
+        pool.wait();
+    }
+
+    // A target inherits the error of the first ancestor that failed
+    for (size_t i = 0; i < vPaths.size(); ++i) {
+        for (const TrieNode* pNode = vTargets[i]; pNode && vResults[i] == 0; pNode = pNode->getParent()) {
+            vResults[i] = ctx.vErrors[ctx.mapIndex.at(pNode)];
+        }
+        if (vResults[i] != 0) {
+            std::cerr << __FUNCTION__ << ": Failed to create directory '" << vPaths[i]
+                      << "', err: " << std::strerror(vResults[i]) << std::endl;
+        }
+    }
+
+    return vResults;
+}
+
+// CreateDirMode::Cached trusts DirCache without a syscall, so a removal
+// has to be in the mirror before the caller can create the same path again
+static void SyncDirCache()
+{
+    if (DirCache::IsWatching()) {
+        int iErrno = errno;
+        DirCache::Instance().sync();
+        errno = iErrno;
+    }
+}
+
+static bool RemoveDirPathBased(const std::string& szPath, bool bSaveParentPath)
+{
     PathTrie pathTrie;
     std::queue<TrieNode*> queueDirs;
     std::stack<TrieNode*> stackDirs;
@@ -107,6 +552,7 @@ bool RemoveDir(const std::string& szPath, bool bSaveParentPath)
         std::string currentDir = TrieNode::getFullPath(queueDirs.front());
         queueDirs.pop();
 
+        SYSCALL_COUNT(Opendir);
         DIR* dir = opendir(currentDir.c_str());
         if(!dir) {
             std::cerr << "Failed to open directory: " << currentDir << std::endl;
@@ -121,9 +567,11 @@ bool RemoveDir(const std::string& szPath, bool bSaveParentPath)
 
             std::string fullPath = currentDir + "/" + entry->d_name;
             struct stat st;
+            SYSCALL_COUNT(Lstat);
             if (lstat(fullPath.c_str(), &st) == 0) {
                 if (S_ISLNK(st.st_mode)) {
                     // If it's a symbolic link, delete it immediately
+                    SYSCALL_COUNT(Remove);
                     if (remove(fullPath.c_str()) != 0) {
                         std::cerr << "Failed to delete symbolic link: " << strerror(errno) << std::endl;
                         return false;
@@ -140,6 +588,7 @@ bool RemoveDir(const std::string& szPath, bool bSaveParentPath)
                     }
                 } else {
                     // If it's a regular file, attempt to delete it
+                    SYSCALL_COUNT(Remove);
                     if (remove(fullPath.c_str()) != 0) {
                         std::cerr << "Failed to delete file: " << strerror(errno) << std::endl;
                         return false;
@@ -158,6 +607,7 @@ bool RemoveDir(const std::string& szPath, bool bSaveParentPath)
         pNode = stackDirs.top();
         stackDirs.pop();
         std::string fullPath = TrieNode::getFullPath(pNode);
+        SYSCALL_COUNT(Rmdir);
         if (fullPath != "" && rmdir(fullPath.c_str()) != 0) {
             std::cerr << "Failed to delete directory: " << fullPath << std::endl;
             return false;
@@ -165,6 +615,125 @@ bool RemoveDir(const std::string& szPath, bool bSaveParentPath)
     }
 
     if (!bSaveParentPath) {
+        SYSCALL_COUNT(Rmdir);
+        if (rmdir(szPath.c_str()) != 0) {
+            std::cerr << "Failed to delete directory: " << szPath << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Same BFS + PathTrie walk as RemoveDirPathBased, but every entry is handled
+// relative to its directory fd, so the kernel only resolves a full path once
+// per directory instead of once per entry.
+static bool RemoveDirFdRelative(const std::string& szPath, bool bSaveParentPath)
+{
+    PathTrie pathTrie(PathTrieMode::Arena);
+    std::queue<TrieNode*> queueDirs;
+    std::stack<TrieNode*> stackDirs;
+
+    TrieNode* pNode = pathTrie.insert(szPath);
+    if(pNode) {
+        queueDirs.push(pNode);
+    }
+    std::string currentDir;
+    while(!queueDirs.empty()) {
+        TrieNode* pDirNode = queueDirs.front();
+        TrieNode::getFullPath(pDirNode, currentDir);
+        queueDirs.pop();
+
+        SYSCALL_COUNT(Open);
+        int iDirFd = open(currentDir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (iDirFd < 0) {
+            std::cerr << "Failed to open directory: " << currentDir << std::endl;
+            return false;
+        }
+        DIR* dir = fdopendir(iDirFd);
+        if(!dir) {
+            std::cerr << "Failed to open directory: " << currentDir << std::endl;
+            close(iDirFd);
+            return false;
+        }
+
+        struct dirent* entry;
+        while((entry = readdir(dir)) != nullptr) {
+            if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            unsigned char ucType = entry->d_type;
+            if (ucType == DT_UNKNOWN) {
+                // File system does not fill d_type, fall back to fstatat
+                struct stat st;
+                SYSCALL_COUNT(Fstatat);
+                if (fstatat(iDirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    std::cerr << "Failed to stat file: " << strerror(errno) << std::endl;
+                    closedir(dir);
+                    return false;
+                }
+                ucType = IFTODT(st.st_mode);
+            }
+
+            if (ucType == DT_DIR) {
+                // If it's a directory, continue processing
+                pNode = pathTrie.insertChild(pDirNode, entry->d_name);
+                if (pNode) {
+                    queueDirs.push(pNode);
+                    stackDirs.push(pNode);
+                } else {
+                    // Error
+                    closedir(dir);
+                    return false;
+                }
+            } else {
+                // Symbolic links, regular files and special files are unlinked in place
+                SYSCALL_COUNT(Unlinkat);
+                if (unlinkat(iDirFd, entry->d_name, 0) != 0) {
+                    std::cerr << "Failed to delete file: " << strerror(errno) << std::endl;
+                    closedir(dir);
+                    return false;
+                }
+            }
+        }
+        closedir(dir);
+    }
+
+    // Reversely rmdir until parent folder. Siblings sit next to each other on
+    // the stack, so their parent fd is opened once and reused.
+    TrieNode* pOpenParent = nullptr;
+    int iParentFd = -1;
+    std::string parentPath;
+    while(!stackDirs.empty()) {
+        pNode = stackDirs.top();
+        stackDirs.pop();
+        if (pNode->getParent() != pOpenParent) {
+            if (iParentFd >= 0) {
+                close(iParentFd);
+            }
+            pOpenParent = pNode->getParent();
+            TrieNode::getFullPath(pOpenParent, parentPath);
+            SYSCALL_COUNT(Open);
+            iParentFd = open(parentPath.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (iParentFd < 0) {
+                std::cerr << "Failed to open directory: " << parentPath << std::endl;
+                return false;
+            }
+        }
+        SYSCALL_COUNT(Unlinkat);
+        if (unlinkat(iParentFd, pNode->getNodeValue().c_str(), AT_REMOVEDIR) != 0) {
+            std::cerr << "Failed to delete directory: " << TrieNode::getFullPath(pNode) << std::endl;
+            close(iParentFd);
+            return false;
+        }
+    }
+    if (iParentFd >= 0) {
+        close(iParentFd);
+    }
+
+    if (!bSaveParentPath) {
+        SYSCALL_COUNT(Rmdir);
         if (rmdir(szPath.c_str()) != 0) {
             std::cerr << "Failed to delete directory: " << szPath << std::endl;
             return false;
@@ -173,3 +742,1702 @@ bool RemoveDir(const std::string& szPath, bool bSaveParentPath)
 
     return true;
 }
+
+#ifdef IO_URING_ENABLE
+namespace {
+// Queues unlinkat operations on a ring and reports the first failure
+class UringUnlinkBatch {
+public:
+    explicit UringUnlinkBatch(IoUring& ring) : m_ring(ring), m_iErrno(0) {}
+
+    // szName must stay valid until the next flush(). Chains (iSqeFlags with
+    // IOSQE_IO_LINK) must be sized by the caller to fit in freeSlots().
+    bool add(int iDirFd, const std::string& szName, int iFlags, unsigned int iSqeFlags = 0) {
+        if (m_ring.freeSlots() == 0 && !flush()) {
+            return false;
+        }
+        m_vNames.push_back(&szName);
+        return m_ring.prepUnlinkat(iDirFd, szName.c_str(), iFlags, m_vNames.size() - 1, iSqeFlags);
+    }
+
+    bool flush() {
+        bool bSubmitted = m_ring.submitAndWait([this](uint64_t ulIndex, int iRes) {
+            // Cancelled links are a consequence of an earlier failure
+            if (iRes < 0 && iRes != -ECANCELED && m_iErrno == 0) {
+                m_iErrno = -iRes;
+                std::cerr << "Failed to delete: " << *m_vNames[ulIndex]
+                          << ", err: " << strerror(m_iErrno) << std::endl;
+            }
+        });
+        m_vNames.clear();
+        if (!bSubmitted && m_iErrno == 0) {
+            m_iErrno = errno;
+        }
+        if (m_iErrno != 0) {
+            errno = m_iErrno;
+            return false;
+        }
+        return true;
+    }
+
+    IoUring& ring() {
+        return m_ring;
+    }
+
+private:
+    IoUring& m_ring;
+    std::vector<const std::string*> m_vNames;
+    int m_iErrno;
+};
+}
+
+// FdRelative walk where the per-entry calls of a directory go to the kernel as
+// one io_uring batch. A directory without sub directories is removed by the
+// same batch: its rmdir is linked behind the unlinks of its contents.
+// Directories with sub directories are removed afterwards, one batch per
+// depth level, deepest first.
+static bool RemoveDirIoUring(const std::string& szPath, bool bSaveParentPath)
+{
+    IoUring* pRing = GetThreadRing();
+    if (!pRing) {
+        return RemoveDirFdRelative(szPath, bSaveParentPath);
+    }
+
+    UringUnlinkBatch batch(*pRing);
+    PathTrie pathTrie(PathTrieMode::Arena);
+    std::queue<std::pair<TrieNode*, size_t>> queueDirs;
+    std::vector<std::vector<TrieNode*>> vLevels;
+
+    TrieNode* pRoot = pathTrie.insert(szPath);
+    if(pRoot) {
+        queueDirs.push(std::make_pair(pRoot, 0));
+    }
+    std::string currentDir;
+    while(!queueDirs.empty()) {
+        TrieNode* pDirNode = queueDirs.front().first;
+        size_t ulDepth = queueDirs.front().second;
+        TrieNode::getFullPath(pDirNode, currentDir);
+        queueDirs.pop();
+
+        SYSCALL_COUNT(Open);
+        int iDirFd = open(currentDir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        DIR* dir = iDirFd >= 0 ? fdopendir(iDirFd) : nullptr;
+        if (!dir) {
+            std::cerr << "Failed to open directory: " << currentDir << std::endl;
+            if (iDirFd >= 0) {
+                close(iDirFd);
+            }
+            return false;
+        }
+
+        std::vector<std::string> vNames;
+        std::vector<unsigned char> vTypes;
+        struct dirent* entry;
+        while((entry = readdir(dir)) != nullptr) {
+            if(strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+            vNames.push_back(entry->d_name);
+            vTypes.push_back(entry->d_type);
+        }
+
+        // Resolve DT_UNKNOWN entries with batched statx
+        std::vector<struct statx> vStatx(vNames.size());
+        std::vector<size_t> vUnknown;
+        for (size_t i = 0; i < vNames.size(); ++i) {
+            if (vTypes[i] == DT_UNKNOWN) {
+                vUnknown.push_back(i);
+            }
+        }
+        for (size_t i = 0; i < vUnknown.size(); ) {
+            int iErrno = 0;
+            for (; i < vUnknown.size() && pRing->freeSlots() > 0; ++i) {
+                size_t ulEntry = vUnknown[i];
+                pRing->prepStatx(iDirFd, vNames[ulEntry].c_str(), AT_SYMLINK_NOFOLLOW,
+                                 STATX_TYPE, &vStatx[ulEntry], ulEntry);
+            }
+            bool bSubmitted = pRing->submitAndWait([&](uint64_t ulEntry, int iRes) {
+                if (iRes < 0) {
+                    iErrno = -iRes;
+                } else {
+                    vTypes[ulEntry] = IFTODT(vStatx[ulEntry].stx_mode);
+                }
+            });
+            if (!bSubmitted || iErrno != 0) {
+                errno = iErrno != 0 ? iErrno : errno;
+                std::cerr << "Failed to stat file: " << strerror(errno) << std::endl;
+                closedir(dir);
+                return false;
+            }
+        }
+
+        size_t ulFiles = 0;
+        for (size_t i = 0; i < vNames.size(); ++i) {
+            if (vTypes[i] == DT_DIR) {
+                TrieNode* pNode = pathTrie.insertChild(pDirNode, vNames[i]);
+                if (!pNode) {
+                    closedir(dir);
+                    return false;
+                }
+                queueDirs.push(std::make_pair(pNode, ulDepth + 1));
+            } else {
+                ++ulFiles;
+            }
+        }
+
+        bool bLinkRmdir = pDirNode != pRoot && ulFiles == vNames.size()
+                          && ulFiles + 1 <= pRing->capacity();
+        if (bLinkRmdir && ulFiles + 1 > pRing->freeSlots() && !batch.flush()) {
+            closedir(dir);
+            return false;
+        }
+        for (size_t i = 0; i < vNames.size(); ++i) {
+            if (vTypes[i] != DT_DIR && !batch.add(iDirFd, vNames[i], 0, bLinkRmdir ? IOSQE_IO_LINK : 0)) {
+                closedir(dir);
+                return false;
+            }
+        }
+        if (bLinkRmdir) {
+            // Runs only once every unlink of the chain above succeeded
+            batch.add(AT_FDCWD, currentDir, AT_REMOVEDIR);
+        } else if (pDirNode != pRoot) {
+            if (vLevels.size() <= ulDepth) {
+                vLevels.resize(ulDepth + 1);
+            }
+            vLevels[ulDepth].push_back(pDirNode);
+        }
+        bool bFlushed = batch.flush();
+        closedir(dir);
+        if (!bFlushed) {
+            return false;
+        }
+    }
+
+    // Reversely rmdir the remaining directories, one batch per level
+    for (size_t ulDepth = vLevels.size(); ulDepth-- > 0; ) {
+        std::vector<std::string> vPaths;
+        vPaths.reserve(vLevels[ulDepth].size());
+        for (TrieNode* pNode : vLevels[ulDepth]) {
+            vPaths.push_back(TrieNode::getFullPath(pNode));
+        }
+        for (const std::string& szDirPath : vPaths) {
+            if (!batch.add(AT_FDCWD, szDirPath, AT_REMOVEDIR)) {
+                return false;
+            }
+        }
+        if (!batch.flush()) {
+            return false;
+        }
+    }
+
+    if (!bSaveParentPath) {
+        SYSCALL_COUNT(Rmdir);
+        if (rmdir(szPath.c_str()) != 0) {
+            std::cerr << "Failed to delete directory: " << szPath << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+#endif
+
+namespace {
+// Record layout returned by the getdents64 syscall
+struct LinuxDirent64 {
+    uint64_t d_ino;
+    int64_t d_off;
+    unsigned short d_reclen;
+    unsigned char d_type;
+    char d_name[];
+};
+
+// One level of the RemoveDirStreaming walk. Only the deepest level reads
+// into the shared getdents64 buffer; a level that is descended from keeps a
+// copy of its entries not handled yet, starting with the sub directory being
+// removed below it. A level thus holds what is left of one buffer at most,
+// usually a few entries.
+struct StreamFrame {
+    int iFd;                            // -1 while closed by the fd cap
+    ino_t ulIno;                        // fstat of iFd before the cap closed it,
+    dev_t ulDev;                        // checks the reopen through ".."
+    const char* pData;                  // the shared buffer or vPending
+    size_t ulSize;
+    size_t ulPos;
+    std::vector<char> vPending;
+};
+
+const LinuxDirent64* CurrentDirent(const StreamFrame& frame)
+{
+    return reinterpret_cast<const LinuxDirent64*>(frame.pData + frame.ulPos);
+}
+
+void NextDirent(StreamFrame& frame)
+{
+    frame.ulPos += CurrentDirent(frame)->d_reclen;
+}
+
+// Open the parent of the frame above it again after the fd cap closed it
+bool ReopenParent(StreamFrame& parent, const StreamFrame& child)
+{
+    SYSCALL_COUNT(Openat);
+    parent.iFd = openat(child.iFd, "..", O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (parent.iFd < 0) {
+        std::cerr << "Failed to reopen directory: " << strerror(errno) << std::endl;
+        return false;
+    }
+    struct stat st;
+    SYSCALL_COUNT(Fstat);
+    if (fstat(parent.iFd, &st) != 0 || st.st_ino != parent.ulIno || st.st_dev != parent.ulDev) {
+        // Moved while we were below it, do not delete in a foreign tree
+        std::cerr << "Directory was moved during removal" << std::endl;
+        errno = ESTALE;
+        return false;
+    }
+    // Reading restarts at the beginning, entries already removed are gone
+    // and the ones still buffered come back as ENOENT
+    return true;
+}
+}
+
+static bool RemoveDirStreamingWalk(const std::string& szPath, bool bSaveParentPath, unsigned int nMaxFds,
+                                   const std::function<bool(uint64_t)>* pfnProgress,
+                                   std::vector<StreamFrame>& vFrames)
+{
+    nMaxFds = std::max(nMaxFds, 2u);
+    uint64_t ulRemoved = 0;
+    auto progress = [pfnProgress, &ulRemoved]() {
+        ++ulRemoved;
+        if (pfnProgress && !(*pfnProgress)(ulRemoved)) {
+            errno = ECANCELED;
+            return false;
+        }
+        return true;
+    };
+    std::unique_ptr<char[]> pBuffer(new char[REMOVE_DIR_STREAM_BUFFER]);
+    size_t ulDepth = 0;                 // frames in use
+    size_t ulLowestOpen = 0;            // frames below it have their fd closed
+    auto push = [&vFrames, &ulDepth](int iFd) {
+        if (ulDepth == vFrames.size()) {
+            vFrames.emplace_back();
+        }
+        StreamFrame& frame = vFrames[ulDepth++];
+        frame.iFd = iFd;
+        frame.pData = nullptr;
+        frame.ulSize = 0;
+        frame.ulPos = 0;
+    };
+    // Give up the fd of the shallowest open level. Its identity comes from
+    // the fd itself: d_ino of the entry differs from st_ino on overlayfs.
+    auto closeLowest = [&vFrames, &ulLowestOpen]() {
+        StreamFrame& lowest = vFrames[ulLowestOpen++];
+        struct stat lowestSt;
+        SYSCALL_COUNT(Fstat);
+        if (fstat(lowest.iFd, &lowestSt) != 0) {
+            std::cerr << "Failed to stat directory: " << strerror(errno) << std::endl;
+            return false;
+        }
+        lowest.ulIno = lowestSt.st_ino;
+        lowest.ulDev = lowestSt.st_dev;
+        close(lowest.iFd);
+        lowest.iFd = -1;
+        return true;
+    };
+
+    SYSCALL_COUNT(Open);
+    int iRootFd = open(szPath.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (iRootFd < 0) {
+        std::cerr << "Failed to open directory: " << szPath << std::endl;
+        return false;
+    }
+    struct stat st;
+    push(iRootFd);
+
+    while (ulDepth > 0) {
+        StreamFrame& frame = vFrames[ulDepth - 1];
+        if (frame.ulPos >= frame.ulSize) {
+            SYSCALL_COUNT(Getdents);
+            long lRead = syscall(SYS_getdents64, frame.iFd, pBuffer.get(), REMOVE_DIR_STREAM_BUFFER);
+            if (lRead < 0) {
+                std::cerr << "Failed to read directory: " << strerror(errno) << std::endl;
+                return false;
+            }
+            frame.pData = pBuffer.get();
+            frame.ulSize = lRead;
+            frame.ulPos = 0;
+            if (lRead > 0) {
+                continue;
+            }
+
+            // Empty now, remove it from its parent and resume the parent
+            --ulDepth;
+            if (ulDepth == 0) {
+                close(frame.iFd);
+                frame.iFd = -1;
+                break;
+            }
+            StreamFrame& parent = vFrames[ulDepth - 1];
+            bool bReopened = parent.iFd >= 0 || ReopenParent(parent, frame);
+            close(frame.iFd);
+            frame.iFd = -1;
+            if (!bReopened) {
+                return false;
+            }
+            ulLowestOpen = std::min(ulLowestOpen, ulDepth - 1);
+            const char* szName = CurrentDirent(parent)->d_name;
+            SYSCALL_COUNT(Unlinkat);
+            if (unlinkat(parent.iFd, szName, AT_REMOVEDIR) != 0 && errno != ENOENT) {
+                std::cerr << "Failed to delete directory: " << szName << ", err: " << strerror(errno) << std::endl;
+                return false;
+            }
+            NextDirent(parent);
+            if (!progress()) {
+                return false;
+            }
+            continue;
+        }
+
+        const LinuxDirent64* pDirent = CurrentDirent(frame);
+        const char* szName = pDirent->d_name;
+        if (szName[0] == '.' && (szName[1] == '\0' || (szName[1] == '.' && szName[2] == '\0'))) {
+            NextDirent(frame);
+            continue;
+        }
+
+        unsigned char ucType = pDirent->d_type;
+        if (ucType == DT_UNKNOWN) {
+            // File system does not fill d_type, fall back to fstatat
+            SYSCALL_COUNT(Fstatat);
+            if (fstatat(frame.iFd, szName, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                if (errno == ENOENT) {
+                    NextDirent(frame);
+                    continue;
+                }
+                std::cerr << "Failed to stat file: " << strerror(errno) << std::endl;
+                return false;
+            }
+            ucType = IFTODT(st.st_mode);
+        }
+
+        if (ucType != DT_DIR) {
+            SYSCALL_COUNT(Unlinkat);
+            if (unlinkat(frame.iFd, szName, 0) != 0 && errno != ENOENT) {
+                std::cerr << "Failed to delete file: " << strerror(errno) << std::endl;
+                return false;
+            }
+            NextDirent(frame);
+            if (!progress()) {
+                return false;
+            }
+            continue;
+        }
+
+        // At the cap, give up the fd of the shallowest open level. It is
+        // reopened through ".." once the walk climbs back to it.
+        if (ulDepth - ulLowestOpen >= nMaxFds && !closeLowest()) {
+            return false;
+        }
+        SYSCALL_COUNT(Openat);
+        int iFd = openat(frame.iFd, szName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (iFd < 0 && errno == EMFILE && ulLowestOpen + 1 < ulDepth) {
+            // The process limit is lower than the cap
+            if (!closeLowest()) {
+                return false;
+            }
+            SYSCALL_COUNT(Openat);
+            iFd = openat(frame.iFd, szName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+        if (iFd < 0) {
+            if (errno == ENOENT) {
+                NextDirent(frame);
+                continue;
+            }
+            std::cerr << "Failed to open directory: " << szName << ", err: " << strerror(errno) << std::endl;
+            return false;
+        }
+        // The sub directory takes over the shared buffer
+        if (frame.pData == pBuffer.get()) {
+            frame.vPending.assign(frame.pData + frame.ulPos, frame.pData + frame.ulSize);
+            frame.pData = frame.vPending.data();
+            frame.ulSize = frame.vPending.size();
+            frame.ulPos = 0;
+        }
+        push(iFd);
+    }
+
+    if (!bSaveParentPath) {
+        SYSCALL_COUNT(Rmdir);
+        if (rmdir(szPath.c_str()) != 0) {
+            std::cerr << "Failed to delete directory: " << szPath << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool RemoveDirStreaming(const std::string& szPath, bool bSaveParentPath, unsigned int nMaxFds)
+{
+    return RemoveDirStreaming(szPath, bSaveParentPath, nMaxFds, nullptr);
+}
+
+bool RemoveDirStreaming(const std::string& szPath, bool bSaveParentPath, unsigned int nMaxFds,
+                        const std::function<bool(uint64_t)>& fnProgress)
+{
+    TRACE_FUNCTION();
+    std::vector<StreamFrame> vFrames;
+    bool bRemoved = RemoveDirStreamingWalk(szPath, bSaveParentPath, nMaxFds, fnProgress ? &fnProgress : nullptr,
+                                           vFrames);
+    if (!bRemoved) {
+        // Keep the failure's errno across the cleanup
+        int iErrno = errno;
+        for (const StreamFrame& frame : vFrames) {
+            if (frame.iFd >= 0) {
+                close(frame.iFd);
+            }
+        }
+        errno = iErrno;
+    }
+    SyncDirCache();
+    return bRemoved;
+}
+
+bool RemoveDir(const std::string& szPath, bool bSaveParentPath)
+{
+    return RemoveDir(szPath, bSaveParentPath, RemoveDirMode::FdRelative);
+}
+
+bool RemoveDir(const std::string& szPath, bool bSaveParentPath, RemoveDirMode eMode)
+{
+    TRACE_FUNCTION();
+    bool bRemoved;
+    switch (eMode) {
+    case RemoveDirMode::PathBased:
+        bRemoved = RemoveDirPathBased(szPath, bSaveParentPath);
+        break;
+    case RemoveDirMode::FdRelative:
+        bRemoved = RemoveDirFdRelative(szPath, bSaveParentPath);
+        break;
+    case RemoveDirMode::IoUring:
+#ifdef IO_URING_ENABLE
+        bRemoved = RemoveDirIoUring(szPath, bSaveParentPath);
+#else
+        bRemoved = RemoveDirFdRelative(szPath, bSaveParentPath);
+#endif
+        break;
+    case RemoveDirMode::Streaming:
+        // Syncs DirCache itself
+        return RemoveDirStreaming(szPath, bSaveParentPath, REMOVE_DIR_STREAM_FDS);
+    default:
+        errno = EINVAL;
+        return false;
+    }
+    SyncDirCache();
+    return bRemoved;
+}
+
+namespace {
+// Directory owned by RemoveDirParallel. iPending holds one token for the scan
+// of the directory itself plus one for every child directory not yet removed,
+// whoever drops it to zero removes the directory.
+struct ParallelDirNode {
+    ParallelDirNode(ParallelDirNode* pParent, const char* szName)
+        : pParent(pParent), szName(szName), iPending(1) {}
+
+    ParallelDirNode* pParent;
+    std::string szName;
+    std::atomic<int> iPending;
+};
+
+struct ParallelRemoveContext {
+    WorkStealingPool* pPool;
+    const ParallelDirNode* pRoot;
+    bool bSaveParentPath;
+    std::atomic<bool> bFailed;
+    std::atomic<int> iErrno;
+};
+
+std::string GetParallelDirPath(const ParallelDirNode* pNode)
+{
+    std::vector<const ParallelDirNode*> vChain;
+    size_t ulLength = 0;
+    for (; pNode != nullptr; pNode = pNode->pParent) {
+        vChain.push_back(pNode);
+        ulLength += pNode->szName.size() + 1;
+    }
+
+    std::string szPath;
+    szPath.reserve(ulLength);
+    for (auto it = vChain.rbegin(); it != vChain.rend(); ++it) {
+        if (!szPath.empty()) {
+            szPath += '/';
+        }
+        szPath += (*it)->szName;
+    }
+    return szPath;
+}
+
+void FailParallelRemove(ParallelRemoveContext& ctx, int iErrno)
+{
+    bool bExpected = false;
+    if (ctx.bFailed.compare_exchange_strong(bExpected, true)) {
+        ctx.iErrno = iErrno;
+    }
+}
+
+// Drop one token of pNode, removing and releasing every directory up the
+// chain whose last token is gone.
+void FinishParallelDir(ParallelRemoveContext& ctx, ParallelDirNode* pNode)
+{
+    while (pNode != nullptr && pNode->iPending.fetch_sub(1) == 1) {
+        if (!ctx.bFailed && (pNode != ctx.pRoot || !ctx.bSaveParentPath)) {
+            std::string szDirPath = GetParallelDirPath(pNode);
+            SYSCALL_COUNT(Rmdir);
+            if (rmdir(szDirPath.c_str()) != 0) {
+                FailParallelRemove(ctx, errno);
+                std::cerr << "Failed to delete directory: " << szDirPath << std::endl;
+            }
+        }
+        ParallelDirNode* pParent = pNode->pParent;
+        delete pNode;
+        pNode = pParent;
+    }
+}
+
+void RemoveDirParallelScan(ParallelRemoveContext& ctx, ParallelDirNode* pNode)
+{
+    if (!ctx.bFailed) {
+        std::string currentDir = GetParallelDirPath(pNode);
+        SYSCALL_COUNT(Open);
+        int iDirFd = open(currentDir.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        DIR* dir = iDirFd >= 0 ? fdopendir(iDirFd) : nullptr;
+        if (!dir) {
+            FailParallelRemove(ctx, errno);
+            std::cerr << "Failed to open directory: " << currentDir << std::endl;
+            if (iDirFd >= 0) {
+                close(iDirFd);
+            }
+        }
+
+        struct dirent* entry;
+        while (dir && !ctx.bFailed && (entry = readdir(dir)) != nullptr) {
+            if (strcmp(entry->d_name, ".") == 0 || strcmp(entry->d_name, "..") == 0) {
+                continue;
+            }
+
+            unsigned char ucType = entry->d_type;
+            if (ucType == DT_UNKNOWN) {
+                struct stat st;
+                SYSCALL_COUNT(Fstatat);
+                if (fstatat(iDirFd, entry->d_name, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    FailParallelRemove(ctx, errno);
+                    std::cerr << "Failed to stat file: " << strerror(errno) << std::endl;
+                    break;
+                }
+                ucType = IFTODT(st.st_mode);
+            }
+
+            if (ucType == DT_DIR) {
+                // Hand the sub directory to the pool, it holds a token on us
+                ParallelDirNode* pChild = new ParallelDirNode(pNode, entry->d_name);
+                pNode->iPending.fetch_add(1);
+                ctx.pPool->submit([&ctx, pChild] { RemoveDirParallelScan(ctx, pChild); });
+            } else {
+                SYSCALL_COUNT(Unlinkat);
+                if (unlinkat(iDirFd, entry->d_name, 0) != 0) {
+                    FailParallelRemove(ctx, errno);
+                    std::cerr << "Failed to delete file: " << strerror(errno) << std::endl;
+                    break;
+                }
+            }
+        }
+        if (dir) {
+            closedir(dir);
+        }
+    }
+
+    FinishParallelDir(ctx, pNode);
+}
+}
+
+std::future<bool> RemoveDirAsync(const std::string& szPath, std::function<void(bool, int)> fnDone)
+{
+    TRACE_FUNCTION();
+    // The path is renamed away before remove() returns. Without a trash the
+    // worker removes it with RemoveDirStreaming, which syncs in turn.
+    std::future<bool> future = TrashReclaimer::Instance().remove(szPath, std::move(fnDone));
+    SyncDirCache();
+    return future;
+}
+
+bool RemoveDirParallel(const std::string& szPath, bool bSaveParentPath, unsigned int nThreads)
+{
+    TRACE_FUNCTION();
+    if (szPath.empty()) {
+        errno = EINVAL;
+        std::cerr << __FUNCTION__ << ": Invalid input!" << std::endl;
+        return false;
+    }
+
+    WorkStealingPool pool(nThreads);
+    ParallelRemoveContext ctx;
+    ParallelDirNode* pRoot = new ParallelDirNode(nullptr, szPath.c_str());
+    ctx.pPool = &pool;
+    ctx.pRoot = pRoot;
+    ctx.bSaveParentPath = bSaveParentPath;
+    ctx.bFailed = false;
+    ctx.iErrno = 0;
+
+    pool.submit([&ctx, pRoot] { RemoveDirParallelScan(ctx, pRoot); });
+    pool.wait();
+    SyncDirCache();
+
+    if (ctx.bFailed) {
+        errno = ctx.iErrno;
+        return false;
+    }
+    return true;
+}
+
+namespace {
+// A directory whose subtree is still being scanned. It holds one token for
+// its own listing plus one per sub directory not yet complete.
+struct ScanDirState {
+    ScanDirState(ScanDirState* pParent, TrieNode* pNode, ScanEntry* pEntry)
+        : pParent(pParent), pNode(pNode), pEntry(pEntry), ulSize(pEntry->ulSize),
+          ulBlocks(pEntry->ulBlocks), ulEntries(1), iPending(1) {}
+
+    ScanDirState* pParent;
+    TrieNode* pNode;
+    ScanEntry* pEntry;
+    std::atomic<uint64_t> ulSize;
+    std::atomic<uint64_t> ulBlocks;
+    std::atomic<uint64_t> ulEntries;
+    std::atomic<int> iPending;
+};
+
+struct ScanDirContext {
+    WorkStealingPool* pPool;
+    ScanDirResult* pResult;
+    const ScanDirOptions* pOptions;
+    dev_t rootDev;
+    std::mutex mutex;           // guards pResult->vEntryBlocks and iErrno
+    std::mutex linkMutex;
+    std::set<std::pair<dev_t, ino_t>> setLinks;     // hard linked inodes seen so far
+};
+
+void FailScanDir(ScanDirContext& ctx, int iErrno, const char* szWhat, const TrieNode* pNode)
+{
+    std::cerr << "ScanDir: Failed to " << szWhat << " '" << TrieNode::getFullPath(pNode)
+              << "', err: " << strerror(iErrno) << std::endl;
+    std::lock_guard<std::mutex> lock(ctx.mutex);
+    if (ctx.pResult->iErrno == 0) {
+        ctx.pResult->iErrno = iErrno;
+    }
+}
+
+// Drop one token of pState. The last one publishes the subtree totals and
+// passes them on to the parent, which may complete in turn.
+void FinishScanDir(ScanDirState* pState)
+{
+    while (pState && pState->iPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        ScanEntry* pEntry = pState->pEntry;
+        pEntry->ulTotalSize = pState->ulSize.load(std::memory_order_relaxed);
+        pEntry->ulTotalBlocks = pState->ulBlocks.load(std::memory_order_relaxed);
+        pEntry->ulTotalEntries = pState->ulEntries.load(std::memory_order_relaxed);
+
+        ScanDirState* pParent = pState->pParent;
+        if (pParent) {
+            pParent->ulSize.fetch_add(pEntry->ulTotalSize, std::memory_order_relaxed);
+            pParent->ulBlocks.fetch_add(pEntry->ulTotalBlocks, std::memory_order_relaxed);
+            pParent->ulEntries.fetch_add(pEntry->ulTotalEntries, std::memory_order_relaxed);
+        }
+        delete pState;
+        pState = pParent;
+    }
+}
+
+void FillScanEntry(ScanEntry& entry, const struct stat& st)
+{
+    entry.ulInode = st.st_ino;
+    entry.ulSize = st.st_size;
+    entry.ulBlocks = st.st_blocks;
+    entry.mtime = st.st_mtim;
+    entry.ucType = IFTODT(st.st_mode);
+    entry.ulTotalSize = entry.ulSize;
+    entry.ulTotalBlocks = entry.ulBlocks;
+    entry.ulTotalEntries = 1;
+}
+
+// List one directory, stat its entries and queue its sub directories. pDir
+// is the already open directory.
+void ScanDirList(ScanDirContext& ctx, ScanDirState* pState, std::shared_ptr<SharedDirFd> pDir)
+{
+    thread_local std::vector<char> vBuffer;
+    thread_local std::vector<ScanEntry> vEntries;
+    thread_local std::vector<TrieNode*> vNodes;
+    thread_local std::vector<char> vDescend;
+    if (vBuffer.size() < ctx.pOptions->ulBufferSize) {
+        vBuffer.resize(std::max<size_t>(ctx.pOptions->ulBufferSize, 4096));
+    }
+    vEntries.clear();
+    vNodes.clear();
+    vDescend.clear();
+
+    PathTrie& trie = ctx.pResult->trie;
+    uint64_t ulSize = 0;
+    uint64_t ulBlocks = 0;
+    while (true) {
+        SYSCALL_COUNT(Getdents);
+        long lRead = syscall(SYS_getdents64, pDir->iFd, vBuffer.data(), vBuffer.size());
+        if (lRead <= 0) {
+            if (lRead < 0) {
+                FailScanDir(ctx, errno, "read directory", pState->pNode);
+            }
+            break;
+        }
+
+        for (long lPos = 0; lPos < lRead; ) {
+            const LinuxDirent64* pDirent = reinterpret_cast<const LinuxDirent64*>(vBuffer.data() + lPos);
+            lPos += pDirent->d_reclen;
+            const char* szName = pDirent->d_name;
+            if (szName[0] == '.' && (szName[1] == '\0' || (szName[1] == '.' && szName[2] == '\0'))) {
+                continue;
+            }
+
+            ScanEntry entry{};
+            struct stat st;
+            st.st_dev = ctx.rootDev;
+            entry.ulInode = pDirent->d_ino;
+            entry.ucType = pDirent->d_type;
+            entry.ulTotalEntries = 1;
+            if (ctx.pOptions->bStat || entry.ucType == DT_UNKNOWN) {
+                SYSCALL_COUNT(Fstatat);
+                if (fstatat(pDir->iFd, szName, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    // Vanished between getdents64 and fstatat, or unreadable
+                    if (errno != ENOENT) {
+                        FailScanDir(ctx, errno, "stat entry of", pState->pNode);
+                    }
+                    continue;
+                }
+                FillScanEntry(entry, st);
+                if (ctx.pOptions->bCountLinksOnce && !S_ISDIR(st.st_mode) && st.st_nlink > 1) {
+                    std::lock_guard<std::mutex> lock(ctx.linkMutex);
+                    if (!ctx.setLinks.emplace(st.st_dev, st.st_ino).second) {
+                        entry.ulTotalSize = 0;
+                        entry.ulTotalBlocks = 0;
+                    }
+                }
+            }
+
+            // A mount point is recorded but not descended into with bOneFileSystem
+            bool bDescend = entry.ucType == DT_DIR &&
+                            !(ctx.pOptions->bOneFileSystem && st.st_dev != ctx.rootDev);
+            vNodes.push_back(trie.insertChild(pState->pNode, szName));
+            vEntries.push_back(entry);
+            vDescend.push_back(bDescend);
+            if (!bDescend) {
+                ulSize += entry.ulTotalSize;
+                ulBlocks += entry.ulTotalBlocks;
+            }
+        }
+    }
+
+    // One block per directory, the nodes point into it
+    ScanEntry* pBlock = nullptr;
+    if (!vEntries.empty()) {
+        std::unique_ptr<ScanEntry[]> pEntries(new ScanEntry[vEntries.size()]);
+        std::copy(vEntries.begin(), vEntries.end(), pEntries.get());
+        pBlock = pEntries.get();
+        std::lock_guard<std::mutex> lock(ctx.mutex);
+        ctx.pResult->vEntryBlocks.push_back(std::move(pEntries));
+    }
+
+    uint64_t ulFiles = 0;
+    for (size_t i = 0; i < vNodes.size(); ++i) {
+        vNodes[i]->setData(&pBlock[i]);
+        if (!vDescend[i]) {
+            ++ulFiles;
+            continue;
+        }
+
+        // The sub directory holds a token on us until its subtree is done
+        ScanDirState* pChild = new ScanDirState(pState, vNodes[i], &pBlock[i]);
+        pState->iPending.fetch_add(1, std::memory_order_relaxed);
+        ctx.pPool->submit([&ctx, pChild, pDir] {
+            SYSCALL_COUNT(Openat);
+            int iFd = openat(pDir->iFd, pChild->pNode->getNodeValue().c_str(),
+                             O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            if (iFd < 0) {
+                FailScanDir(ctx, errno, "open directory", pChild->pNode);
+                FinishScanDir(pChild);
+                return;
+            }
+            ScanDirList(ctx, pChild, std::make_shared<SharedDirFd>(iFd));
+        });
+    }
+
+    pState->ulSize.fetch_add(ulSize, std::memory_order_relaxed);
+    pState->ulBlocks.fetch_add(ulBlocks, std::memory_order_relaxed);
+    pState->ulEntries.fetch_add(ulFiles, std::memory_order_relaxed);
+    FinishScanDir(pState);
+}
+}
+
+std::unique_ptr<ScanDirResult> ScanDir(const std::string& szPath, const ScanDirOptions& options)
+{
+    TRACE_FUNCTION();
+    if (szPath.empty()) {
+        errno = EINVAL;
+        std::cerr << __FUNCTION__ << ": Invalid input!" << std::endl;
+        return nullptr;
+    }
+
+    SYSCALL_COUNT(Open);
+    int iRootFd = open(szPath.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (iRootFd < 0 || fstat(iRootFd, &st) != 0) {
+        int iErrno = errno;
+        std::cerr << __FUNCTION__ << ": Failed to open '" << szPath
+                  << "', err: " << strerror(iErrno) << std::endl;
+        if (iRootFd >= 0) {
+            close(iRootFd);
+        }
+        errno = iErrno;
+        return nullptr;
+    }
+    SYSCALL_COUNT(Fstat);
+
+    char szCwd[PATH_MAX];
+    std::unique_ptr<ScanDirResult> pResult(new ScanDirResult());
+    pResult->pRoot = pResult->trie.insert(
+        NormalizeCreatePath(szPath, getcwd(szCwd, sizeof(szCwd)) ? szCwd : "/"));
+    std::unique_ptr<ScanEntry[]> pRootEntry(new ScanEntry[1]);
+    FillScanEntry(pRootEntry[0], st);
+    pResult->pRoot->setData(pRootEntry.get());
+
+    WorkStealingPool pool(options.nThreads);
+    ScanDirContext ctx;
+    ctx.pPool = &pool;
+    ctx.pResult = pResult.get();
+    ctx.pOptions = &options;
+    ctx.rootDev = st.st_dev;
+
+    ScanDirState* pState = new ScanDirState(nullptr, pResult->pRoot, pRootEntry.get());
+    pResult->vEntryBlocks.push_back(std::move(pRootEntry));
+    auto pRootDir = std::make_shared<SharedDirFd>(iRootFd);
+    pool.submit([&ctx, pState, pRootDir] { ScanDirList(ctx, pState, pRootDir); });
+    pool.wait();
+
+    if (pResult->iErrno != 0) {
+        errno = pResult->iErrno;
+    }
+    return pResult;
+}
+
+namespace {
+// Directory being copied. It holds one token for its own listing plus one
+// per sub directory and file batch not yet done. The last one sets the mode
+// and times of the copy, which creating its entries would have changed.
+// Tokens of work that writes into the copy (the listing, file batches, sub
+// directories not yet created) are counted in iOpen as well. Once they are
+// all gone the fd of the copy is closed, so only directories still being
+// filled hold one, not every unfinished ancestor.
+struct CopyDirState {
+    CopyDirState(CopyDirState* pParent, TrieNode* pNode, std::shared_ptr<SharedDirFd> pDst)
+        : pParent(pParent), pNode(pNode), pDst(std::move(pDst)), bFixMode(false), bNeedFd(false),
+          iOpen(1), iPending(1) {}
+
+    CopyDirState* pParent;
+    TrieNode* pNode;                    // source directory, for error messages
+    std::shared_ptr<SharedDirFd> pDst;  // reset once iOpen drops to 0
+    mode_t mode;                        // final mode of the copy
+    bool bFixMode;                      // mkdirat could not create it with that mode
+    bool bNeedFd;                       // it or an ancestor is fixed up when done, so
+                                        // it is reopened through ".." of a child
+    dev_t dev;                          // the copy, set with bNeedFd
+    ino_t ino;
+    struct timespec times[2];
+    std::atomic<int> iOpen;
+    std::atomic<int> iPending;
+};
+
+struct CopyDirContext {
+    WorkStealingPool* pPool;
+    const CopyDirOptions* pOptions;
+    PathTrie trie;
+    mode_t umask;
+    dev_t dstDev;                       // the copy itself, never copied into itself
+    ino_t dstIno;
+    std::atomic<bool> bNoClone;         // FICLONE is not supported, skip it
+    std::atomic<bool> bNoCopyRange;     // copy_file_range is not supported, use sendfile
+    std::atomic<uint64_t> ulDirs, ulFiles, ulSymlinks, ulSpecial, ulBytes;
+    std::atomic<uint64_t> ulCloned, ulCopyRange, ulSendfile;
+    std::atomic<int> iErrno;
+
+    CopyDirContext()
+        : trie(PathTrieMode::Concurrent), bNoClone(false), bNoCopyRange(false), ulDirs(0), ulFiles(0),
+          ulSymlinks(0), ulSpecial(0), ulBytes(0), ulCloned(0), ulCopyRange(0), ulSendfile(0), iErrno(0) {}
+};
+
+void FailCopyDir(CopyDirContext& ctx, int iErrno, const char* szWhat, const TrieNode* pNode, const char* szName)
+{
+    std::cerr << "CopyDir: Failed to " << szWhat << " '" << TrieNode::getFullPath(pNode) << "/" << szName
+              << "', err: " << strerror(iErrno) << std::endl;
+    int iExpected = 0;
+    ctx.iErrno.compare_exchange_strong(iExpected, iErrno);
+}
+
+// The umask of the process, from the Umask: line of /proc/self/status
+// (Linux 4.7 and later). Setting and restoring it instead would briefly
+// clear it for every other thread, so that is only the fallback.
+mode_t GetUmask()
+{
+    char szStatus[4096];
+    ssize_t iLen = -1;
+    int iFd = open("/proc/self/status", O_RDONLY | O_CLOEXEC);
+    if (iFd >= 0) {
+        iLen = read(iFd, szStatus, sizeof(szStatus) - 1);
+        close(iFd);
+    }
+    if (iLen > 0) {
+        szStatus[iLen] = '\0';
+        const char* pLine = strstr(szStatus, "\nUmask:");
+        if (pLine) {
+            return static_cast<mode_t>(strtoul(pLine + sizeof("\nUmask:") - 1, nullptr, 8)) & 0777;
+        }
+    }
+    mode_t mask = umask(0);
+    umask(mask);
+    return mask;
+}
+
+// Mode of a copy, like cp: the umask applies unless bPreserveMode
+mode_t GetCopyMode(const CopyDirContext& ctx, mode_t srcMode)
+{
+    return ctx.pOptions->bPreserveMode ? (srcMode & 07777) : (srcMode & 0777 & ~ctx.umask);
+}
+
+// Drop a token of pState. The state that drops its last token is done: its
+// mode and times are set and its parent loses a token in turn. iDirFd is the
+// copy of pState if the caller holds it open, -1 otherwise. Going up, every
+// copy is reached through ".." of the one below, its own fd is closed by
+// then; a failed reopen is reported once and skips the ancestors' fix ups.
+void FinishCopyDir(CopyDirContext& ctx, CopyDirState* pState, int iDirFd = -1)
+{
+    int iOwnedFd = -1;                  // reopened through "..", closed on the way up
+    while (pState && pState->iPending.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (iDirFd >= 0 && pState->bFixMode && fchmod(iDirFd, pState->mode) != 0) {
+            FailCopyDir(ctx, errno, "set mode of copy of", pState->pNode, ".");
+        }
+        if (iDirFd >= 0 && ctx.pOptions->bPreserveTimes && futimens(iDirFd, pState->times) != 0) {
+            FailCopyDir(ctx, errno, "set times of copy of", pState->pNode, ".");
+        }
+
+        // The parent is renamed away if ".." is no longer the directory created
+        CopyDirState* pParent = pState->pParent;
+        int iParentFd = -1;
+        if (pParent && pParent->bNeedFd && iDirFd >= 0) {
+            SYSCALL_COUNT(Openat);
+            iParentFd = openat(iDirFd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            struct stat st;
+            SYSCALL_COUNT(Fstat);
+            if (iParentFd >= 0 && (fstat(iParentFd, &st) != 0 || st.st_dev != pParent->dev ||
+                                   st.st_ino != pParent->ino)) {
+                close(iParentFd);
+                iParentFd = -1;
+                errno = ESTALE;
+            }
+            if (iParentFd < 0) {
+                FailCopyDir(ctx, errno, "reopen copy of", pParent->pNode, ".");
+            }
+        }
+        if (iOwnedFd >= 0) {
+            close(iOwnedFd);
+        }
+        iOwnedFd = iParentFd;
+        iDirFd = iParentFd;
+        delete pState;
+        pState = pParent;
+    }
+    if (iOwnedFd >= 0) {
+        close(iOwnedFd);
+    }
+}
+
+// Drop a token that also held the fd of the copy of pState open
+void ReleaseCopyDir(CopyDirContext& ctx, CopyDirState* pState)
+{
+    std::shared_ptr<SharedDirFd> pDst;
+    if (pState->iOpen.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        pDst = std::move(pState->pDst);
+    }
+    FinishCopyDir(ctx, pState, pDst ? pDst->iFd : -1);
+}
+
+// Move the data of iSrcFd to iDstFd inside the kernel, returns 0 or errno
+int CopyFileData(CopyDirContext& ctx, int iSrcFd, int iDstFd)
+{
+    if (ctx.pOptions->bReflink && !ctx.bNoClone.load(std::memory_order_relaxed)) {
+        SYSCALL_COUNT(Clone);
+        if (ioctl(iDstFd, FICLONE, iSrcFd) == 0) {
+            ctx.ulCloned.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        // EINVAL depends on the file, e.g. an unaligned size, the rest on the file system
+        if (errno == EOPNOTSUPP || errno == ENOTTY || errno == ENOSYS || errno == EXDEV) {
+            ctx.bNoClone = true;
+        } else if (errno != EINVAL) {
+            return errno;
+        }
+    }
+
+    if (!ctx.bNoCopyRange.load(std::memory_order_relaxed)) {
+        bool bCopied = false;
+        while (true) {
+            SYSCALL_COUNT(CopyFileRange);
+            ssize_t lCopied = copy_file_range(iSrcFd, nullptr, iDstFd, nullptr, 1ul << 30, 0);
+            if (lCopied > 0) {
+                bCopied = true;
+                continue;
+            }
+            if (lCopied == 0) {
+                ctx.ulCopyRange.fetch_add(1, std::memory_order_relaxed);
+                return 0;
+            }
+            if (errno == EINTR) {
+                continue;
+            }
+            if (bCopied || (errno != ENOSYS && errno != EXDEV && errno != EINVAL && errno != EOPNOTSUPP)) {
+                return errno;
+            }
+            ctx.bNoCopyRange = true;
+            break;
+        }
+    }
+
+    while (true) {
+        SYSCALL_COUNT(Sendfile);
+        ssize_t lSent = sendfile(iDstFd, iSrcFd, nullptr, 1ul << 30);
+        if (lSent == 0) {
+            ctx.ulSendfile.fetch_add(1, std::memory_order_relaxed);
+            return 0;
+        }
+        if (lSent < 0 && errno != EINTR) {
+            return errno;
+        }
+    }
+}
+
+void CopyDirFile(CopyDirContext& ctx, const CopyDirState* pState, int iSrcDirFd, const char* szName)
+{
+    SYSCALL_COUNT(Openat);
+    int iSrcFd = openat(iSrcDirFd, szName, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (iSrcFd < 0 || fstat(iSrcFd, &st) != 0) {
+        FailCopyDir(ctx, errno, "open", pState->pNode, szName);
+        if (iSrcFd >= 0) {
+            close(iSrcFd);
+        }
+        return;
+    }
+    SYSCALL_COUNT(Fstat);
+
+    mode_t mode = GetCopyMode(ctx, st.st_mode);
+    SYSCALL_COUNT(Openat);
+    int iDstFd = openat(pState->pDst->iFd, szName, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, mode);
+    if (iDstFd < 0) {
+        FailCopyDir(ctx, errno, "create copy of", pState->pNode, szName);
+        close(iSrcFd);
+        return;
+    }
+
+    int iErrno = CopyFileData(ctx, iSrcFd, iDstFd);
+    if (iErrno != 0) {
+        FailCopyDir(ctx, iErrno, "copy", pState->pNode, szName);
+    } else {
+        ctx.ulFiles.fetch_add(1, std::memory_order_relaxed);
+        ctx.ulBytes.fetch_add(st.st_size, std::memory_order_relaxed);
+    }
+    if ((mode & ctx.umask) != 0 && fchmod(iDstFd, mode) != 0) {
+        FailCopyDir(ctx, errno, "set mode of copy of", pState->pNode, szName);
+    }
+    if (ctx.pOptions->bPreserveTimes) {
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+        if (futimens(iDstFd, times) != 0) {
+            FailCopyDir(ctx, errno, "set times of copy of", pState->pNode, szName);
+        }
+    }
+    close(iDstFd);
+    close(iSrcFd);
+}
+
+// Symbolic links, fifos, sockets and device nodes
+void CopyDirOther(CopyDirContext& ctx, const CopyDirState* pState, int iSrcDirFd, const char* szName,
+                  unsigned char ucType)
+{
+    struct stat st;
+    bool bStat = ucType != DT_LNK || ctx.pOptions->bPreserveTimes;
+    if (bStat) {
+        SYSCALL_COUNT(Fstatat);
+        if (fstatat(iSrcDirFd, szName, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+            FailCopyDir(ctx, errno, "stat", pState->pNode, szName);
+            return;
+        }
+    }
+
+    if (ucType == DT_LNK) {
+        char szTarget[PATH_MAX];
+        SYSCALL_COUNT(Readlink);
+        ssize_t lLength = readlinkat(iSrcDirFd, szName, szTarget, sizeof(szTarget));
+        if (lLength < 0 || lLength == static_cast<ssize_t>(sizeof(szTarget))) {
+            FailCopyDir(ctx, lLength < 0 ? errno : ENAMETOOLONG, "read link", pState->pNode, szName);
+            return;
+        }
+        szTarget[lLength] = '\0';
+        SYSCALL_COUNT(Symlink);
+        if (symlinkat(szTarget, pState->pDst->iFd, szName) != 0) {
+            FailCopyDir(ctx, errno, "create copy of", pState->pNode, szName);
+            return;
+        }
+        ctx.ulSymlinks.fetch_add(1, std::memory_order_relaxed);
+    } else {
+        if (mknodat(pState->pDst->iFd, szName, (st.st_mode & S_IFMT) | GetCopyMode(ctx, st.st_mode),
+                    st.st_rdev) != 0) {
+            FailCopyDir(ctx, errno, "create copy of", pState->pNode, szName);
+            return;
+        }
+        ctx.ulSpecial.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    if (ctx.pOptions->bPreserveTimes) {
+        struct timespec times[2] = { st.st_atim, st.st_mtim };
+        if (utimensat(pState->pDst->iFd, szName, times, AT_SYMLINK_NOFOLLOW) != 0) {
+            FailCopyDir(ctx, errno, "set times of copy of", pState->pNode, szName);
+        }
+    }
+}
+
+void CopyDirList(CopyDirContext& ctx, CopyDirState* pState, std::shared_ptr<SharedDirFd> pSrc);
+
+// Hand a batch of files of pState to the pool, it holds a token on pState
+void SubmitCopyBatch(CopyDirContext& ctx, CopyDirState* pState, const std::shared_ptr<SharedDirFd>& pSrc,
+                     std::vector<std::string>& vBatch)
+{
+    pState->iOpen.fetch_add(1, std::memory_order_relaxed);
+    pState->iPending.fetch_add(1, std::memory_order_relaxed);
+    ctx.pPool->submit([&ctx, pState, pSrc, vNames = std::move(vBatch)] {
+        for (const std::string& szName : vNames) {
+            CopyDirFile(ctx, pState, pSrc->iFd, szName.c_str());
+        }
+        ReleaseCopyDir(ctx, pState);
+    });
+    vBatch.clear();
+}
+
+// Open the source sub directory szName of pParent, create its copy and list
+// it. The caller took two tokens on pParent: one for creating the copy, which
+// needs the fd of pParent's copy, and one for the subtree.
+void CopyDirChild(CopyDirContext& ctx, CopyDirState* pParent, const std::shared_ptr<SharedDirFd>& pParentSrc,
+                  TrieNode* pNode)
+{
+    const char* szName = pNode->getNodeValue().c_str();
+    SYSCALL_COUNT(Openat);
+    int iSrcFd = openat(pParentSrc->iFd, szName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    struct stat st;
+    if (iSrcFd < 0 || fstat(iSrcFd, &st) != 0) {
+        FailCopyDir(ctx, errno, "open directory", pParent->pNode, szName);
+        if (iSrcFd >= 0) {
+            close(iSrcFd);
+        }
+        FinishCopyDir(ctx, pParent);
+        ReleaseCopyDir(ctx, pParent);
+        return;
+    }
+    SYSCALL_COUNT(Fstat);
+    auto pSrc = std::make_shared<SharedDirFd>(iSrcFd);
+    if (st.st_dev == ctx.dstDev && st.st_ino == ctx.dstIno) {
+        FailCopyDir(ctx, EINVAL, "copy a directory into itself,", pParent->pNode, szName);
+        FinishCopyDir(ctx, pParent);
+        ReleaseCopyDir(ctx, pParent);
+        return;
+    }
+
+    // The owner needs write access until every entry is in place
+    mode_t mode = GetCopyMode(ctx, st.st_mode);
+    SYSCALL_COUNT(Mkdirat);
+    int iDstFd = -1;
+    if (mkdirat(pParent->pDst->iFd, szName, mode | S_IRWXU) == 0) {
+        SYSCALL_COUNT(Openat);
+        iDstFd = openat(pParent->pDst->iFd, szName, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (iDstFd < 0) {
+        FailCopyDir(ctx, errno, "create copy of", pParent->pNode, szName);
+        FinishCopyDir(ctx, pParent);
+        ReleaseCopyDir(ctx, pParent);
+        return;
+    }
+    ctx.ulDirs.fetch_add(1, std::memory_order_relaxed);
+
+    CopyDirState* pState = new CopyDirState(pParent, pNode, std::make_shared<SharedDirFd>(iDstFd));
+    pState->mode = mode;
+    pState->bFixMode = ((mode | S_IRWXU) & ~ctx.umask) != mode;
+    pState->times[0] = st.st_atim;
+    pState->times[1] = st.st_mtim;
+    pState->bNeedFd = pState->bFixMode || ctx.pOptions->bPreserveTimes || pParent->bNeedFd;
+    struct stat dstSt;
+    if (pState->bNeedFd) {
+        SYSCALL_COUNT(Fstat);
+        if (fstat(iDstFd, &dstSt) != 0) {
+            FailCopyDir(ctx, errno, "stat copy of", pParent->pNode, szName);
+            dstSt.st_dev = 0;
+            dstSt.st_ino = 0;
+        }
+        pState->dev = dstSt.st_dev;
+        pState->ino = dstSt.st_ino;
+    }
+    ReleaseCopyDir(ctx, pParent);
+    CopyDirList(ctx, pState, pSrc);
+}
+
+// List one source directory. Sub directories become tasks, files are copied
+// in batches, full batches by other tasks.
+void CopyDirList(CopyDirContext& ctx, CopyDirState* pState, std::shared_ptr<SharedDirFd> pSrc)
+{
+    thread_local std::vector<char> vBuffer(64 * 1024);
+    std::vector<std::string> vBatch;
+    const size_t ulBatchFiles = std::max(1u, ctx.pOptions->nBatchFiles);
+
+    while (true) {
+        SYSCALL_COUNT(Getdents);
+        long lRead = syscall(SYS_getdents64, pSrc->iFd, vBuffer.data(), vBuffer.size());
+        if (lRead <= 0) {
+            if (lRead < 0) {
+                FailCopyDir(ctx, errno, "read directory", pState->pNode, ".");
+            }
+            break;
+        }
+
+        for (long lPos = 0; lPos < lRead; ) {
+            const LinuxDirent64* pDirent = reinterpret_cast<const LinuxDirent64*>(vBuffer.data() + lPos);
+            lPos += pDirent->d_reclen;
+            const char* szName = pDirent->d_name;
+            if (szName[0] == '.' && (szName[1] == '\0' || (szName[1] == '.' && szName[2] == '\0'))) {
+                continue;
+            }
+
+            unsigned char ucType = pDirent->d_type;
+            if (ucType == DT_UNKNOWN) {
+                struct stat st;
+                SYSCALL_COUNT(Fstatat);
+                if (fstatat(pSrc->iFd, szName, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    FailCopyDir(ctx, errno, "stat", pState->pNode, szName);
+                    continue;
+                }
+                ucType = IFTODT(st.st_mode);
+            }
+
+            if (ucType == DT_DIR) {
+                // The sub directory holds a token on us until its subtree is done
+                TrieNode* pChild = ctx.trie.insertChild(pState->pNode, szName);
+                pState->iOpen.fetch_add(1, std::memory_order_relaxed);
+                pState->iPending.fetch_add(2, std::memory_order_relaxed);
+                ctx.pPool->submit([&ctx, pState, pSrc, pChild] { CopyDirChild(ctx, pState, pSrc, pChild); });
+            } else if (ucType == DT_REG) {
+                vBatch.emplace_back(szName);
+                if (vBatch.size() >= ulBatchFiles) {
+                    SubmitCopyBatch(ctx, pState, pSrc, vBatch);
+                }
+            } else {
+                CopyDirOther(ctx, pState, pSrc->iFd, szName, ucType);
+            }
+        }
+    }
+
+    // The last, partial batch is copied right here
+    for (const std::string& szName : vBatch) {
+        CopyDirFile(ctx, pState, pSrc->iFd, szName.c_str());
+    }
+    ReleaseCopyDir(ctx, pState);
+}
+}
+
+bool CopyDir(const std::string& szSrc, const std::string& szDst, const CopyDirOptions& options,
+             CopyDirStats* pStats)
+{
+    TRACE_FUNCTION();
+    if (szSrc.empty() || szDst.empty()) {
+        errno = EINVAL;
+        std::cerr << __FUNCTION__ << ": Invalid input!" << std::endl;
+        return false;
+    }
+
+    CopyDirContext ctx;
+    ctx.pOptions = &options;
+    ctx.umask = GetUmask();
+
+    SYSCALL_COUNT(Open);
+    int iSrcFd = open(szSrc.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    struct stat st;
+    if (iSrcFd < 0 || fstat(iSrcFd, &st) != 0) {
+        int iErrno = errno;
+        std::cerr << __FUNCTION__ << ": Failed to open '" << szSrc << "', err: " << strerror(iErrno) << std::endl;
+        if (iSrcFd >= 0) {
+            close(iSrcFd);
+        }
+        errno = iErrno;
+        return false;
+    }
+    SYSCALL_COUNT(Fstat);
+    auto pSrc = std::make_shared<SharedDirFd>(iSrcFd);
+
+    mode_t mode = GetCopyMode(ctx, st.st_mode);
+    SYSCALL_COUNT(Mkdir);
+    int iDstFd = -1;
+    struct stat dstSt;
+    if (mkdir(szDst.c_str(), mode | S_IRWXU) == 0) {
+        SYSCALL_COUNT(Open);
+        iDstFd = open(szDst.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    }
+    if (iDstFd < 0 || fstat(iDstFd, &dstSt) != 0) {
+        int iErrno = errno;
+        std::cerr << __FUNCTION__ << ": Failed to create '" << szDst << "', err: " << strerror(iErrno) << std::endl;
+        if (iDstFd >= 0) {
+            close(iDstFd);
+        }
+        errno = iErrno;
+        return false;
+    }
+    SYSCALL_COUNT(Fstat);
+    ctx.dstDev = dstSt.st_dev;
+    ctx.dstIno = dstSt.st_ino;
+
+    char szCwd[PATH_MAX];
+    TrieNode* pRoot = ctx.trie.insert(NormalizeCreatePath(szSrc, getcwd(szCwd, sizeof(szCwd)) ? szCwd : "/"));
+    CopyDirState* pState = new CopyDirState(nullptr, pRoot, std::make_shared<SharedDirFd>(iDstFd));
+    pState->mode = mode;
+    pState->bFixMode = ((mode | S_IRWXU) & ~ctx.umask) != mode;
+    pState->times[0] = st.st_atim;
+    pState->times[1] = st.st_mtim;
+    pState->bNeedFd = pState->bFixMode || options.bPreserveTimes;
+    pState->dev = dstSt.st_dev;
+    pState->ino = dstSt.st_ino;
+
+    {
+        WorkStealingPool pool(options.nThreads);
+        ctx.pPool = &pool;
+        pool.submit([&ctx, pState, pSrc] { CopyDirList(ctx, pState, pSrc); });
+        pool.wait();
+    }
+
+    if (pStats) {
+        pStats->ulDirs = ctx.ulDirs;
+        pStats->ulFiles = ctx.ulFiles;
+        pStats->ulSymlinks = ctx.ulSymlinks;
+        pStats->ulSpecial = ctx.ulSpecial;
+        pStats->ulBytes = ctx.ulBytes;
+        pStats->ulCloned = ctx.ulCloned;
+        pStats->ulCopyRange = ctx.ulCopyRange;
+        pStats->ulSendfile = ctx.ulSendfile;
+    }
+    if (ctx.iErrno != 0) {
+        errno = ctx.iErrno;
+        return false;
+    }
+    return true;
+}
+
+namespace {
+// Attached to every directory node of a PruneDir traversal
+struct PruneDirInfo {
+    uint64_t ulEntries;                 // entries not removed yet
+    uint64_t ulBytes;                   // usage of the directory itself
+};
+
+struct PruneCandidate {
+    TrieNode* pParent;
+    std::string szName;
+    uint64_t ulBytes;
+    uint64_t ulKey;                     // larger keys are evicted first
+};
+
+// Min-heap on the key, the top is the candidate to drop first
+bool PruneKeyGreater(const PruneCandidate& a, const PruneCandidate& b)
+{
+    return a.ulKey > b.ulKey;
+}
+
+struct PrunePass {
+    PrunePass() : trie(PathTrieMode::Arena), ulBytes(0), bTruncated(false), iErrno(0) {}
+
+    PathTrie trie;
+    TrieNode* pRoot;
+    std::deque<PruneDirInfo> dirInfos;
+    std::vector<PruneCandidate> vHeap;
+    uint64_t ulBytes;                   // usage of the whole tree
+    bool bTruncated;                    // the heap bound dropped candidates
+    int iErrno;
+};
+
+PruneDirInfo& GetPruneInfo(const TrieNode* pNode)
+{
+    return *static_cast<PruneDirInfo*>(pNode->getData());
+}
+
+void FailPruneDir(PrunePass& pass, int iErrno, const char* szWhat, const TrieNode* pNode, const char* szName)
+{
+    std::cerr << "PruneDir: Failed to " << szWhat << " '" << TrieNode::getFullPath(pNode) << "/" << szName
+              << "', err: " << strerror(iErrno) << std::endl;
+    if (pass.iErrno == 0) {
+        pass.iErrno = iErrno;
+    }
+}
+
+uint64_t PruneKey(PrunePolicy ePolicy, const struct stat& st, uint64_t ulBytes)
+{
+    switch (ePolicy) {
+    case PrunePolicy::LeastRecentlyUsed:
+        return ~(static_cast<uint64_t>(st.st_atim.tv_sec) * 1000000000ull + st.st_atim.tv_nsec);
+    case PrunePolicy::OldestModified:
+        return ~(static_cast<uint64_t>(st.st_mtim.tv_sec) * 1000000000ull + st.st_mtim.tv_nsec);
+    case PrunePolicy::LargestFirst:
+        break;
+    }
+    return ulBytes;
+}
+
+uint64_t PruneElapsedNs(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+}
+
+// Sum the usage of the tree and keep the ulMaxCandidates best victims.
+// Directories go on an explicit stack and are opened by path, so only one
+// fd is open at a time.
+void PruneDirScan(PrunePass& pass, PrunePolicy ePolicy, size_t ulMaxCandidates)
+{
+    std::vector<char> vBuffer(64 * 1024);
+    std::vector<TrieNode*> vStack(1, pass.pRoot);
+    std::string szDirPath;
+    while (!vStack.empty()) {
+        TrieNode* pNode = vStack.back();
+        vStack.pop_back();
+        TrieNode::getFullPath(pNode, szDirPath);
+        SYSCALL_COUNT(Open);
+        int iFd = open(szDirPath.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (iFd < 0) {
+            if (errno != ENOENT) {
+                FailPruneDir(pass, errno, "open directory", pNode, ".");
+            }
+            continue;
+        }
+
+        PruneDirInfo& info = GetPruneInfo(pNode);
+        while (true) {
+            SYSCALL_COUNT(Getdents);
+            long lRead = syscall(SYS_getdents64, iFd, vBuffer.data(), vBuffer.size());
+            if (lRead <= 0) {
+                if (lRead < 0) {
+                    FailPruneDir(pass, errno, "read directory", pNode, ".");
+                }
+                break;
+            }
+
+            for (long lPos = 0; lPos < lRead; ) {
+                const LinuxDirent64* pDirent = reinterpret_cast<const LinuxDirent64*>(vBuffer.data() + lPos);
+                lPos += pDirent->d_reclen;
+                const char* szName = pDirent->d_name;
+                if (szName[0] == '.' && (szName[1] == '\0' || (szName[1] == '.' && szName[2] == '\0'))) {
+                    continue;
+                }
+
+                struct stat st;
+                SYSCALL_COUNT(Fstatat);
+                if (fstatat(iFd, szName, &st, AT_SYMLINK_NOFOLLOW) != 0) {
+                    if (errno != ENOENT) {
+                        FailPruneDir(pass, errno, "stat", pNode, szName);
+                    }
+                    continue;
+                }
+                uint64_t ulBytes = static_cast<uint64_t>(st.st_blocks) * 512;
+                pass.ulBytes += ulBytes;
+                ++info.ulEntries;
+
+                if (S_ISDIR(st.st_mode)) {
+                    TrieNode* pChild = pass.trie.insertChild(pNode, szName);
+                    pass.dirInfos.push_back({ 0, ulBytes });
+                    pChild->setData(&pass.dirInfos.back());
+                    vStack.push_back(pChild);
+                    continue;
+                }
+
+                uint64_t ulKey = PruneKey(ePolicy, st, ulBytes);
+                if (pass.vHeap.size() >= ulMaxCandidates) {
+                    pass.bTruncated = true;
+                    if (ulMaxCandidates == 0 || ulKey <= pass.vHeap.front().ulKey) {
+                        continue;
+                    }
+                    std::pop_heap(pass.vHeap.begin(), pass.vHeap.end(), PruneKeyGreater);
+                    pass.vHeap.pop_back();
+                }
+                pass.vHeap.push_back({ pNode, szName, ulBytes, ulKey });
+                std::push_heap(pass.vHeap.begin(), pass.vHeap.end(), PruneKeyGreater);
+            }
+        }
+        close(iFd);
+    }
+}
+
+// Remove the victims of one directory, then the directory and its parents
+// as long as they are left empty. Returns the bytes reclaimed.
+uint64_t PruneDirRemove(PrunePass& pass, TrieNode* pDir, const PruneCandidate* pBegin, const PruneCandidate* pEnd,
+                        PruneDirStats& stats)
+{
+    std::string szDirPath = TrieNode::getFullPath(pDir);
+    SYSCALL_COUNT(Open);
+    int iFd = open(szDirPath.c_str(), O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (iFd < 0) {
+        if (errno != ENOENT) {
+            FailPruneDir(pass, errno, "open directory", pDir, ".");
+        }
+        return 0;
+    }
+
+    uint64_t ulReclaimed = 0;
+    PruneDirInfo& info = GetPruneInfo(pDir);
+    for (const PruneCandidate* pVictim = pBegin; pVictim != pEnd; ++pVictim) {
+        SYSCALL_COUNT(Unlinkat);
+        if (unlinkat(iFd, pVictim->szName.c_str(), 0) == 0) {
+            ulReclaimed += pVictim->ulBytes;
+            ++stats.ulRemovedFiles;
+        } else if (errno != ENOENT) {
+            FailPruneDir(pass, errno, "delete", pDir, pVictim->szName.c_str());
+            continue;
+        }
+        --info.ulEntries;
+    }
+
+    // Climb through ".." so that every removal stays relative to an fd
+    while (pDir != pass.pRoot && GetPruneInfo(pDir).ulEntries == 0) {
+        SYSCALL_COUNT(Openat);
+        int iParentFd = openat(iFd, "..", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        close(iFd);
+        iFd = iParentFd;
+        if (iFd < 0) {
+            FailPruneDir(pass, errno, "open parent of", pDir, ".");
+            break;
+        }
+        SYSCALL_COUNT(Unlinkat);
+        if (unlinkat(iFd, pDir->getNodeValue().c_str(), AT_REMOVEDIR) != 0) {
+            // Filled again meanwhile
+            if (errno != ENOTEMPTY && errno != EEXIST) {
+                FailPruneDir(pass, errno, "delete directory", pDir, ".");
+            }
+            break;
+        }
+        ulReclaimed += GetPruneInfo(pDir).ulBytes;
+        ++stats.ulRemovedDirs;
+        pDir = pDir->getParent();
+        --GetPruneInfo(pDir).ulEntries;
+    }
+    if (iFd >= 0) {
+        close(iFd);
+    }
+    return ulReclaimed;
+}
+}
+
+bool PruneDir(const std::string& szPath, uint64_t ulTargetBytes, PrunePolicy ePolicy, PruneDirStats* pStats,
+              size_t ulMaxCandidates)
+{
+    TRACE_FUNCTION();
+    if (szPath.empty()) {
+        errno = EINVAL;
+        std::cerr << __FUNCTION__ << ": Invalid input!" << std::endl;
+        return false;
+    }
+    char szCwd[PATH_MAX];
+    std::string szRoot = NormalizeCreatePath(szPath, getcwd(szCwd, sizeof(szCwd)) ? szCwd : "/");
+
+    PruneDirStats stats;
+    int iErrno = 0;
+    bool bFits = false;
+    while (true) {
+        PrunePass pass;
+        ++stats.nPasses;
+
+        auto start = std::chrono::steady_clock::now();
+        struct stat st;
+        SYSCALL_COUNT(Lstat);
+        if (lstat(szRoot.c_str(), &st) != 0) {
+            iErrno = errno;
+            std::cerr << __FUNCTION__ << ": Failed to stat '" << szRoot << "', err: " << strerror(iErrno) << std::endl;
+            break;
+        }
+        pass.pRoot = pass.trie.insert(szRoot);
+        pass.dirInfos.push_back({ 0, static_cast<uint64_t>(st.st_blocks) * 512 });
+        pass.pRoot->setData(&pass.dirInfos.back());
+        pass.ulBytes = pass.dirInfos.back().ulBytes;
+        PruneDirScan(pass, ePolicy, ulMaxCandidates);
+        stats.ulScanNs += PruneElapsedNs(start);
+        if (stats.nPasses == 1) {
+            stats.ulScannedBytes = pass.ulBytes;
+        }
+        if (pass.ulBytes <= ulTargetBytes) {
+            bFits = true;
+            iErrno = pass.iErrno;
+            break;
+        }
+
+        // The most eligible victims that cover the excess
+        start = std::chrono::steady_clock::now();
+        std::vector<PruneCandidate>& vVictims = pass.vHeap;
+        std::sort(vVictims.begin(), vVictims.end(), PruneKeyGreater);
+        uint64_t ulExcess = pass.ulBytes - ulTargetBytes;
+        uint64_t ulPicked = 0;
+        size_t ulVictims = 0;
+        while (ulVictims < vVictims.size() && ulPicked < ulExcess) {
+            ulPicked += vVictims[ulVictims++].ulBytes;
+        }
+        vVictims.resize(ulVictims);
+        std::sort(vVictims.begin(), vVictims.end(), [](const PruneCandidate& a, const PruneCandidate& b) {
+            return a.pParent < b.pParent;
+        });
+        stats.ulSelectNs += PruneElapsedNs(start);
+
+        start = std::chrono::steady_clock::now();
+        uint64_t ulReclaimed = 0;
+        for (size_t i = 0; i < vVictims.size(); ) {
+            size_t j = i;
+            while (j < vVictims.size() && vVictims[j].pParent == vVictims[i].pParent) {
+                ++j;
+            }
+            ulReclaimed += PruneDirRemove(pass, vVictims[i].pParent, &vVictims[i], vVictims.data() + j, stats);
+            i = j;
+        }
+        stats.ulRemoveNs += PruneElapsedNs(start);
+        stats.ulReclaimedBytes += ulReclaimed;
+
+        iErrno = pass.iErrno;
+        if (pass.ulBytes - std::min(pass.ulBytes, ulReclaimed) <= ulTargetBytes) {
+            bFits = true;
+            break;
+        }
+        // Only a truncated heap leaves victims for another traversal
+        if (!pass.bTruncated || ulReclaimed == 0) {
+            if (iErrno == 0) {
+                iErrno = ENOSPC;
+            }
+            break;
+        }
+    }
+
+    SyncDirCache();
+    if (pStats) {
+        *pStats = stats;
+    }
+    if (!bFits || iErrno != 0) {
+        errno = iErrno;
+        return false;
+    }
+    return true;
+}
@@ -0,0 +1,271 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#include "trace.h"
+#include "PerfCounters.h"
+#include "TraceRing.h"
+#include "TraceStats.h"
+#include <csignal>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <unordered_map>
+
+#ifndef TRACE_DEFAULT_BACKEND
+#define TRACE_DEFAULT_BACKEND       "ftrace"
+#endif
+
+std::atomic<bool> Tracer::s_bEnabled(false);
+std::atomic<int> Tracer::s_iBackend(static_cast<int>(TraceBackend::Ftrace));
+
+namespace {
+// Sampling rates by event name and the sites resolved so far. Function
+// local statics, trace points may run before this file is initialized.
+std::mutex& SiteMutex()
+{
+    static std::mutex mutex;
+    return mutex;
+}
+
+std::unordered_map<std::string, uint32_t>& SampleRates()
+{
+    static std::unordered_map<std::string, uint32_t> mapRates;
+    return mapRates;
+}
+
+std::vector<TraceSite*>& Sites()
+{
+    static std::vector<TraceSite*> vSites;
+    return vSites;
+}
+
+bool ParseBackend(const char* szName, TraceBackend& eBackend)
+{
+    if (strcmp(szName, "ftrace") == 0) {
+        eBackend = TraceBackend::Ftrace;
+    } else if (strcmp(szName, "ring") == 0) {
+        eBackend = TraceBackend::Ring;
+    } else if (strcmp(szName, "stats") == 0) {
+        eBackend = TraceBackend::Stats;
+    } else if (strcmp(szName, "perf") == 0) {
+        eBackend = TraceBackend::Perf;
+    } else {
+        return false;
+    }
+    return true;
+}
+
+pid_t CurrentTid()
+{
+    thread_local pid_t iTid = gettid();
+    return iTid;
+}
+
+// TraceStats id of the site, registered by name on first use
+int StatsId(TraceSite& site)
+{
+    int iStatsId = site.iStatsId.load(std::memory_order_relaxed);
+    if (iStatsId < 0) {
+        iStatsId = TraceStats::Instance().registerSite(site.szName);
+        site.iStatsId.store(iStatsId, std::memory_order_relaxed);
+    }
+    return iStatsId;
+}
+
+// Only flips the flag, backends set themselves up on their first event
+void OnToggleSignal(int)
+{
+    Tracer::IsEnabled() ? Tracer::Disable() : Tracer::Enable(Tracer::GetBackend());
+}
+
+// Apply $TRACE_SAMPLE and $TRACE, and install the toggle signal if
+// $TRACE_SIGNAL asks for it
+struct TraceStartup {
+    TraceStartup() {
+        TraceBackend eDefault = TraceBackend::Ftrace;
+        ParseBackend(TRACE_DEFAULT_BACKEND, eDefault);
+        const char* szTrace = getenv("TRACE");
+        if (szTrace && *szTrace && strcmp(szTrace, "0") != 0 && strcmp(szTrace, "1") != 0 &&
+            !ParseBackend(szTrace, eDefault)) {
+            std::cerr << "Tracer: Unknown backend '" << szTrace << "', using "
+                      << TRACE_DEFAULT_BACKEND << std::endl;
+        }
+        Tracer::SetBackend(eDefault);
+
+        // name=rate pairs separated by commas
+        const char* szSample = getenv("TRACE_SAMPLE");
+        std::string szRates = szSample ? szSample : "";
+        size_t ulPos = 0;
+        while (ulPos < szRates.size()) {
+            size_t ulEnd = szRates.find(',', ulPos);
+            std::string szPair = szRates.substr(ulPos, ulEnd == std::string::npos ? std::string::npos : ulEnd - ulPos);
+            size_t ulEq = szPair.find('=');
+            if (ulEq != std::string::npos) {
+                Tracer::SetSampling(szPair.substr(0, ulEq), strtoul(szPair.c_str() + ulEq + 1, nullptr, 10));
+            }
+            ulPos = ulEnd == std::string::npos ? szRates.size() : ulEnd + 1;
+        }
+
+        const char* szSignal = getenv("TRACE_SIGNAL");
+        if (szSignal && *szSignal && strcmp(szSignal, "0") != 0 && !Tracer::InstallToggleSignal()) {
+            std::cerr << "Tracer: Signal " << TRACE_TOGGLE_SIGNAL << " is handled by the application, "
+                      << "no toggle installed" << std::endl;
+        }
+
+        if (szTrace && *szTrace && strcmp(szTrace, "0") != 0) {
+            Tracer::Enable();
+        }
+    }
+} g_traceStartup;
+}
+
+void Tracer::Enable(TraceBackend eBackend) {
+    SetBackend(eBackend);
+    s_bEnabled.store(true, std::memory_order_release);
+}
+
+void Tracer::SetBackend(TraceBackend eBackend) {
+    s_iBackend.store(static_cast<int>(eBackend), std::memory_order_relaxed);
+}
+
+void Tracer::Enable() {
+    Enable(GetBackend());
+}
+
+bool Tracer::InstallToggleSignal() {
+    struct sigaction current;
+    if (sigaction(TRACE_TOGGLE_SIGNAL, nullptr, &current) != 0) {
+        return false;
+    }
+    if (current.sa_handler == OnToggleSignal) {
+        return true;
+    }
+    if ((current.sa_flags & SA_SIGINFO) != 0 || current.sa_handler != SIG_DFL) {
+        return false;
+    }
+    struct sigaction action;
+    std::memset(&action, 0, sizeof(action));
+    action.sa_handler = OnToggleSignal;
+    action.sa_flags = SA_RESTART;
+    return sigaction(TRACE_TOGGLE_SIGNAL, &action, nullptr) == 0;
+}
+
+void Tracer::Disable() {
+    s_bEnabled.store(false, std::memory_order_relaxed);
+}
+
+TraceBackend Tracer::GetBackend() {
+    return static_cast<TraceBackend>(s_iBackend.load(std::memory_order_relaxed));
+}
+
+void Tracer::SetSampling(const std::string& szName, uint32_t uRate) {
+    uRate = std::max<uint32_t>(uRate, 1);
+    std::lock_guard<std::mutex> lock(SiteMutex());
+    SampleRates()[szName] = uRate;
+    for (TraceSite* pSite : Sites()) {
+        if (szName == pSite->szName) {
+            pSite->uRate.store(uRate, std::memory_order_relaxed);
+        }
+    }
+}
+
+bool Tracer::Sample(TraceSite& site) {
+    uint32_t uRate = site.uRate.load(std::memory_order_relaxed);
+    if (uRate == 0) {
+        // First recorded call of this site, pick up its sampling rate
+        std::lock_guard<std::mutex> lock(SiteMutex());
+        uRate = site.uRate.load(std::memory_order_relaxed);
+        if (uRate == 0) {
+            auto it = SampleRates().find(site.szName);
+            uRate = it != SampleRates().end() ? it->second : 1;
+            site.uRate.store(uRate, std::memory_order_relaxed);
+            Sites().push_back(&site);
+        }
+    }
+    return uRate == 1 || site.uCalls.fetch_add(1, std::memory_order_relaxed) % uRate == 0;
+}
+
+void Tracer::Begin(TraceSite& site) {
+    switch (GetBackend()) {
+    case TraceBackend::Ftrace:
+        Trace::Instance().begin(site.szName, CurrentTid());
+        break;
+    case TraceBackend::Ring:
+        TraceRing::Instance().begin(site.szName);
+        break;
+    case TraceBackend::Stats:
+        TraceStats::Instance().begin(StatsId(site));
+        break;
+    case TraceBackend::Perf:
+        PerfTrace::Instance().begin();
+        break;
+    }
+}
+
+void Tracer::End(TraceSite& site) {
+    switch (GetBackend()) {
+    case TraceBackend::Ftrace:
+        Trace::Instance().end(site.szName, CurrentTid());
+        break;
+    case TraceBackend::Ring:
+        TraceRing::Instance().end(site.szName);
+        break;
+    case TraceBackend::Stats:
+        TraceStats::Instance().end(StatsId(site));
+        break;
+    case TraceBackend::Perf:
+        PerfTrace::Instance().end(site.szName);
+        break;
+    }
+}
+
+void Tracer::ScopeGuard::start(TraceSite& site) {
+    if (!Sample(site)) {
+        return;
+    }
+
+    // The backend may be switched meanwhile, end the event where it began
+    m_pSite = &site;
+    m_eBackend = GetBackend();
+    if (m_eBackend == TraceBackend::Ftrace) {
+        Trace::Instance().begin(site.szName, CurrentTid());
+    } else if (m_eBackend == TraceBackend::Ring) {
+        m_ulStartNs = TraceRing::Now();
+    } else if (m_eBackend == TraceBackend::Stats) {
+        m_ulStartNs = TraceStats::Now();
+    } else {
+        PerfTrace::Instance().begin();
+    }
+}
+
+void Tracer::ScopeGuard::finish() {
+    switch (m_eBackend) {
+    case TraceBackend::Ftrace:
+        Trace::Instance().end(m_pSite->szName, CurrentTid());
+        break;
+    case TraceBackend::Ring:
+        TraceRing::Instance().complete(m_pSite->szName, m_ulStartNs);
+        break;
+    case TraceBackend::Stats:
+        TraceStats::Instance().record(StatsId(*m_pSite), TraceStats::Now() - m_ulStartNs);
+        break;
+    case TraceBackend::Perf:
+        PerfTrace::Instance().end(m_pSite->szName);
+        break;
+    }
+}
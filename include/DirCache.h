@@ -0,0 +1,130 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <shared_mutex>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include "PathTrie.h"
+
+#define DIR_CACHE_WATCHES           8192        // default inotify watch budget
+
+struct DirCacheStats {
+    uint64_t ulLookups = 0;
+    uint64_t ulUnknown = 0;             // lookups the cache could not answer
+    uint64_t ulEvents = 0;
+    uint64_t ulRescans = 0;             // after IN_Q_OVERFLOW
+    size_t ulWatches = 0;
+    size_t ulDirs = 0;                  // directories known to exist
+};
+
+// Existence cache of the directories below a watched root, backing
+// CreateDirMode::Cached. The tree is mirrored into a PathTrie with one
+// inotify watch per directory. A background thread blocks on the inotify fd
+// and applies create, delete and move events as they arrive, watching and
+// listing new directories. A lookup is a walk of the mirror under a reader
+// lock and makes no syscall.
+//
+// The mirror trails the file system by the time the thread needs to apply an
+// event, usually microseconds. sync() applies everything queued so far, so a
+// lookup after it sees every change made before, by any process. The removal
+// calls of file_utils sync before returning, so a CreateDir after them on
+// any thread never trusts a directory they removed.
+//
+// A directory is only trusted if it is watched. Once the budget is spent,
+// lookups below unwatched directories answer "unknown" and the caller falls
+// back to syscalls. IN_Q_OVERFLOW drops the mirror and scans the root again.
+class DirCache {
+public:
+    static DirCache& Instance();
+
+    // Mirror szRoot, replacing the root watched before
+    bool watch(const std::string& szRoot, size_t ulMaxWatches = DIR_CACHE_WATCHES);
+
+    // Drop the mirror and every watch
+    void unwatch();
+
+    // Apply every event queued so far, e.g. after removing directories the
+    // next CreateDir must not consider present. RemoveDir and friends do so
+    // themselves, other processes' changes show within microseconds.
+    void sync();
+
+    // A root is watched, without constructing the instance
+    static bool IsWatching() {
+        return s_bWatching.load(std::memory_order_acquire);
+    }
+
+    // Number of leading components of szPath, an absolute path without empty
+    // components, that exist as directories. Every further component is
+    // known to be missing. -1 if szPath is not below the root or the cache
+    // cannot tell.
+    int lookup(std::string_view szPath) const;
+
+    DirCacheStats getStats();
+
+    // Disable copy and copy operations on this class to prevent duplication
+    DirCache(const DirCache&) = delete;
+    DirCache& operator=(const DirCache&) = delete;
+
+private:
+    struct Entry {
+        int iWd = -1;
+        bool bExists = true;
+        bool bComplete = false;         // watched and listed, children are known
+    };
+
+    DirCache();
+
+    static const Entry* findEntry(const TrieNode* pNode);
+    Entry& getEntry(TrieNode* pNode);
+    void resetLocked();
+    bool rescanLocked();
+    bool scanLocked(TrieNode* pNode);
+    void markGoneLocked(TrieNode* pNode);
+    void unwatchLocked(Entry& entry);
+    void drainLocked();
+    void run();
+
+    static std::atomic<bool> s_bWatching;
+
+    mutable std::shared_mutex m_mutex;  // shared by lookups, exclusive for changes
+    int m_iFd;                          // inotify, nonblocking
+    std::thread m_thread;
+    std::string m_szRoot;
+    size_t m_ulRootComponents;
+    size_t m_ulMaxWatches;
+    bool m_bValid;                      // the mirror matches the root
+    std::unique_ptr<PathTrie> m_pTrie;
+    TrieNode* m_pRoot;
+    std::deque<Entry> m_entries;        // node data, addresses stay put
+    std::unordered_map<int, TrieNode*> m_mapWatches;
+    DirCacheStats m_stats;              // events and rescans, under the exclusive lock
+    mutable std::atomic<uint64_t> m_ulLookups;
+    mutable std::atomic<uint64_t> m_ulUnknown;
+};
+
+#endif // DIRCACHE_H
@@ -0,0 +1,100 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef IOURING_H
+#define IOURING_H
+
+#include <cstdint>
+#include <functional>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+struct io_uring_sqe;
+struct io_uring_cqe;
+
+// Minimal io_uring ring driven through the raw syscalls, so no liburing is
+// needed. Operations are queued with prep*() and issued together by
+// submitAndWait(), a whole batch costs a single io_uring_enter.
+class IoUring {
+public:
+    IoUring();
+
+    ~IoUring();
+
+    // Set up a ring of iEntries submission slots
+    bool init(unsigned int iEntries);
+
+    bool isReady() const;
+
+    // Runtime probe, true if the kernel provides io_uring together with
+    // mkdirat, unlinkat and statx. The result is cached.
+    static bool IsSupported();
+
+    // Number of operations that can still be queued before submitAndWait()
+    unsigned int freeSlots() const;
+
+    unsigned int capacity() const;
+
+    // iSqeFlags takes IOSQE_IO_LINK / IOSQE_IO_HARDLINK to order operations.
+    // The path must stay valid until submitAndWait() returns.
+    bool prepMkdirat(int iDirFd, const char* szPath, mode_t mode,
+                     uint64_t ulUserData, unsigned int iSqeFlags = 0);
+
+    bool prepUnlinkat(int iDirFd, const char* szPath, int iFlags,
+                      uint64_t ulUserData, unsigned int iSqeFlags = 0);
+
+    bool prepStatx(int iDirFd, const char* szPath, int iFlags, unsigned int iMask,
+                   struct statx* pStatx, uint64_t ulUserData, unsigned int iSqeFlags = 0);
+
+    // Submit every queued operation and wait for all completions. onComplete
+    // receives the user data and the result (>= 0 or -errno) of each one.
+    // Returns false if io_uring_enter itself failed. Submitted operations
+    // are still waited for then, and the ring is released: isReady() is
+    // false until init() sets it up again.
+    bool submitAndWait(const std::function<void(uint64_t, int)>& onComplete);
+
+    // Disable copy and copy operations on this class to prevent duplication
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+private:
+    io_uring_sqe* getSqe();
+    void release();
+
+    int m_iRingFd;
+    void* m_pSqRing;
+    void* m_pCqRing;
+    size_t m_ulSqRingSize;
+    size_t m_ulCqRingSize;
+    io_uring_sqe* m_pSqes;
+    size_t m_ulSqesSize;
+
+    unsigned int* m_pSqHead;
+    unsigned int* m_pSqTail;
+    unsigned int* m_pSqMask;
+    unsigned int* m_pSqArray;
+    unsigned int* m_pCqHead;
+    unsigned int* m_pCqTail;
+    unsigned int* m_pCqMask;
+    io_uring_cqe* m_pCqes;
+
+    unsigned int m_iEntries;
+    unsigned int m_iQueued;             // prepared but not yet submitted
+};
+
+#endif // IOURING_H
@@ -20,25 +20,72 @@
 #define PATHTRIE_H
 
 #include "TrieNode.h"
+#include "TrieArena.h"
+#include "TrieWalker.h"
+#include <atomic>
+#include <mutex>
 #include <stack>
 #include <string>
+#include <string_view>
 #include <vector>
 
+enum class PathTrieMode {
+    Heap,       // every node is its own heap allocation owning its name
+    Arena,      // nodes come from a monotonic arena released in one shot,
+                // names are interned into a shared pool
+    Radix,      // Arena, plus single-child chains are merged into one node
+                // whose value spans several components ("a/b/c"). Edges are
+                // split on insert, so every inserted path still ends on a node.
+    Concurrent, // Heap nodes that many threads may insert into and look up at
+                // the same time. Lookups never lock; a miss locks the parent
+                // and re-checks before creating the child.
+};
+
 class PathTrie {
 public:
-    PathTrie();
+    explicit PathTrie(PathTrieMode mode = PathTrieMode::Heap);
 
     ~PathTrie();
 
-    TrieNode* insert(const std::string& path);
+    // Insert if absent and return the node of path. When several threads race
+    // on the same path of a PathTrieMode::Concurrent trie, all of them get
+    // the same winning node, and pInserted is set for exactly one of them.
+    TrieNode* insert(std::string_view path, bool* pInserted = nullptr);
+
+    // Insert a single component below an existing node, skips re-parsing the full path
+    TrieNode* insertChild(TrieNode* parent, std::string_view part, bool* pInserted = nullptr);
+
+    // Lookup without inserting, nullptr if the path is not in the trie
+    TrieNode* find(std::string_view path) const;
 
+    size_t getNodeCount() const;
 
     TrieNode* GetRoot();
 
+    // Visit every node in order, see TrieWalker. Returns false if the
+    // visitor stopped the walk.
+    bool walk(TrieOrder order, const std::function<TrieVisit(TrieNode*, size_t)>& visit, bool bSorted = false);
+
     void print();
 
+    // Disable copy and copy operations on this class to prevent duplication
+    PathTrie(const PathTrie&) = delete;
+    PathTrie& operator=(const PathTrie&) = delete;
+
 private:
-    std::unique_ptr<TrieNode> root;
+    TrieNode* createChild(TrieNode* parent, std::string_view part);
+    TrieNode* insertShared(TrieNode* parent, std::string_view part, bool& bInserted);
+    TrieNode* insertRadix(TrieNode* node, std::string_view rest);
+    TrieNode* splitEdge(TrieNode* node, size_t length);
+
+    // Writers of a concurrent node lock the stripe its address hashes to
+    static const size_t LOCK_STRIPES = 64;
+
+    std::unique_ptr<TrieArena> arena;   // only set in PathTrieMode::Arena and Radix
+    std::unique_ptr<std::mutex[]> locks;    // only set in PathTrieMode::Concurrent
+    TrieNode* root;
+    bool radix;
+    std::atomic<size_t> nodeCount;
 };
 
 #endif // PATHTRIE_H
@@ -0,0 +1,165 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include "syscall_stats.h"
+#include <cstdint>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <string>
+
+enum class PerfEvent : int {
+    Cycles = 0,         // hardware, usually missing in VMs
+    Instructions,       // hardware
+    ContextSwitches,
+    PageFaults,
+    TaskClock,          // CPU time of the thread in nanoseconds
+    Count
+};
+
+// Counters of one measured call, or the sum of several calls. Events the
+// kernel refused to count are flagged unavailable and stay 0. The syscall
+// tally is filled only with SYSCALL_STATS_ENABLE.
+struct PerfStats {
+    uint64_t ulCalls;
+    uint64_t ulWallNs;
+    uint64_t events[static_cast<int>(PerfEvent::Count)];
+    bool available[static_cast<int>(PerfEvent::Count)];
+    uint64_t syscalls[static_cast<int>(SyscallType::Count)];
+
+    PerfStats();
+
+    bool has(PerfEvent eEvent) const {
+        return available[static_cast<int>(eEvent)];
+    }
+
+    uint64_t get(PerfEvent eEvent) const {
+        return events[static_cast<int>(eEvent)];
+    }
+
+    uint64_t getSyscalls(SyscallType eType) const {
+        return syscalls[static_cast<int>(eType)];
+    }
+
+    uint64_t getTotalSyscalls() const;
+
+    // Accumulate another call, an event stays available only if it is in both
+    void add(const PerfStats& other);
+
+    // One line per available event and non-zero syscall counter
+    void print(std::ostream& os) const;
+
+    static const char* Name(PerfEvent eEvent);
+};
+
+// perf_event_open counters of the calling thread. Every event is opened on
+// its own, so a missing PMU (ENOENT in most VMs) loses only cycles and
+// instructions. Events count user and kernel space, or only user space when
+// perf_event_paranoid is 2 and the process lacks CAP_PERFMON; context
+// switches then always read 0. With paranoid 3 or a seccomp filter nothing
+// is counted and isAvailable() is false for all events. Threads spawned by
+// the measured code are not included.
+class PerfCounters {
+public:
+    // Counters of the calling thread, opened on first use
+    static PerfCounters& ForThread();
+
+    bool isAvailable(PerfEvent eEvent) const {
+        return m_fds[static_cast<int>(eEvent)] >= 0;
+    }
+
+    // Kernel space is excluded from this event
+    bool isUserOnly(PerfEvent eEvent) const {
+        return m_bUserOnly[static_cast<int>(eEvent)];
+    }
+
+    // Absolute counts of the thread so far plus its syscall counters. One
+    // read() per available event, a few microseconds in total.
+    void snapshot(PerfStats& stats) const;
+
+    // Value of perf_event_paranoid, or INT32_MIN if it cannot be read
+    static int GetParanoid();
+
+    ~PerfCounters();
+
+    // Disable copy and copy operations on this class to prevent duplication
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+private:
+    PerfCounters();
+
+    int m_fds[static_cast<int>(PerfEvent::Count)];
+    bool m_bUserOnly[static_cast<int>(PerfEvent::Count)];
+};
+
+// Measures the enclosing scope on the calling thread and stores the
+// difference in the given stats when it ends.
+class PerfScope {
+public:
+    explicit PerfScope(PerfStats& result);
+    ~PerfScope();
+
+    PerfScope(const PerfScope&) = delete;
+    PerfScope& operator=(const PerfScope&) = delete;
+
+private:
+    PerfStats& m_result;
+    PerfStats m_start;
+};
+
+// Run fn once and return its counters, e.g.
+//   PerfStats stats = MeasurePerf([&] { CreateDir(szPath); });
+template <typename Fn>
+PerfStats MeasurePerf(Fn&& fn)
+{
+    PerfStats stats;
+    {
+        PerfScope scope(stats);
+        fn();
+    }
+    return stats;
+}
+
+// Per-site sums of the perf trace backend, printed to stderr at exit.
+// Nested TRACE_FUNCTION scopes are counted in every enclosing site.
+class PerfTrace {
+public:
+    static PerfTrace& Instance();
+
+    // Start and end of a traced scope on the calling thread, strictly nested
+    void begin();
+    void end(const char* szName);
+
+    void report(std::ostream& os);
+
+    // Disable copy and copy operations on this class to prevent duplication
+    PerfTrace(const PerfTrace&) = delete;
+    PerfTrace& operator=(const PerfTrace&) = delete;
+
+private:
+    PerfTrace();
+
+    std::mutex m_mutex;                 // guards m_sites
+    std::map<std::string, PerfStats> m_sites;
+};
+
+#endif // PERFCOUNTERS_H
@@ -0,0 +1,110 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef TRACERING_H
+#define TRACERING_H
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sys/types.h>
+
+#define TRACE_RING_EVENTS           65536       // per thread, power of two
+#define TRACE_RING_FLUSH_MS         20
+#define TRACE_RING_DEFAULT_FILE     "trace.json"
+
+// In-process trace backend. Every thread records fixed-size binary events
+// into its own single-producer ring, no lock and no syscall per event. A
+// background thread drains the rings and writes Chrome Trace JSON into the
+// file named by $TRACE_FILE (default trace.json), the last events are
+// flushed at exit. When a ring is full new events are dropped and counted.
+// The instance is never destroyed, so threads that outlive the static
+// destructors can still touch their rings.
+//
+// Event names are stored as pointers, so they have to outlive the tracer:
+// string literals and __FUNCTION__ are fine.
+class TraceRing {
+public:
+    static TraceRing& Instance();
+
+    void begin(const char* szName);
+
+    void end(const char* szName);
+
+    // One complete event covering [ulStartNs, now)
+    void complete(const char* szName, uint64_t ulStartNs);
+
+    // Monotonic timestamp in nanoseconds
+    static uint64_t Now();
+
+    // Drain every ring into the output file right away
+    void flush();
+
+    // Events lost to full rings
+    uint64_t getDropped() const;
+
+    // Disable copy and copy operations on this class to prevent duplication
+    TraceRing(const TraceRing&) = delete;
+    TraceRing& operator=(const TraceRing&) = delete;
+
+private:
+    struct Event {
+        const char* szName;
+        uint64_t ulTimestampNs;
+        uint64_t ulDurationNs;
+        pid_t iTid;
+        char cPhase;                    // 'B', 'E' or 'X'
+    };
+
+    struct Ring;
+    struct ThreadRing;
+
+    TraceRing();
+
+    // Write the last events and close the file, at exit
+    void finish();
+
+    Ring* getRing();
+    void releaseRing(Ring* pRing);
+    void push(const char* szName, uint64_t ulTimestampNs, uint64_t ulDurationNs, char cPhase);
+    void run();
+    void drain();
+    void writeEvent(const Event& event);
+    void writeBuffer(bool bForce);
+
+    int m_iFd;                          // output file, -1 if it cannot be written
+    pid_t m_iPid;
+    bool m_bFirstEvent;
+    std::string m_szBuffer;             // JSON waiting to be written
+    std::atomic<uint64_t> m_ulDropped;
+
+    std::mutex m_mutex;                 // guards m_rings and m_bStop
+    std::vector<std::unique_ptr<Ring>> m_rings;
+    std::mutex m_flushMutex;            // one consumer at a time
+    std::condition_variable m_cvStop;
+    std::thread m_flusher;
+    bool m_bStop;
+    bool m_bFinished;                   // file closed, guarded by m_flushMutex
+};
+
+#endif // TRACERING_H
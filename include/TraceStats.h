@@ -0,0 +1,119 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef TRACESTATS_H
+#define TRACESTATS_H
+
+#include <atomic>
+#include <cstdint>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#define TRACE_STATS_SIGNAL          SIGUSR2     // print the report on demand
+
+// Log-linear latency histogram in nanoseconds: 16 linear sub-buckets per
+// power of two, so every bucket is within 6.25% of its values. Written by a
+// single thread, read and merged by any thread.
+class LatencyHistogram {
+public:
+    static const int SUB_BUCKETS = 16;
+    static const int BUCKETS = (64 - 3) * SUB_BUCKETS;
+
+    LatencyHistogram();
+
+    void record(uint64_t ulNs);
+
+    // Add the samples of other to this histogram
+    void merge(const LatencyHistogram& other);
+
+    uint64_t getCount() const;
+
+    uint64_t getTotal() const;
+
+    uint64_t getMax() const;
+
+    // Upper bound of the bucket holding the given quantile (0..1)
+    uint64_t getPercentile(double dQuantile) const;
+
+private:
+    static int BucketOf(uint64_t ulNs);
+    static uint64_t BucketUpperBound(int iBucket);
+
+    std::atomic<uint64_t> m_ulCount;
+    std::atomic<uint64_t> m_ulTotal;
+    std::atomic<uint64_t> m_ulMax;
+    std::atomic<uint64_t> m_buckets[BUCKETS];
+};
+
+// Aggregating trace backend. Every TRACE_FUNCTION / TRACE_B / TRACE_E site
+// feeds a per-thread histogram and call counter, nothing is written while
+// the program runs. The merged p50/p90/p99/max and total time per event are
+// printed to stderr at exit, on report(), or when TRACE_STATS_SIGNAL arrives.
+class TraceStats {
+public:
+    static TraceStats& Instance();
+
+    // Id of the event called szName, registered on first use
+    int registerSite(const std::string& szName);
+
+    void record(int iSite, uint64_t ulNs);
+
+    // TRACE_B / TRACE_E pairs of registered sites, matched by id on the
+    // calling thread. Sites of the same name share the id.
+    void begin(int iSite);
+
+    void end(int iSite);
+
+    // Print the merged statistics of every event
+    void report(std::ostream& os);
+
+    // Monotonic timestamp in nanoseconds
+    static uint64_t Now();
+
+    // Disable copy and copy operations on this class to prevent duplication
+    TraceStats(const TraceStats&) = delete;
+    TraceStats& operator=(const TraceStats&) = delete;
+
+private:
+    struct ThreadStats;
+
+    TraceStats();
+
+    // Stop the signal watcher and print the report, at exit
+    void finish();
+
+    ThreadStats& getThreadStats();
+    LatencyHistogram* getHistogram(int iSite);
+    void retire(ThreadStats* pStats);
+    void watchSignal();
+
+    std::mutex m_mutex;                 // guards everything below
+    std::vector<std::string> m_names;
+    std::unordered_map<std::string, int> m_sites;
+    std::vector<ThreadStats*> m_threads;                        // live threads
+    std::vector<std::unique_ptr<LatencyHistogram>> m_retired;   // per site, exited threads
+    int m_signalPipe[2];
+    std::thread m_signalWatcher;
+};
+
+#endif // TRACESTATS_H
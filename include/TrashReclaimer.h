@@ -0,0 +1,113 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef TRASHRECLAIMER_H
+#define TRASHRECLAIMER_H
+
+#include <sys/types.h>
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <future>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define TRASH_DIR_NAME              ".fileio-trash"
+
+struct TrashOptions {
+    unsigned int nThreads = 1;          // reclaimer threads, fixed once the first entry is queued
+    uint64_t ulMaxEntriesPerSec = 0;    // removal rate over all threads, 0 is unlimited
+    double dCpuBudget = 0;              // CPU share per thread, e.g. 0.25, 0 is unlimited
+};
+
+// Backs RemoveDirAsync. A directory is renamed into the trash area of its
+// file system, which takes one syscall whatever the tree holds, and worker
+// threads delete the trash in the background with RemoveDirStreaming.
+//
+// Trash entries are named <pid>.<seq>. The first time a trash directory is
+// used, entries of processes that no longer run are claimed and deleted, so
+// trees left by a crash are finished by the next process.
+class TrashReclaimer {
+public:
+    static TrashReclaimer& Instance();
+
+    // Rate and CPU budget apply from the next removed entry
+    void configure(const TrashOptions& options);
+
+    // Use szDir/.fileio-trash for the file system holding szDir instead of
+    // the top-most writable directory of that file system
+    bool setTrashDir(const std::string& szDir);
+
+    // Rename szPath into the trash and queue it. On failure the returned
+    // future is ready with false, errno is set and fnDone has been called.
+    std::future<bool> remove(const std::string& szPath, std::function<void(bool, int)> fnDone);
+
+    // Claim and queue the leftovers of dead processes in szTrashDir,
+    // returns the number of entries queued
+    unsigned int recover(const std::string& szTrashDir);
+
+    // Block until the queue is empty and no entry is being deleted
+    void wait();
+
+    // Entries queued or being deleted
+    size_t pending();
+
+    // Disable copy and copy operations on this class to prevent duplication
+    TrashReclaimer(const TrashReclaimer&) = delete;
+    TrashReclaimer& operator=(const TrashReclaimer&) = delete;
+
+private:
+    struct Job {
+        std::string szPath;
+        std::promise<bool> promise;
+        std::function<void(bool, int)> fnDone;
+    };
+
+    TrashReclaimer();
+    ~TrashReclaimer();
+
+    std::string trashDirFor(const std::string& szParent, dev_t ulDev);
+    bool openTrash(const std::string& szTrashDir);
+    unsigned int recoverLocked(const std::string& szTrashDir, bool bClaimOwn);
+    bool moveToTrash(const std::string& szPath, const std::string& szTrashDir, std::string& szEntry);
+    void enqueueLocked(Job job);
+    void run();
+    bool throttle(uint64_t ulRemoved, uint64_t ulStartNs, uint64_t ulStartCpuNs);
+
+    std::mutex m_mutex;
+    std::condition_variable m_cvWork;
+    std::condition_variable m_cvDone;
+    std::deque<Job> m_jobs;
+    std::vector<std::thread> m_threads;
+    std::map<dev_t, std::string> m_trashDirs;   // trash directory per file system
+    std::set<std::string> m_opened;             // trash directories created and recovered
+    unsigned int m_nThreads;
+    std::atomic<uint64_t> m_ulMaxEntriesPerSec;
+    std::atomic<double> m_dCpuBudget;
+    std::atomic<bool> m_bStop;
+    uint64_t m_ulSeq;                           // next trash entry name
+    size_t m_ulActive;                          // entries being deleted
+};
+
+#endif // TRASHRECLAIMER_H
@@ -0,0 +1,85 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef TREEFIXTURE_H
+#define TREEFIXTURE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+enum class FixtureShape {
+    Balanced,   // every directory has iFanout sub directories, iDepth levels deep
+    Skewed,     // sub directory and file counts drawn from a power law with
+                // mean iFanout / iFiles, a few huge directories and many tiny ones
+    DeepChain,  // a single chain of iDepth directories, may exceed PATH_MAX
+    Flat,       // iFiles files and iFanout empty sub directories in the root
+};
+
+struct FixtureOptions {
+    FixtureShape eShape = FixtureShape::Balanced;
+    uint64_t ulSeed = 1;        // same seed, same tree, whatever nThreads is
+    int iFanout = 10;
+    int iDepth = 3;
+    int iFiles = 10;            // files per directory
+    double dSymlinkRatio = 0.5; // symlinks per file, each points at a sibling file
+    size_t ulFileSize = 0;      // bytes written to every file
+    unsigned int nThreads = 0;  // 0 picks std::thread::hardware_concurrency()
+};
+
+// What a fixture holds, the root directory excluded
+struct FixtureStats {
+    uint64_t ulDirs = 0;
+    uint64_t ulFiles = 0;
+    uint64_t ulSymlinks = 0;
+    uint64_t ulBytes = 0;
+
+    uint64_t getEntries() const {
+        return ulDirs + ulFiles + ulSymlinks;
+    }
+};
+
+/**
+ * @brief Build a synthetic directory tree at szPath. Every entry is created
+ *        with mkdirat / openat / symlinkat relative to its parent's fd, and
+ *        sibling subtrees, as well as chunks of a large directory, are built
+ *        in parallel on a WorkStealingPool. Names follow the TestFileIO
+ *        fixtures: dir_N, file_N and link_N.
+ *
+ * @param szPath The root of the fixture, must not exist yet. Its parent must.
+ * @param options Shape and size of the tree.
+ * @param pStats Receives the number of created entries, may be nullptr.
+ *
+ * @return true if the whole tree was created, false with errno set to the
+ *         first failure otherwise. A partial tree is left behind.
+ */
+bool CreateFixture(const std::string& szPath, const FixtureOptions& options, FixtureStats* pStats = nullptr);
+
+/**
+ * @brief A writable directory on tmpfs, so that fixtures live in memory and
+ *        benchmarks measure CPU cost instead of device I/O. Tries $TMPFS_DIR,
+ *        /dev/shm, $XDG_RUNTIME_DIR and /tmp in that order.
+ *
+ * @return The directory, or an empty string if none of them is on tmpfs.
+ */
+std::string FindTmpfsDir();
+
+// True if szPath lives on a tmpfs mount
+bool IsOnTmpfs(const std::string& szPath);
+
+#endif // TREEFIXTURE_H
@@ -0,0 +1,108 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef TRIEARENA_H
+#define TRIEARENA_H
+
+#include <cstddef>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_set>
+#include <vector>
+
+// Monotonic allocator backing PathTrieMode::Arena. Memory is only handed out,
+// never given back one by one; everything is released in one shot when the
+// arena is destroyed. Component names are interned, so a name such as
+// "file_0" is stored once no matter how many directories contain it.
+class TrieArena {
+public:
+    TrieArena();
+
+    ~TrieArena();
+
+    void* allocate(size_t ulSize, size_t ulAlign);
+
+    // Return the pooled copy of part, adding it on first use
+    const std::string* intern(std::string_view part);
+
+    // Bytes requested from the heap for blocks
+    size_t getBytesReserved() const;
+
+    // Number of distinct interned names
+    size_t getInternedCount() const;
+
+    // Disable copy and copy operations on this class to prevent duplication
+    TrieArena(const TrieArena&) = delete;
+    TrieArena& operator=(const TrieArena&) = delete;
+
+private:
+    std::vector<std::unique_ptr<char[]>> m_blocks;
+    char* m_pCursor;
+    size_t m_ulRemaining;
+    size_t m_ulNextBlockSize;
+    size_t m_ulReserved;
+    std::unordered_set<std::string> m_pool;
+};
+
+// Allocator for containers living inside arena nodes. Without an arena it
+// falls back to the global heap, so the same container type serves
+// PathTrieMode::Heap as well.
+template <typename T>
+class ArenaAllocator {
+public:
+    using value_type = T;
+
+    explicit ArenaAllocator(TrieArena* pArena = nullptr) noexcept : m_pArena(pArena) {}
+
+    template <typename U>
+    ArenaAllocator(const ArenaAllocator<U>& other) noexcept : m_pArena(other.arena()) {}
+
+    T* allocate(size_t n) {
+        if (m_pArena) {
+            return static_cast<T*>(m_pArena->allocate(n * sizeof(T), alignof(T)));
+        }
+        return static_cast<T*>(::operator new(n * sizeof(T)));
+    }
+
+    void deallocate(T* p, size_t) noexcept {
+        if (!m_pArena) {
+            ::operator delete(p);
+        }
+    }
+
+    TrieArena* arena() const noexcept {
+        return m_pArena;
+    }
+
+private:
+    TrieArena* m_pArena;
+};
+
+template <typename T, typename U>
+bool operator==(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) noexcept {
+    return lhs.arena() == rhs.arena();
+}
+
+template <typename T, typename U>
+bool operator!=(const ArenaAllocator<T>& lhs, const ArenaAllocator<U>& rhs) noexcept {
+    return !(lhs == rhs);
+}
+
+#endif // TRIEARENA_H
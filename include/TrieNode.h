@@ -19,33 +19,113 @@
 #ifndef TRIENODE_H
 #define TRIENODE_H
 
+#include <atomic>
 #include <string>
-#include <unordered_map>
+#include <string_view>
 #include <memory>
+#include <functional>
+#include <vector>
+#include "TrieArena.h"
 
 class TrieNode {
 public:
+    // Heap allocated node owning its name and its children
     TrieNode(const std::string& part);
 
     ~TrieNode();
 
+    // Node placed in arena with an interned name, released with the arena
+    static TrieNode* Create(TrieArena* arena, std::string_view part);
+
     void addChild(const std::string& part, std::unique_ptr<TrieNode> child);
 
-    TrieNode* getChild(const std::string& part) const;
+    // Link a new child owned the same way as this node, i.e. heap allocated
+    // with new or taken from the same arena
+    void addChild(TrieNode* child);
+
+    // Child whose value starts with the component part. In PathTrieMode::Radix
+    // the child may hold several components ("a/b/c").
+    TrieNode* getChild(std::string_view part) const;
+
+    size_t getChildCount() const;
+
+    void forEachChild(const std::function<void(TrieNode*)>& visit) const;
 
     const std::string& getNodeValue() const;
 
     TrieNode* getParent() const;
 
+    // Also caches the depth and the full path length of this node
     void setParent(TrieNode* parent);
 
+    // Number of path components up to the root
+    size_t getDepth() const;
+
+    // Length of getFullPath(this)
+    size_t getPathLength() const;
+
     static std::string getFullPath(const TrieNode* node);
 
+    // Write the full path into a caller supplied buffer, reusing its
+    // capacity. Runs in O(path length) and does not allocate once the buffer
+    // is large enough.
+    static void getFullPath(const TrieNode* node, std::string& path);
+
+    // Opaque payload attached by the owner of the trie, e.g. ScanDir metadata.
+    // Not owned by the node.
+    void setData(void* data);
+
+    void* getData() const;
+
     void print(const TrieNode* node = nullptr, const std::string& prefix = "") const;
 private:
-    std::unordered_map<std::string, std::unique_ptr<TrieNode>> children;
-    std::string nodeValue;
+    friend class PathTrie;
+    friend class TrieWalker;
+
+    TrieNode(TrieArena* arena, const std::string* value);
+
+    // Swap a child for a node with the same first component (edge split)
+    void replaceChild(TrieNode* existing, TrieNode* replacement);
+    void setNodeValue(std::string_view value);
+
+    // PathTrieMode::Concurrent lookup. Never blocks and is safe while another
+    // thread runs linkShared on the same node; a child published after the
+    // index was loaded may be missed.
+    TrieNode* findShared(std::string_view part) const;
+
+    // Publish a child to findShared readers. Writers of one node have to be
+    // serialized by the caller.
+    void linkShared(TrieNode* child);
+
+    // Name order of children, by the first component of their value
+    static bool compareNames(const TrieNode* lhs, const TrieNode* rhs);
+
+    // False once a hash index took over, children are in insertion order then
+    bool hasSortedChildren() const;
+
+    struct ChildIndex;
+    using ChildList = std::vector<TrieNode*, ArenaAllocator<TrieNode*>>;
+    using Slot = std::atomic<TrieNode*>;
+
+    TrieArena* getArena() const;
+    void linkChild(TrieNode* child);
+    void rebuildIndex(size_t capacity, bool bKeepOld);
+    static Slot* findSlot(const ChildIndex* table, std::string_view part);
+
+    // Up to FLAT_CHILDREN_MAX children are kept sorted by name in the flat
+    // list and binary searched. Larger sets keep insertion order and get an
+    // open addressing hash index of child pointers on top. Concurrent nodes
+    // always go through the index, starting at SHARED_INDEX_MIN slots.
+    static const size_t FLAT_CHILDREN_MAX = 16;
+    static const size_t SHARED_INDEX_MIN = 4;
+
+    const std::string* nodeValue;       // owned, or interned in the arena
     TrieNode* parent;
+    ChildList children;                 // allocator tells heap and arena nodes apart
+    std::atomic<ChildIndex*> index;     // nullptr while the flat list is enough
+    size_t depth;
+    size_t pathLength;
+    void* data;
 };
 
 #endif // TRIENODE_H
@@ -0,0 +1,107 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef TRIESNAPSHOT_H
+#define TRIESNAPSHOT_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+
+class PathTrie;
+
+// Pointer free on-disk image of a PathTrie, mapped read-only with mmap. The
+// file holds a header, the node array and a blob of node names. Nodes are
+// stored in breadth-first order, so the children of a node form one range of
+// the array, sorted by name. Nodes are addressed by their index in the array.
+//
+// Opening a snapshot only maps it; nothing is parsed or allocated, pages are
+// faulted in as lookups touch them. The file uses the byte order of the
+// machine that wrote it.
+class TrieSnapshot {
+public:
+    using NodeId = uint32_t;
+
+    static const NodeId INVALID_NODE = UINT32_MAX;
+
+    TrieSnapshot();
+
+    ~TrieSnapshot();
+
+    // Serialize pathTrie to szPath. The file is written under a temporary
+    // name and renamed into place, so readers never map a partial snapshot.
+    static bool Write(PathTrie& pathTrie, const std::string& szPath);
+
+    // Map a snapshot written by Write. Only the header is validated.
+    bool open(const std::string& szPath);
+
+    bool isOpen() const;
+
+    void close();
+
+    size_t getNodeCount() const;
+
+    NodeId getRoot() const;
+
+    // Same semantics as PathTrie::find, INVALID_NODE if the path is missing
+    NodeId find(std::string_view path) const;
+
+    // Child whose value starts with the component part
+    NodeId getChild(NodeId node, std::string_view part) const;
+
+    size_t getChildCount(NodeId node) const;
+
+    // The i-th child in name order
+    NodeId getChild(NodeId node, size_t i) const;
+
+    void forEachChild(NodeId node, const std::function<void(NodeId)>& visit) const;
+
+    // Points into the mapping, valid until close()
+    std::string_view getNodeValue(NodeId node) const;
+
+    NodeId getParent(NodeId node) const;
+
+    size_t getDepth(NodeId node) const;
+
+    size_t getPathLength(NodeId node) const;
+
+    std::string getFullPath(NodeId node) const;
+
+    // Same as TrieNode::getFullPath, reusing the capacity of path
+    void getFullPath(NodeId node, std::string& path) const;
+
+    // Disable copy and copy operations on this class to prevent duplication
+    TrieSnapshot(const TrieSnapshot&) = delete;
+    TrieSnapshot& operator=(const TrieSnapshot&) = delete;
+
+private:
+    struct Header;
+    struct Node;
+
+    const Node& getNode(NodeId node) const;
+
+    void* m_pMapping;
+    size_t m_ulMappingSize;
+    const Node* m_pNodes;
+    const char* m_pNames;
+    size_t m_ulNodeCount;
+};
+
+#endif // TRIESNAPSHOT_H
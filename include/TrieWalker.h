@@ -0,0 +1,106 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef TRIEWALKER_H
+#define TRIEWALKER_H
+
+#include <cstddef>
+#include <functional>
+#include <vector>
+
+class TrieNode;
+
+enum class TrieOrder {
+    PreOrder,       // parents before their children
+    PostOrder,      // children before their parents, e.g. to remove directories
+    BreadthFirst,   // level by level
+};
+
+// What a visitor of TrieWalker::Walk wants next
+enum class TrieVisit {
+    Continue,
+    SkipChildren,   // do not descend into this node, same as Continue in PostOrder
+    Stop,
+};
+
+// Iterative traversal of the subtree below a node, for trees of any depth.
+// Depth-first orders keep one frame per level on an explicit stack,
+// BreadthFirst keeps the current and the next level. The buffers grow with
+// the depth or width of the tree and are reused by reset, no allocation is
+// made per node.
+//
+// With bSorted children are visited by name, the same order as
+// TrieSnapshot. Otherwise they come in storage order, which is already by
+// name for nodes with up to 16 children outside PathTrieMode::Concurrent.
+//
+// The trie must not change during the walk.
+class TrieWalker {
+public:
+    TrieWalker(TrieNode* root, TrieOrder order, bool bSorted = false);
+
+    // Walk the subtree of root from the start, keeping the buffers
+    void reset(TrieNode* root);
+
+    // Next node, nullptr once the walk is done. The first node of PreOrder
+    // and BreadthFirst is the root, PostOrder returns it last.
+    TrieNode* next();
+
+    // Depth of the node last returned by next, relative to the root (0)
+    size_t getDepth() const;
+
+    // The children of the node last returned by next are not visited.
+    // Ignored in PostOrder, where they have been visited already.
+    void skipChildren();
+
+    // Visitor form of the loop over next. visit gets every node and its
+    // relative depth. Returns false if the visitor stopped the walk.
+    static bool Walk(TrieNode* root, TrieOrder order, const std::function<TrieVisit(TrieNode*, size_t)>& visit,
+                     bool bSorted = false);
+
+private:
+    // Children of pNode still to visit, [pNext, pEnd). They point into the
+    // node's own list, or into its sorted copy at offset ulSorted of
+    // m_vSorted (NOT_SORTED otherwise).
+    struct Frame {
+        TrieNode* pNode;
+        TrieNode* const* pNext;
+        TrieNode* const* pEnd;
+        size_t ulSorted;
+    };
+
+    static const size_t NOT_SORTED = static_cast<size_t>(-1);
+
+    void push(TrieNode* pNode);
+    void pop();
+    TrieNode* nextDepthFirst();
+    TrieNode* nextBreadthFirst();
+
+    TrieNode* m_pRoot;
+    TrieOrder m_eOrder;
+    bool m_bSorted;
+    TrieNode* m_pLast;                  // last node returned, expanded lazily
+    bool m_bSkip;                       // skipChildren was called for m_pLast
+    size_t m_ulDepth;
+    std::vector<Frame> m_vStack;        // depth-first orders
+    std::vector<TrieNode*> m_vSorted;   // sorted children of the frames that need a copy
+    std::vector<TrieNode*> m_vLevel;    // BreadthFirst
+    std::vector<TrieNode*> m_vNextLevel;
+    size_t m_ulPos;                     // next index into m_vLevel
+};
+
+#endif // TRIEWALKER_H
@@ -0,0 +1,76 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef WORKSTEALINGPOOL_H
+#define WORKSTEALINGPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Fixed size thread pool where every worker owns a task deque. A worker pops
+// its own newest task first (depth-first, cache friendly) and steals the
+// oldest task of another worker when its own deque runs dry.
+class WorkStealingPool {
+public:
+    // nThreads == 0 picks std::thread::hardware_concurrency()
+    explicit WorkStealingPool(unsigned int nThreads = 0);
+
+    ~WorkStealingPool();
+
+    // Tasks submitted from a worker go to that worker's deque, otherwise
+    // they are spread round-robin.
+    void submit(std::function<void()> task);
+
+    // Block until every submitted task, including tasks submitted by other
+    // tasks, has finished.
+    void wait();
+
+    unsigned int size() const;
+
+    // Disable copy and copy operations on this class to prevent duplication
+    WorkStealingPool(const WorkStealingPool&) = delete;
+    WorkStealingPool& operator=(const WorkStealingPool&) = delete;
+
+private:
+    struct Worker {
+        std::mutex mutex;
+        std::deque<std::function<void()>> tasks;
+    };
+
+    void run(unsigned int iIndex);
+    bool pop(unsigned int iIndex, std::function<void()>& task);
+    bool steal(unsigned int iIndex, std::function<void()>& task);
+
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    std::vector<std::thread> m_threads;
+    std::atomic<unsigned long> m_ulQueued;      // tasks sitting in deques
+    std::atomic<unsigned long> m_ulPending;     // tasks submitted but not finished
+    std::atomic<unsigned int> m_iNextWorker;    // round-robin cursor for external submits
+    std::mutex m_mutex;
+    std::condition_variable m_cvWork;
+    std::condition_variable m_cvDone;
+    bool m_bStop;
+};
+
+#endif // WORKSTEALINGPOOL_H
@@ -18,9 +18,43 @@
 
 
 #ifndef _FILE_UTILS_H
+#define _FILE_UTILS_H
 
 #include <string>
+#include <vector>
+#include <memory>
 #include <cerrno>
+#include <cstdint>
+#include <ctime>
+#include <functional>
+#include <future>
+#include "PathTrie.h"
+
+/**
+ * @brief Strategies available to CreateDir.
+ */
+enum class CreateDirMode {
+    StatFirst,      // stat the target, then stat and mkdir every missing prefix
+    MkdirFirst,     // mkdir the leaf first, walk back to the deepest existing
+                    // ancestor only on ENOENT
+    IoUring,        // one hard-linked batch of mkdirat per prefix plus a statx,
+                    // falls back to StatFirst without io_uring support
+    Cached,         // answer from DirCache below its watched root and mkdir only
+                    // the missing components, falls back to MkdirFirst elsewhere
+};
+
+/**
+ * @brief Traversal engines available to RemoveDir.
+ */
+enum class RemoveDirMode {
+    PathBased,      // opendir/lstat/remove on a rebuilt absolute path per entry
+    FdRelative,     // openat/fdopendir/unlinkat relative to the directory fd,
+                    // trusting d_type and calling fstatat only for DT_UNKNOWN
+    IoUring,        // FdRelative walk with statx/unlinkat submitted in batches
+                    // through io_uring, falls back to FdRelative without support
+    Streaming,      // depth-first getdents64 walk, every directory is removed as
+                    // soon as it is empty, memory grows with depth only
+};
 
 /**
  * @brief Creates a directory at the specified path. If any parent directories
@@ -32,6 +66,30 @@
  */
 bool CreateDir(const std::string& szPath);
 
+/**
+ * @brief Same as CreateDir(szPath) with an explicit strategy. The one-argument
+ *        overload uses CreateDirMode::StatFirst.
+ *
+ * @param szPath The path of the directory to be created.
+ * @param eMode The strategy to use.
+ * @return True if the directory is successfully created, false otherwise.
+ *         If an error occurs, the appropriate error number is set.
+ */
+bool CreateDir(const std::string& szPath, CreateDirMode eMode);
+
+/**
+ * @brief Creates many directories at once. Every target is inserted into a
+ *        PathTrie, so a prefix shared by several targets is created or
+ *        opened only once. Directories are created top-down with mkdirat
+ *        relative to the parent fd, sibling subtrees in parallel.
+ *
+ * @param vPaths The paths of the directories to be created.
+ * @param nThreads Number of worker threads, 0 uses every hardware thread.
+ * @return One error number per input path, 0 if that directory exists
+ *         after the call.
+ */
+std::vector<int> CreateDirs(const std::vector<std::string>& vPaths, unsigned int nThreads = 0);
+
 /**
  * @brief Removes a directory at the specified path. Deletes all files and
  *        subdirectories recursively.
@@ -44,4 +102,233 @@ bool CreateDir(const std::string& szPath);
  */
 bool RemoveDir(const std::string& szPath, bool bSaveParentPath);
 
+/**
+ * @brief Same as RemoveDir(szPath, bSaveParentPath) with an explicit
+ *        traversal engine. The two-argument overload uses
+ *        RemoveDirMode::FdRelative.
+ *
+ * @param szPath The absolute path of the directory to be removed.
+ * @param bSaveParentPath If true, the specified directory itself will be
+ *                        preserved, but its contents will be deleted.
+ * @param eMode The traversal engine to use.
+ * @return True if the directory is successfully removed, false otherwise.
+ *         If an error occurs, the appropriate error number is set.
+ */
+bool RemoveDir(const std::string& szPath, bool bSaveParentPath, RemoveDirMode eMode);
+
+/**
+ * @brief Bounded-memory variant of RemoveDir, used by RemoveDirMode::Streaming
+ *        with a cap of 64 fds. The tree is walked depth-first over getdents64
+ *        with one open directory per level, and a directory is removed as
+ *        soon as its last entry is gone. A level keeps only the entries of
+ *        its last read that are not handled yet, nothing is kept per visited
+ *        directory, so memory is O(depth) however many directories the tree
+ *        holds. Once nMaxFds levels are open, the shallowest one is
+ *        closed and reopened through ".." when the walk climbs back to it;
+ *        the reopen fails with ESTALE if that directory was moved meanwhile.
+ *        Entries that disappear during the walk are skipped.
+ *
+ * @param szPath The path of the directory to be removed.
+ * @param bSaveParentPath If true, the specified directory itself will be
+ *                        preserved, but its contents will be deleted.
+ * @param nMaxFds Most directories held open at once, at least 2.
+ * @return True if the directory is successfully removed, false otherwise.
+ *         If an error occurs, the appropriate error number is set.
+ */
+bool RemoveDirStreaming(const std::string& szPath, bool bSaveParentPath, unsigned int nMaxFds);
+
+/**
+ * @brief RemoveDirStreaming with a hook for throttling or cancelling. fnProgress
+ *        is called after every removed entry with the number removed so far,
+ *        and may sleep. Returning false stops the walk, RemoveDirStreaming then
+ *        fails with ECANCELED and leaves the rest of the tree in place.
+ */
+bool RemoveDirStreaming(const std::string& szPath, bool bSaveParentPath, unsigned int nMaxFds,
+                        const std::function<bool(uint64_t)>& fnProgress);
+
+/**
+ * @brief Asynchronous variant of RemoveDir. szPath is renamed into the trash
+ *        area of its file system and is gone when the call returns, the tree
+ *        is deleted by background threads afterwards. Trash placement, the
+ *        deletion rate and CPU budget, and the recovery of trash left by a
+ *        crashed process are handled by TrashReclaimer.
+ *
+ * @param szPath The path of the directory to be removed.
+ * @param fnDone Optional callback with the result and error number, called
+ *               from a reclaimer thread, or before returning if szPath
+ *               could not be moved to the trash.
+ * @return A future that becomes true once the tree is deleted. If szPath
+ *         could not be moved it is ready with false and errno is set.
+ */
+std::future<bool> RemoveDirAsync(const std::string& szPath, std::function<void(bool, int)> fnDone = nullptr);
+
+/**
+ * @brief Parallel variant of RemoveDir. Subtrees are spread across a
+ *        work-stealing thread pool and every directory is removed as soon
+ *        as all of its children are gone, instead of in a final pass.
+ *
+ * @param szPath The path of the directory to be removed.
+ * @param bSaveParentPath If true, the specified directory itself will be
+ *                        preserved, but its contents will be deleted.
+ * @param nThreads Number of worker threads, 0 uses every hardware thread.
+ * @return True if the directory is successfully removed, false otherwise.
+ *         If an error occurs, the appropriate error number is set.
+ */
+bool RemoveDirParallel(const std::string& szPath, bool bSaveParentPath, unsigned int nThreads);
+
+/**
+ * @brief Metadata ScanDir attaches to every node of its trie.
+ */
+struct ScanEntry {
+    uint64_t ulInode;
+    uint64_t ulSize;            // st_size
+    uint64_t ulBlocks;          // st_blocks, in 512-byte units
+    struct timespec mtime;
+    unsigned char ucType;       // DT_* value
+    // Sums over the entry itself and everything below it. Zero for a further
+    // name of an already counted hard link.
+    uint64_t ulTotalSize;
+    uint64_t ulTotalBlocks;
+    uint64_t ulTotalEntries;
+};
+
+/**
+ * @brief Tuning knobs of ScanDir.
+ */
+struct ScanDirOptions {
+    unsigned int nThreads = 0;          // 0 uses every hardware thread
+    bool bStat = true;                  // fstatat every entry for size, blocks and
+                                        // mtime, otherwise only inode and type
+                                        // from getdents64 are filled in
+    bool bOneFileSystem = false;        // do not descend into other mounts, like
+                                        // du -x. Needs bStat.
+    bool bCountLinksOnce = true;        // add the size of a hard linked inode to
+                                        // the totals only for its first name, like du
+    size_t ulBufferSize = 256 * 1024;   // getdents64 buffer of each worker thread
+};
+
+/**
+ * @brief Tree recorded by ScanDir. Every node below pRoot carries a ScanEntry.
+ */
+struct ScanDirResult {
+    ScanDirResult() : trie(PathTrieMode::Concurrent), pRoot(nullptr), iErrno(0) {}
+
+    static const ScanEntry* GetEntry(const TrieNode* pNode) {
+        return static_cast<const ScanEntry*>(pNode->getData());
+    }
+
+    PathTrie trie;
+    TrieNode* pRoot;            // node of the scanned directory
+    int iErrno;                 // first error met, unreadable parts are skipped
+    std::vector<std::unique_ptr<ScanEntry[]>> vEntryBlocks;   // one block per directory
+};
+
+/**
+ * @brief Measures a tree, like du. Directories are read with raw getdents64
+ *        into large reusable buffers and spread across a work-stealing
+ *        thread pool. Sizes are summed bottom-up as soon as a subtree is
+ *        complete. Symbolic links are not followed.
+ *
+ * @param szPath The path of the directory to be scanned.
+ * @param options Tuning knobs.
+ * @return The recorded tree, nullptr if szPath cannot be opened. Entries
+ *         that could not be read are left out and reported in iErrno.
+ *         If an error occurs, the appropriate error number is set.
+ */
+std::unique_ptr<ScanDirResult> ScanDir(const std::string& szPath,
+                                       const ScanDirOptions& options = ScanDirOptions());
+
+/**
+ * @brief Tuning knobs of CopyDir.
+ */
+struct CopyDirOptions {
+    unsigned int nThreads = 0;          // 0 uses every hardware thread
+    bool bReflink = true;               // share file extents with FICLONE where the
+                                        // file system supports it
+    bool bPreserveMode = false;         // copy permission bits as they are, like
+                                        // cp -p, instead of applying the umask
+    bool bPreserveTimes = false;        // copy atime and mtime
+    unsigned int nBatchFiles = 64;      // files of one directory handed to one task,
+                                        // larger directories use several threads
+};
+
+/**
+ * @brief What CopyDir copied, and how the file data moved.
+ */
+struct CopyDirStats {
+    uint64_t ulDirs = 0;                // below the copied directory
+    uint64_t ulFiles = 0;
+    uint64_t ulSymlinks = 0;
+    uint64_t ulSpecial = 0;             // fifos, sockets and device nodes
+    uint64_t ulBytes = 0;
+    uint64_t ulCloned = 0;              // files shared with FICLONE
+    uint64_t ulCopyRange = 0;           // files copied with copy_file_range
+    uint64_t ulSendfile = 0;            // files copied with sendfile
+};
+
+/**
+ * @brief Copies a tree, like cp -r. Directories are listed with getdents64
+ *        and recreated with mkdirat, every call is relative to the fds of
+ *        the source and the copy. Subtrees and batches of files are spread
+ *        across a work-stealing thread pool. File data never passes
+ *        through user space: FICLONE shares the extents on file systems
+ *        with reflinks, otherwise copy_file_range, or sendfile where that
+ *        is not supported, copies it in the kernel. Symbolic links are
+ *        recreated, not followed. Hard links are copied as separate files.
+ *
+ * @param szSrc The directory to be copied.
+ * @param szDst The path of the copy, it must not exist yet.
+ * @param options Tuning knobs.
+ * @param pStats Optional, receives the counts.
+ * @return True if everything was copied, false otherwise. The copy goes on
+ *         past entries that fail, the first error is reported in errno.
+ */
+bool CopyDir(const std::string& szSrc, const std::string& szDst,
+             const CopyDirOptions& options = CopyDirOptions(), CopyDirStats* pStats = nullptr);
+
+/**
+ * @brief Order in which PruneDir evicts files.
+ */
+enum class PrunePolicy {
+    LeastRecentlyUsed,          // oldest atime first, needs a mount without noatime
+    OldestModified,             // oldest mtime first
+    LargestFirst,               // most allocated bytes first
+};
+
+/**
+ * @brief What PruneDir found and removed, and the time of every phase.
+ */
+struct PruneDirStats {
+    uint64_t ulScannedBytes = 0;        // usage of the tree before pruning
+    uint64_t ulReclaimedBytes = 0;
+    uint64_t ulRemovedFiles = 0;        // files and symbolic links
+    uint64_t ulRemovedDirs = 0;         // directories emptied by the pruning
+    unsigned int nPasses = 0;
+    uint64_t ulScanNs = 0;              // traversal and candidate heap
+    uint64_t ulSelectNs = 0;            // ordering of the victims
+    uint64_t ulRemoveNs = 0;            // unlinkat of victims and emptied directories
+};
+
+/**
+ * @brief Shrinks a cache directory to a size budget. One traversal sums the
+ *        allocated bytes (st_blocks, like du) of the tree and keeps the
+ *        ulMaxCandidates files most eligible under ePolicy in a bounded
+ *        heap. Victims are then taken from the heap until the usage fits
+ *        ulTargetBytes, and removed directory by directory with unlinkat
+ *        relative to their parent. Directories that become empty are
+ *        removed as well, szPath itself is kept. Only if the heap ran short
+ *        of victims is the tree traversed again.
+ *
+ * @param szPath The cache directory.
+ * @param ulTargetBytes Usage to shrink the tree to.
+ * @param ePolicy Order of eviction.
+ * @param pStats Optional, receives the reclaimed bytes and phase times.
+ * @param ulMaxCandidates Most candidates kept per traversal.
+ * @return True if the usage fits ulTargetBytes, false otherwise. Entries
+ *         that disappear meanwhile are skipped, on other errors the first
+ *         one is reported in errno. ENOSPC means nothing is left to evict.
+ */
+bool PruneDir(const std::string& szPath, uint64_t ulTargetBytes, PrunePolicy ePolicy,
+              PruneDirStats* pStats = nullptr, size_t ulMaxCandidates = 1 << 20);
+
 #endif // !_FILE_UTILS_H
@@ -0,0 +1,132 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+#ifndef SYSCALL_STATS_H
+#define SYSCALL_STATS_H
+
+#include <atomic>
+#include <iomanip>
+#include <iostream>
+
+// File system calls issued by file_utils. Calls hidden inside libc (e.g. the
+// getdents64 behind readdir) are not counted, only direct getdents64 calls.
+enum class SyscallType : int {
+    Stat = 0,
+    Lstat,
+    Fstatat,
+    Mkdir,
+    Mkdirat,
+    Open,
+    Openat,
+    Opendir,
+    Unlink,
+    Unlinkat,
+    Remove,
+    Rmdir,
+    Symlink,
+    IoUringEnter,
+    Getdents,
+    Fstat,
+    Clone,
+    CopyFileRange,
+    Sendfile,
+    Readlink,
+    Count
+};
+
+class SyscallStats {
+public:
+    // One process-wide counter table
+    static SyscallStats& Instance() {
+        static SyscallStats stats;
+        return stats;
+    }
+
+    void add(SyscallType eType) {
+        m_counters[static_cast<int>(eType)].fetch_add(1, std::memory_order_relaxed);
+        ThreadCounters()[static_cast<int>(eType)]++;
+    }
+
+    // Calls issued by the calling thread since it started, never reset.
+    // Per-call tallies are differences of two snapshots, see PerfCounters.h.
+    static unsigned long* ThreadCounters() {
+        thread_local unsigned long counters[static_cast<int>(SyscallType::Count)] = {};
+        return counters;
+    }
+
+    unsigned long get(SyscallType eType) const {
+        return m_counters[static_cast<int>(eType)].load(std::memory_order_relaxed);
+    }
+
+    unsigned long total() const {
+        unsigned long ulTotal = 0;
+        for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+            ulTotal += m_counters[i].load(std::memory_order_relaxed);
+        }
+        return ulTotal;
+    }
+
+    void reset() {
+        for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+            m_counters[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    // Print every non-zero counter followed by the total
+    void print(std::ostream& os) const {
+        for (int i = 0; i < static_cast<int>(SyscallType::Count); ++i) {
+            unsigned long ulCount = m_counters[i].load(std::memory_order_relaxed);
+            if (ulCount != 0) {
+                os << "    " << std::left << std::setw(10) << name(static_cast<SyscallType>(i))
+                   << std::right << ulCount << std::endl;
+            }
+        }
+        os << "    " << std::left << std::setw(10) << "total" << std::right << total() << std::endl;
+    }
+
+    static const char* name(SyscallType eType) {
+        static const char* names[] = {
+            "stat", "lstat", "fstatat", "mkdir", "mkdirat", "open", "openat",
+            "opendir", "unlink", "unlinkat", "remove", "rmdir", "symlink",
+            "io_uring", "getdents", "fstat", "ficlone", "copy_range", "sendfile",
+            "readlink"
+        };
+        return names[static_cast<int>(eType)];
+    }
+
+    // Disable copy and copy operations on this class to prevent duplication
+    SyscallStats(const SyscallStats&) = delete;
+    SyscallStats& operator=(const SyscallStats&) = delete;
+
+private:
+    SyscallStats() {
+        reset();
+    }
+
+    std::atomic<unsigned long> m_counters[static_cast<int>(SyscallType::Count)];
+};
+
+#ifdef SYSCALL_STATS_ENABLE
+#define SYSCALL_COUNT(type) \
+  SyscallStats::Instance().add(SyscallType::type)
+#else
+// If syscall statistics are disabled, define empty macros
+#define SYSCALL_COUNT(type)
+#endif
+
+#endif // SYSCALL_STATS_H
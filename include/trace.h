@@ -16,25 +16,28 @@
  * 
  */
 
+#ifndef TRACE_H
+#define TRACE_H
+
 #include <iostream>
 #include <string>
 #include <chrono>
+#include <atomic>
+#include <cstdint>
 #include <unistd.h>
 #include <fcntl.h>
-#include <unistd.h>
 #include <vector>
 #include <algorithm>
 
 #define TRACE_MARKER                "/sys/kernel/debug/tracing/trace_marker"
+#define TRACE_TOGGLE_SIGNAL         SIGUSR1     // flips tracing on and off
 
+// ftrace backend, one trace_marker write per begin and end event
 class Trace {
   public:
-    explicit Trace() : m_iTraceMarkerFd(-1), m_iPid(getpid()) {
-      // Open trace_marker file for reporting trace event
-      m_iTraceMarkerFd = open(TRACE_MARKER, O_WRONLY);
-      if (m_iTraceMarkerFd < 0) {
-        throw std::runtime_error("Failed to open trace_marker");
-      }
+    static Trace& Instance() {
+      static Trace trace;
+      return trace;
     }
 
     ~Trace() {
@@ -45,77 +48,158 @@ class Trace {
     }
 
     // Start recording
-    void begin(const std::string& szEventName, pid_t iTid) {
-      return begin(szEventName, iTid, getTimeStampUs());
+    void begin(const char* szEventName, pid_t iTid) {
+      if (m_iTraceMarkerFd >= 0) {
+        dprintf(m_iTraceMarkerFd, "B|%d|%d|%s|%lu\n", m_iPid, iTid, szEventName, getTimeStampUs());
+      }
     }
 
     // End recording
-    void end(const std::string& szEventName, pid_t iTid) {
-      return end(szEventName, iTid, getTimeStampUs());
+    void end(const char* szEventName, pid_t iTid) {
+      if (m_iTraceMarkerFd >= 0) {
+        dprintf(m_iTraceMarkerFd, "E|%d|%d|%s|%lu\n", m_iPid, iTid, szEventName, getTimeStampUs());
+      }
     }
 
     // Disable copy and copy operations on this class to prevent duplication
     Trace(const Trace&) = delete;
     Trace& operator=(const Trace&) = delete;
 
-    // Nested ScopeGuard class to trigger trace events
-    class ScopeGuard {
-      private:
-        Trace& trace;
-        std::string szEventName;
-        pid_t m_iTid;
-
-      public:
-        ScopeGuard(Trace& trace, const std::string& szEventName)
-          : trace(trace), szEventName(szEventName), m_iTid(gettid()) {
-            trace.begin(szEventName, m_iTid, trace.getTimeStampUs());
-          }
-
-        ~ScopeGuard() {
-          trace.end(szEventName, m_iTid, trace.getTimeStampUs());
-        }
-    };
   private:
     int m_iTraceMarkerFd;               // fd to /sys/kernel/debug/tracing/trace_marker
     pid_t m_iPid;                       // process ID
 
+    Trace() : m_iTraceMarkerFd(-1), m_iPid(getpid()) {
+      // Open trace_marker file for reporting trace event. Without root or
+      // debugfs the events are dropped instead of failing the process.
+      m_iTraceMarkerFd = open(TRACE_MARKER, O_WRONLY | O_CLOEXEC);
+      if (m_iTraceMarkerFd < 0) {
+        std::cerr << "Trace: Failed to open " << TRACE_MARKER << ", ftrace events are dropped" << std::endl;
+      }
+    }
+
     // inline function to acquire timestamp
     unsigned long getTimeStampUs() const {
       auto now = std::chrono::high_resolution_clock::now();
       auto duration = now.time_since_epoch();
       return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
     }
+};
 
-    // Start recording
-    void begin(const std::string& szEventName, pid_t iTid, unsigned long timestamp) {
-      if (m_iTraceMarkerFd >= 0) {
-        dprintf(m_iTraceMarkerFd, "B|%d|%d|%s|%lu\n", m_iPid, iTid, szEventName.c_str(), timestamp);
-      }
-    }
+enum class TraceBackend : int {
+    Ftrace,     // trace_marker, needs root and debugfs
+    Ring,       // per-thread ring buffers written as Chrome JSON, see TraceRing.h
+    Stats,      // per-site latency histograms, see TraceStats.h
+    Perf,       // per-site perf_event and syscall counters, see PerfCounters.h
+};
 
-    // End recording
-    void end(const std::string& szEventName, pid_t iTid, unsigned long timestamp) {
-      if (m_iTraceMarkerFd >= 0) {
-        dprintf(m_iTraceMarkerFd, "E|%d|%d|%s|%lu\n", m_iPid, iTid, szEventName.c_str(), timestamp);
-      }
+// Static state of one TRACE_FUNCTION, TRACE_B or TRACE_E site. Constant
+// initialized, so the site costs no guard variable and nothing runs until
+// tracing is enabled.
+struct TraceSite {
+    constexpr explicit TraceSite(const char* szName)
+      : szName(szName), uRate(0), uCalls(0), iStatsId(-1) {}
+
+    const char* szName;
+    std::atomic<uint32_t> uRate;        // record 1 of uRate calls, 0 until resolved
+    std::atomic<uint32_t> uCalls;
+    std::atomic<int> iStatsId;          // TraceStats site, -1 until first use
+};
+
+// The process-wide tracer. Tracing is compiled in and switched at runtime:
+//   TRACE=1|ftrace|ring|stats|perf   enable at startup, 1 picks the default backend
+//   TRACE_SAMPLE=CreateDir=100,...   record only 1 of N events of that name
+//   TRACE_SIGNAL=1, then kill -USR1  toggle, also Tracer::InstallToggleSignal
+//   Tracer::Enable / Disable         API
+// While disabled a trace point costs a single load and branch.
+class Tracer {
+  public:
+    static bool IsEnabled() {
+      return s_bEnabled.load(std::memory_order_relaxed);
     }
+
+    static void Enable(TraceBackend eBackend);
+
+    // Enable with the backend chosen by $TRACE or at build time
+    static void Enable();
+
+    static void Disable();
+
+    // Backend of the next Enable(), does not enable tracing by itself
+    static void SetBackend(TraceBackend eBackend);
+
+    // Toggle tracing on TRACE_TOGGLE_SIGNAL. Only installed on request, and
+    // false without installing if the application handles the signal already.
+    static bool InstallToggleSignal();
+
+    static TraceBackend GetBackend();
+
+    // Record 1 of uRate events called szName, 1 records every event
+    static void SetSampling(const std::string& szName, uint32_t uRate);
+
+    // Only called while enabled
+    static void Begin(TraceSite& site);
+
+    static void End(TraceSite& site);
+
+    // Records the enclosing scope. While disabled only the constructor tests
+    // the flag, the destructor tests the guard's own member.
+    class ScopeGuard {
+      public:
+        explicit ScopeGuard(TraceSite& site) : m_pSite(nullptr) {
+          if (__builtin_expect(IsEnabled(), 0)) {
+            start(site);
+          }
+        }
+
+        ~ScopeGuard() {
+          if (__builtin_expect(m_pSite != nullptr, 0)) {
+            finish();
+          }
+        }
+
+        ScopeGuard(const ScopeGuard&) = delete;
+        ScopeGuard& operator=(const ScopeGuard&) = delete;
+
+      private:
+        void start(TraceSite& site);
+        void finish();
+
+        TraceSite* m_pSite;             // set only if this call is recorded
+        TraceBackend m_eBackend;
+        uint64_t m_ulStartNs;
+    };
+
+  private:
+    friend class ScopeGuard;
+
+    static bool Sample(TraceSite& site);
+
+    static std::atomic<bool> s_bEnabled;
+    static std::atomic<int> s_iBackend;
 };
 
 #ifdef TRACE_ENABLE
-// Each file includes trace.h will have its own trace instance
-static Trace trace;
 // Macro to declare Trace::ScopeGuard instance
 #define TRACE_FUNCTION() \
-  Trace::ScopeGuard trace_guard(trace, __FUNCTION__);
+  static TraceSite trace_site(__FUNCTION__); \
+  Tracer::ScopeGuard trace_guard(trace_site);
 
+// The site keeps the first name it sees, so event names have to be string
+// literals. Pasting "" around the argument rejects anything else at compile time.
 #define TRACE_B(sz_trace_event) \
-  trace.begin(sz_trace_event, gettid())
+  do { static TraceSite trace_site("" sz_trace_event ""); \
+       if (Tracer::IsEnabled()) Tracer::Begin(trace_site); } while (0)
 
 #define TRACE_E(sz_trace_event) \
-  trace.end(sz_trace_event, gettid())
+  do { static TraceSite trace_site("" sz_trace_event ""); \
+       if (Tracer::IsEnabled()) Tracer::End(trace_site); } while (0)
 #else
-// If tracing is disabled, define empty macros
+// If tracing is compiled out, define empty macros. TRACE_B/TRACE_E still
+// only take literals, so code builds the same way either way.
 #define TRACE_FUNCTION()
-#define TRACE_B(sz_trace_event)
-#define TRACE_E(sz_trace_event)
+#define TRACE_B(sz_trace_event) do { static_cast<void>("" sz_trace_event ""); } while (0)
+#define TRACE_E(sz_trace_event) do { static_cast<void>("" sz_trace_event ""); } while (0)
 #endif
+
+#endif // TRACE_H
@@ -1,19 +1,60 @@
 #include <iostream>
 #include <fstream>
+#include <iterator>
 #include <string>
 #include <unistd.h>
+#include <sys/stat.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <dirent.h>
 #include <cstdlib>
 #include <limits.h>
 #include <cstring>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <mutex>
+#include <unordered_map>
 #include "file_utils.h"
+#include "PathTrie.h"
+#include "TrieSnapshot.h"
+#include "PerfCounters.h"
+#include "TreeFixture.h"
+#include "TrashReclaimer.h"
+#include "DirCache.h"
+#include "syscall_stats.h"
+#include "trace.h"
+#include "TraceRing.h"
 
 #define TEST_ENTRIES_NUM        500
+#define TEST_CREATE_DEPTH       12
+
+// Number of checks that came out inconsistent, main() fails if any did
+static unsigned int s_nInconsistent = 0;
+
+// Suffix for a result line, counts the check if it failed
+static const char* CheckResult(bool bConsistent) {
+    if (!bConsistent) {
+        ++s_nInconsistent;
+        return ", inconsistent result";
+    }
+    return "";
+}
+
+// Print and reset the syscall counters collected since the last call
+void ReportSyscallStats() {
+#ifdef SYSCALL_STATS_ENABLE
+    SyscallStats::Instance().print(std::cout);
+    SyscallStats::Instance().reset();
+#endif
+}
 
 // Create TEST_ENTRIES_NUM different folders
-void TestCreateDir() {
+void TestCreateDir(CreateDirMode eMode) {
     for (int i = 0; i < TEST_ENTRIES_NUM; ++i) {
         std::string szDirPath = "test_dir_" + std::to_string(i);
-        if (!CreateDir(szDirPath)) {
+        if (!CreateDir(szDirPath, eMode)) {
             std::cerr << "Failed to create directory: " << szDirPath << std::endl;
         }
     }
@@ -47,12 +88,18 @@ void CreateFilesAndLinks(const std::string& szDirPath, int iNumFiles, int iNumDi
     return;
 }
 
-// Test RemoveDir function to delete directory
-void TestRemoveDir() {
+// Populate every test folder for TestRemoveDir
+void PrepareRemoveDir() {
     for (int i = 0; i < TEST_ENTRIES_NUM; ++i) {
         std::string szDirPath = "test_dir_" + std::to_string(i);
-
         CreateFilesAndLinks(szDirPath, 10, 5, 5);
+    }
+}
+
+// Test RemoveDir function to delete directory
+void TestRemoveDir(RemoveDirMode eMode) {
+    for (int i = 0; i < TEST_ENTRIES_NUM; ++i) {
+        std::string szDirPath = "test_dir_" + std::to_string(i);
 
         char absPath[PATH_MAX];
         if (realpath(szDirPath.c_str(), absPath) == nullptr) {
@@ -63,20 +110,1288 @@ void TestRemoveDir() {
 
         std::string absoluteDirPath = absPath;
 
-        if (!RemoveDir(absoluteDirPath, false)) {
+        if (!RemoveDir(absoluteDirPath, false, eMode)) {
             std::cerr << "Failed to remove directory: " << absoluteDirPath << std::endl;
         }
     }
 }
 
+// Run one CreateDir workload and print its elapsed time (and syscalls)
+void RunCreateDirWorkload(const char* szWorkload, const std::vector<std::string>& vPaths, CreateDirMode eMode) {
+#ifdef SYSCALL_STATS_ENABLE
+    SyscallStats::Instance().reset();
+#endif
+    auto start = std::chrono::steady_clock::now();
+    for (const auto& szPath : vPaths) {
+        if (!CreateDir(szPath, eMode)) {
+            std::cerr << "Failed to create directory: " << szPath << std::endl;
+        }
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "  " << szWorkload << ", elapsed: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+              << " us" << std::endl;
+    ReportSyscallStats();
+}
+
+// Compare CreateDir modes on depth TEST_CREATE_DEPTH paths where only the
+// leaf is missing, where the whole chain is missing, and where nothing is
+void TestCreateDirWorkloads(const char* szName, CreateDirMode eMode) {
+    const std::string szRootPath = "test_create";
+    std::string szParent = szRootPath;
+    for (int i = 1; i < TEST_CREATE_DEPTH - 1; ++i) {
+        szParent += "/d" + std::to_string(i);
+    }
+    CreateDir(szParent);
+
+    std::vector<std::string> vShallow;
+    std::vector<std::string> vDeep;
+    for (int i = 0; i < TEST_ENTRIES_NUM; ++i) {
+        vShallow.push_back(szParent + "/leaf_" + std::to_string(i));
+        std::string szDeep = szRootPath + "/deep_" + std::to_string(i);
+        for (int j = 2; j < TEST_CREATE_DEPTH; ++j) {
+            szDeep += "/d" + std::to_string(j);
+        }
+        vDeep.push_back(szDeep);
+    }
+
+    std::cout << "Testing CreateDir workloads (" << szName << ")..." << std::endl;
+    RunCreateDirWorkload("shallow-miss", vShallow, eMode);
+    RunCreateDirWorkload("deep-miss", vDeep, eMode);
+    RunCreateDirWorkload("already-exists", vShallow, eMode);
+
+    char absPath[PATH_MAX];
+    if (realpath(szRootPath.c_str(), absPath) == nullptr || !RemoveDir(absPath, false)) {
+        std::cerr << "Failed to remove directory: " << szRootPath << std::endl;
+    }
+#ifdef SYSCALL_STATS_ENABLE
+    SyscallStats::Instance().reset();
+#endif
+}
+
+// Create the folders of TestCreateDir and PrepareRemoveDir with one CreateDirs call
+void TestCreateDirs() {
+    std::vector<std::string> vPaths;
+    for (int i = 0; i < TEST_ENTRIES_NUM; ++i) {
+        std::string szDirPath = "test_dir_" + std::to_string(i);
+        vPaths.push_back(szDirPath);
+        for (int j = 0; j < 5; ++j) {
+            vPaths.push_back(szDirPath + "/dir_" + std::to_string(j));
+        }
+    }
+
+    std::vector<int> vResults = CreateDirs(vPaths);
+    long lFailed = std::count_if(vResults.begin(), vResults.end(), [](int iErr) { return iErr != 0; });
+    if (lFailed != 0) {
+        std::cerr << "Failed to create " << lFailed << " directories" << std::endl;
+    }
+}
+
+// Average nanoseconds per operation of fn, which runs ulOps operations
+template <typename Fn>
+double MeasureNs(size_t ulOps, Fn fn) {
+    auto start = std::chrono::steady_clock::now();
+    fn();
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    return std::chrono::duration<double, std::nano>(elapsed).count() / ulOps;
+}
+
+// Microbenchmark PathTrie insert/find/getFullPath on one set of paths
+void RunPathTrieBenchmark(const char* szShape, const std::vector<std::string>& vPaths) {
+    PathTrie pathTrie(PathTrieMode::Arena);
+    std::vector<TrieNode*> vNodes;
+    vNodes.reserve(vPaths.size());
+    size_t ulSink = 0;
+
+    double dInsert = MeasureNs(vPaths.size(), [&] {
+        for (const auto& szPath : vPaths) {
+            vNodes.push_back(pathTrie.insert(szPath));
+        }
+    });
+    double dFind = MeasureNs(vPaths.size(), [&] {
+        for (const auto& szPath : vPaths) {
+            ulSink += pathTrie.find(szPath) != nullptr;
+        }
+    });
+    double dFullPath = MeasureNs(vNodes.size(), [&] {
+        for (const TrieNode* pNode : vNodes) {
+            ulSink += TrieNode::getFullPath(pNode).size();
+        }
+    });
+    std::string szBuffer;
+    double dFullPathBuffer = MeasureNs(vNodes.size(), [&] {
+        for (const TrieNode* pNode : vNodes) {
+            TrieNode::getFullPath(pNode, szBuffer);
+            ulSink += szBuffer.size();
+        }
+    });
+
+    std::cout << "  " << szShape << ": insert " << dInsert << " ns, find " << dFind
+              << " ns, getFullPath " << dFullPath << " ns, getFullPath(buffer) "
+              << dFullPathBuffer << " ns" << (ulSink == 0 ? " (empty)" : "") << std::endl;
+}
+
+// PathTrie microbenchmarks on deep (depth 64 and 256) and wide tries
+void TestPathTrie() {
+    std::cout << "Testing PathTrie..." << std::endl;
+    for (int iDepth : { 64, 256 }) {
+        std::string szParent;
+        for (int i = 1; i < iDepth; ++i) {
+            szParent += "/dir_" + std::to_string(i);
+        }
+        std::vector<std::string> vPaths;
+        for (int i = 0; i < 1000; ++i) {
+            vPaths.push_back(szParent + "/leaf_" + std::to_string(i));
+        }
+        RunPathTrieBenchmark(iDepth == 64 ? "deep-64" : "deep-256", vPaths);
+    }
+
+    std::vector<std::string> vPaths;
+    for (int i = 0; i < 100000; ++i) {
+        vPaths.push_back("/wide/entry_" + std::to_string(i));
+    }
+    RunPathTrieBenchmark("wide-100000", vPaths);
+
+    // Build output layout: long single child chains ending in a few leaves
+    vPaths.clear();
+    for (int i = 0; i < 2000; ++i) {
+        std::string szChain = "/build/out_" + std::to_string(i);
+        for (int j = 0; j < 10; ++j) {
+            szChain += "/obj/x86_64/release/gen";
+        }
+        for (int k = 0; k < 3; ++k) {
+            vPaths.push_back(szChain + "/leaf_" + std::to_string(k));
+        }
+    }
+    PathTrie arenaTrie(PathTrieMode::Arena);
+    PathTrie radixTrie(PathTrieMode::Radix);
+    for (const auto& szPath : vPaths) {
+        arenaTrie.insert(szPath);
+        radixTrie.insert(szPath);
+    }
+    std::cout << "  deep-chain nodes: Arena " << arenaTrie.getNodeCount()
+              << ", Radix " << radixTrie.getNodeCount() << std::endl;
+}
+
+// Every thread inserts the whole path set into one trie, each starting at a
+// different offset so the threads overlap on every node. With bLocked the
+// threads share a Heap trie behind one mutex instead.
+void RunConcurrentPathTrie(const std::vector<std::string>& vPaths, unsigned int nThreads,
+                           bool bLocked, size_t ulExpectedNodes) {
+    PathTrie pathTrie(bLocked ? PathTrieMode::Heap : PathTrieMode::Concurrent);
+    std::mutex trieMutex;
+    std::vector<std::vector<TrieNode*>> vNodes(nThreads, std::vector<TrieNode*>(vPaths.size()));
+    std::vector<std::vector<char>> vInserted(nThreads, std::vector<char>(vPaths.size()));
+
+    auto start = std::chrono::steady_clock::now();
+    std::vector<std::thread> vWorkers;
+    for (unsigned int t = 0; t < nThreads; ++t) {
+        vWorkers.emplace_back([&, t] {
+            size_t ulOffset = vPaths.size() * t / nThreads;
+            for (size_t i = 0; i < vPaths.size(); ++i) {
+                size_t ulIndex = (ulOffset + i) % vPaths.size();
+                bool bInserted = false;
+                if (bLocked) {
+                    std::lock_guard<std::mutex> lock(trieMutex);
+                    vNodes[t][ulIndex] = pathTrie.insert(vPaths[ulIndex], &bInserted);
+                } else {
+                    vNodes[t][ulIndex] = pathTrie.insert(vPaths[ulIndex], &bInserted);
+                }
+                vInserted[t][ulIndex] = bInserted;
+            }
+        });
+    }
+    for (auto& worker : vWorkers) {
+        worker.join();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    // Every thread has to get the same node, exactly one of them created it
+    size_t ulErrors = pathTrie.getNodeCount() != ulExpectedNodes;
+    for (size_t i = 0; i < vPaths.size(); ++i) {
+        TrieNode* pNode = vNodes[0][i];
+        int iInserted = 0;
+        for (unsigned int t = 0; t < nThreads; ++t) {
+            ulErrors += vNodes[t][i] != pNode;
+            iInserted += vInserted[t][i];
+        }
+        ulErrors += iInserted != 1 || pathTrie.find(vPaths[i]) != pNode ||
+                    TrieNode::getFullPath(pNode) != vPaths[i];
+    }
+
+    double dSeconds = std::chrono::duration<double>(elapsed).count();
+    std::cout << "    " << (bLocked ? "mutex" : "concurrent") << ", threads: " << nThreads
+              << ", " << static_cast<size_t>(vPaths.size() * nThreads / dSeconds) << " inserts/s";
+    if (ulErrors != 0) {
+        std::cout << ", " << ulErrors << " errors";
+    }
+    std::cout << std::endl;
+}
+
+// 100 x 50 x 20 file paths below /scan
+std::vector<std::string> MakeScanPaths() {
+    std::vector<std::string> vPaths;
+    for (int i = 0; i < 100; ++i) {
+        for (int j = 0; j < 50; ++j) {
+            for (int k = 0; k < 20; ++k) {
+                vPaths.push_back("/scan/dir_" + std::to_string(i) + "/sub_" + std::to_string(j) +
+                                 "/file_" + std::to_string(k));
+            }
+        }
+    }
+    return vPaths;
+}
+
+// Stress PathTrieMode::Concurrent with 1..nMaxThreads threads inserting
+// overlapping path sets, next to a mutex protected Heap trie
+void TestConcurrentPathTrie(const std::vector<unsigned int>& vThreads) {
+    std::cout << "Testing concurrent PathTrie..." << std::endl;
+    std::vector<std::string> vPaths = MakeScanPaths();
+    PathTrie expected;
+    for (const auto& szPath : vPaths) {
+        expected.insert(szPath);
+    }
+
+    for (unsigned int nThreads : vThreads) {
+        RunConcurrentPathTrie(vPaths, nThreads, false, expected.getNodeCount());
+    }
+    RunConcurrentPathTrie(vPaths, vThreads.back(), true, expected.getNodeCount());
+}
+
+// Walk pathTrie in every order, plain and sorted, and count the nodes that
+// are missing, visited twice or out of order
+size_t CheckTrieWalk(PathTrie& pathTrie) {
+    size_t ulErrors = 0;
+    for (TrieOrder eOrder : { TrieOrder::PreOrder, TrieOrder::PostOrder, TrieOrder::BreadthFirst }) {
+        for (bool bSorted : { false, true }) {
+            std::unordered_map<const TrieNode*, size_t> mapDepths;
+            std::unordered_map<const TrieNode*, std::string_view> mapLastChild;
+            size_t ulLastDepth = 0;
+            TrieWalker walker(pathTrie.GetRoot(), eOrder, bSorted);
+            while (TrieNode* pNode = walker.next()) {
+                size_t ulDepth = walker.getDepth();
+                ulErrors += !mapDepths.emplace(pNode, ulDepth).second;
+                const TrieNode* pParent = pNode->getParent();
+                if (eOrder == TrieOrder::PostOrder) {
+                    // Every child is done before its parent
+                    pNode->forEachChild([&](TrieNode* pChild) {
+                        auto it = mapDepths.find(pChild);
+                        ulErrors += it == mapDepths.end() || it->second != ulDepth + 1;
+                    });
+                } else if (pParent != nullptr && pNode != pathTrie.GetRoot()) {
+                    auto it = mapDepths.find(pParent);
+                    ulErrors += it == mapDepths.end() || it->second + 1 != ulDepth;
+                }
+                ulErrors += eOrder == TrieOrder::BreadthFirst && ulDepth < ulLastDepth;
+                ulLastDepth = ulDepth;
+                if (bSorted && pParent != nullptr) {
+                    std::string_view name = pNode->getNodeValue();
+                    name = name.substr(0, name.find('/'));
+                    auto it = mapLastChild.find(pParent);
+                    ulErrors += it != mapLastChild.end() && !(it->second < name);
+                    mapLastChild[pParent] = name;
+                }
+            }
+            ulErrors += mapDepths.size() != pathTrie.getNodeCount();
+        }
+    }
+
+    // Only the root and its children once their subtrees are skipped
+    size_t ulVisited = 0;
+    pathTrie.walk(TrieOrder::PreOrder, [&ulVisited](TrieNode*, size_t ulDepth) {
+        ++ulVisited;
+        return ulDepth == 1 ? TrieVisit::SkipChildren : TrieVisit::Continue;
+    });
+    ulErrors += ulVisited != 1 + pathTrie.GetRoot()->getChildCount();
+    return ulErrors;
+}
+
+// Correctness of TrieWalker in every PathTrieMode and on a chain far deeper
+// than the recursive print handles, then walk throughput on a balanced trie
+// of fanout 10 and iDepth levels
+void TestTrieWalker(int iDepth) {
+    std::cout << "Testing TrieWalker..." << std::endl;
+    std::vector<std::string> vPaths = MakeScanPaths();
+    for (PathTrieMode eMode : { PathTrieMode::Heap, PathTrieMode::Arena, PathTrieMode::Radix,
+                                PathTrieMode::Concurrent }) {
+        PathTrie pathTrie(eMode);
+        for (const auto& szPath : vPaths) {
+            pathTrie.insert(szPath);
+        }
+        size_t ulErrors = CheckTrieWalk(pathTrie);
+        if (ulErrors != 0) {
+            std::cout << "  mode " << static_cast<int>(eMode) << ": " << ulErrors << " errors" << std::endl;
+        }
+    }
+
+    PathTrie chainTrie(PathTrieMode::Arena);
+    TrieNode* pNode = chainTrie.GetRoot();
+    for (int i = 0; i < 1000000; ++i) {
+        pNode = chainTrie.insertChild(pNode, "d");
+    }
+    size_t ulMaxDepth = 0;
+    chainTrie.walk(TrieOrder::PostOrder, [&ulMaxDepth](TrieNode*, size_t ulDepth) {
+        ulMaxDepth = std::max(ulMaxDepth, ulDepth);
+        return TrieVisit::Continue;
+    });
+    std::cout << "  chain of depth " << ulMaxDepth << ": " << CheckTrieWalk(chainTrie) << " errors" << std::endl;
+
+    PathTrie pathTrie(PathTrieMode::Arena);
+    std::vector<TrieNode*> vLevel(1, pathTrie.GetRoot());
+    std::vector<TrieNode*> vNext;
+    for (int iLevel = 0; iLevel < iDepth; ++iLevel) {
+        vNext.clear();
+        for (TrieNode* pParent : vLevel) {
+            for (int i = 0; i < 10; ++i) {
+                vNext.push_back(pathTrie.insertChild(pParent, "dir_" + std::to_string(i)));
+            }
+        }
+        vLevel.swap(vNext);
+    }
+    size_t ulNodes = pathTrie.getNodeCount();
+    size_t ulSink = 0;
+
+    // What callers did before: recursion through forEachChild
+    std::function<void(TrieNode*)> recurse = [&](TrieNode* pParent) {
+        ulSink += pParent->getDepth();
+        pParent->forEachChild(recurse);
+    };
+    double dRecursive = MeasureNs(ulNodes, [&] { recurse(pathTrie.GetRoot()); });
+    std::cout << "  " << ulNodes << " nodes, ns per node: forEachChild recursion " << dRecursive;
+    const struct {
+        const char* szName;
+        TrieOrder eOrder;
+        bool bSorted;
+    } walks[] = {
+        { "pre-order", TrieOrder::PreOrder, false },
+        { "post-order", TrieOrder::PostOrder, false },
+        { "BFS", TrieOrder::BreadthFirst, false },
+        { "sorted pre-order", TrieOrder::PreOrder, true },
+    };
+    for (const auto& walk : walks) {
+        TrieWalker walker(pathTrie.GetRoot(), walk.eOrder, walk.bSorted);
+        double dNs = MeasureNs(ulNodes, [&] {
+            while (walker.next() != nullptr) {
+                ulSink += walker.getDepth();
+            }
+        });
+        std::cout << ", " << walk.szName << " " << dNs;
+    }
+    double dVisitor = MeasureNs(ulNodes, [&] {
+        pathTrie.walk(TrieOrder::PreOrder, [&ulSink](TrieNode*, size_t ulDepth) {
+            ulSink += ulDepth;
+            return TrieVisit::Continue;
+        });
+    });
+    std::cout << ", visitor " << dVisitor << (ulSink == 0 ? " (empty)" : "") << std::endl;
+}
+
+// Rebuild a trie from its paths, then persist it and look every path up in
+// the mapped snapshot instead
+void TestTrieSnapshot(PathTrieMode eMode, const char* szMode) {
+    const std::string szSnapshotPath = "test_snapshot.trie";
+    std::vector<std::string> vPaths = MakeScanPaths();
+
+    PathTrie pathTrie(eMode);
+    double dBuild = MeasureNs(1, [&] {
+        for (const auto& szPath : vPaths) {
+            pathTrie.insert(szPath);
+        }
+    });
+    bool bWritten = false;
+    double dWrite = MeasureNs(1, [&] { bWritten = TrieSnapshot::Write(pathTrie, szSnapshotPath); });
+
+    TrieSnapshot snapshot;
+    bool bOpened = false;
+    double dOpen = MeasureNs(1, [&] { bOpened = bWritten && snapshot.open(szSnapshotPath); });
+    if (!bOpened) {
+        std::cerr << "Failed to snapshot the " << szMode << " trie" << std::endl;
+        return;
+    }
+
+    size_t ulErrors = snapshot.getNodeCount() != pathTrie.getNodeCount();
+    std::string szBuffer;
+    double dFind = MeasureNs(vPaths.size(), [&] {
+        for (const auto& szPath : vPaths) {
+            TrieSnapshot::NodeId node = snapshot.find(szPath);
+            snapshot.getFullPath(node, szBuffer);
+            ulErrors += node == TrieSnapshot::INVALID_NODE || szBuffer != szPath ||
+                        snapshot.getChildCount(node) != 0;
+        }
+    });
+    struct stat statBuf;
+    stat(szSnapshotPath.c_str(), &statBuf);
+    unlink(szSnapshotPath.c_str());
+
+    std::cout << "  " << szMode << ": build " << dBuild / 1000 << " us, write " << dWrite / 1000
+              << " us, open " << dOpen / 1000 << " us, find+getFullPath " << dFind << " ns, "
+              << statBuf.st_size << " bytes";
+    if (ulErrors != 0) {
+        std::cout << ", " << ulErrors << " errors";
+    }
+    std::cout << std::endl;
+}
+
+// Scan one fixture with 1..N threads and with du -s, the block totals have
+// to agree
+void TestScanDir(const std::vector<unsigned int>& vThreads) {
+    std::cout << "Testing ScanDir..." << std::endl;
+    const std::string szRootPath = "test_scan";
+    for (int i = 0; i < TEST_ENTRIES_NUM; ++i) {
+        std::string szDirPath = szRootPath + "/test_dir_" + std::to_string(i);
+        CreateDir(szDirPath);
+        CreateFilesAndLinks(szDirPath, 10, 5, 5);
+    }
+
+    uint64_t ulBlocks = 0;
+    for (unsigned int nThreads : vThreads) {
+        ScanDirOptions options;
+        options.nThreads = nThreads;
+        auto start = std::chrono::steady_clock::now();
+        std::unique_ptr<ScanDirResult> pResult = ScanDir(szRootPath, options);
+        double dSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+        if (!pResult) {
+            std::cerr << "Failed to scan directory: " << szRootPath << std::endl;
+            break;
+        }
+
+        // Every node below the root carries one entry
+        const ScanEntry* pRoot = ScanDirResult::GetEntry(pResult->pRoot);
+        size_t ulNodes = pResult->trie.getNodeCount() - pResult->pRoot->getDepth();
+        ulBlocks = pRoot->ulTotalBlocks;
+        std::cout << "    threads: " << nThreads << ", " << pRoot->ulTotalEntries << " entries, "
+                  << pRoot->ulTotalSize << " bytes, "
+                  << static_cast<uint64_t>(pRoot->ulTotalEntries / dSeconds) << " entries/s";
+        std::cout << CheckResult(pResult->iErrno == 0 && ulNodes == pRoot->ulTotalEntries) << std::endl;
+    }
+
+    // du -sk reports 1K blocks, ScanDir 512-byte blocks
+    std::string szCommand = "du -sk " + szRootPath;
+    auto start = std::chrono::steady_clock::now();
+    FILE* pPipe = popen(szCommand.c_str(), "r");
+    unsigned long ulDuBlocks = 0;
+    if (pPipe) {
+        if (fscanf(pPipe, "%lu", &ulDuBlocks) != 1) {
+            ulDuBlocks = 0;
+        }
+        pclose(pPipe);
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "    du -s: " << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+              << " us" << (ulDuBlocks * 2 == ulBlocks ? "" : ", block totals differ") << std::endl;
+
+    char absPath[PATH_MAX];
+    if (realpath(szRootPath.c_str(), absPath) == nullptr || !RemoveDir(absPath, false)) {
+        std::cerr << "Failed to remove directory: " << szRootPath << std::endl;
+    }
+}
+
+// The balanced fixture built the old way, one path based call per entry
+void CreateBalancedTree(const std::string& szDirPath, int iFanout, int iDepth, int iFiles, int iSymlinks) {
+    CreateFilesAndLinks(szDirPath, iFiles, iDepth > 0 ? iFanout : 0, iSymlinks);
+    for (int i = 0; i < iFanout && iDepth > 0; ++i) {
+        CreateBalancedTree(szDirPath + "/dir_" + std::to_string(i), iFanout, iDepth - 1, iFiles, iSymlinks);
+    }
+}
+
+// Entries below szPath, or 0 if the scan failed
+uint64_t CountEntries(const std::string& szPath) {
+    std::unique_ptr<ScanDirResult> pResult = ScanDir(szPath, ScanDirOptions());
+    if (!pResult || pResult->iErrno != 0) {
+        return 0;
+    }
+    // The root counts itself
+    return ScanDirResult::GetEntry(pResult->pRoot)->ulTotalEntries - 1;
+}
+
+// Every entry below szPath as "relative path, type, size or link target",
+// sorted, so that two trees compare equal only if they hold the same entries
+void ListTree(const std::string& szPath, const std::string& szRelative, std::vector<std::string>& vEntries) {
+    DIR* pDir = opendir(szPath.c_str());
+    if (pDir == nullptr) {
+        vEntries.push_back(szRelative + " unreadable");
+        return;
+    }
+    while (struct dirent* pEntry = readdir(pDir)) {
+        if (strcmp(pEntry->d_name, ".") == 0 || strcmp(pEntry->d_name, "..") == 0) {
+            continue;
+        }
+        const std::string szChild = szPath + "/" + pEntry->d_name;
+        const std::string szChildRelative = szRelative + "/" + pEntry->d_name;
+        struct stat st;
+        if (lstat(szChild.c_str(), &st) != 0) {
+            vEntries.push_back(szChildRelative + " unreadable");
+        } else if (S_ISDIR(st.st_mode)) {
+            vEntries.push_back(szChildRelative + " dir");
+            ListTree(szChild, szChildRelative, vEntries);
+        } else if (S_ISLNK(st.st_mode)) {
+            char szTarget[PATH_MAX];
+            ssize_t iLen = readlink(szChild.c_str(), szTarget, sizeof(szTarget));
+            vEntries.push_back(szChildRelative + " link " + std::string(szTarget, std::max<ssize_t>(iLen, 0)));
+        } else {
+            vEntries.push_back(szChildRelative + " file " + std::to_string(st.st_size));
+        }
+    }
+    closedir(pDir);
+    if (szRelative.empty()) {
+        std::sort(vEntries.begin(), vEntries.end());
+    }
+}
+
+// Build the same tree serially with CreateFilesAndLinks and with
+// CreateFixture, on the working directory's file system and on tmpfs. Then
+// a skewed tree from one seed on 1 and on several threads, which must be
+// identical, and from another seed, which must not.
+void TestTreeFixture() {
+    std::cout << "Testing TreeFixture..." << std::endl;
+    FixtureOptions options;
+    options.iFanout = 10;
+    options.iDepth = 3;
+    options.iFiles = 10;
+    options.dSymlinkRatio = 0.5;
+
+    char szCwd[PATH_MAX];
+    if (getcwd(szCwd, sizeof(szCwd)) == nullptr) {
+        std::cerr << "Failed to get the working directory" << std::endl;
+        return;
+    }
+    std::string szTmpfs = FindTmpfsDir();
+    const struct {
+        const char* szName;
+        std::string szRoot;
+    } locations[] = {
+        { "cwd", szCwd },
+        { "tmpfs", szTmpfs },
+    };
+
+    for (const auto& location : locations) {
+        if (location.szRoot.empty()) {
+            std::cout << "  " << location.szName << ": no tmpfs found" << std::endl;
+            continue;
+        }
+        const std::string szPath = location.szRoot + "/test_fixture." + std::to_string(getpid());
+        for (int iBuilder = 0; iBuilder < 2; ++iBuilder) {
+            FixtureStats stats;
+            bool bCreated = true;
+            auto start = std::chrono::steady_clock::now();
+            if (iBuilder == 0) {
+                CreateDir(szPath);
+                CreateBalancedTree(szPath, options.iFanout, options.iDepth, options.iFiles, 5);
+            } else {
+                bCreated = CreateFixture(szPath, options, &stats);
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+
+            uint64_t ulEntries = CountEntries(szPath);
+            std::cout << "  " << location.szName << ", " << (iBuilder == 0 ? "CreateFilesAndLinks" : "CreateFixture")
+                      << ": " << ulEntries << " entries, "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms";
+            std::cout << CheckResult(bCreated && (iBuilder == 0 || ulEntries == stats.getEntries())) << std::endl;
+            if (!RemoveDir(szPath, false)) {
+                std::cerr << "Failed to remove directory: " << szPath << std::endl;
+            }
+        }
+    }
+
+    const std::string szPath = (szTmpfs.empty() ? std::string(szCwd) : szTmpfs) + "/test_fixture_seed." +
+                               std::to_string(getpid());
+    options.eShape = FixtureShape::Skewed;
+    options.ulFileSize = 100;
+    const struct {
+        uint64_t ulSeed;
+        unsigned int nThreads;
+    } runs[] = {
+        { 7, 1 },
+        { 7, std::max(4u, std::thread::hardware_concurrency()) },
+        { 8, std::max(4u, std::thread::hardware_concurrency()) },
+    };
+    std::vector<std::string> vFirst;
+    FixtureStats firstStats;
+    for (const auto& run : runs) {
+        options.ulSeed = run.ulSeed;
+        options.nThreads = run.nThreads;
+        FixtureStats stats;
+        bool bCreated = CreateFixture(szPath, options, &stats);
+        std::vector<std::string> vEntries;
+        ListTree(szPath, "", vEntries);
+        RemoveDir(szPath, false);
+
+        bool bSameTree = vEntries == vFirst && stats.ulDirs == firstStats.ulDirs &&
+                         stats.ulFiles == firstStats.ulFiles && stats.ulSymlinks == firstStats.ulSymlinks &&
+                         stats.ulBytes == firstStats.ulBytes;
+        std::cout << "  skewed, seed " << run.ulSeed << ", " << run.nThreads << " thread(s): "
+                  << vEntries.size() << " entries, " << stats.ulBytes << " bytes";
+        std::cout << CheckResult(bCreated && vEntries.size() == stats.getEntries() &&
+                                 (&run != &runs[1] || bSameTree) && (&run != &runs[2] || !bSameTree))
+                  << std::endl;
+        if (&run == &runs[0]) {
+            vFirst = std::move(vEntries);
+            firstStats = stats;
+        }
+    }
+}
+
+// RemoveDirAsync against RemoveDir on the same fixture: the time until the
+// path is gone, the time until the tree is deleted, a throttled removal and
+// the recovery of an entry left in the trash by a dead process
+void TestRemoveDirAsync() {
+    std::cout << "Testing RemoveDirAsync..." << std::endl;
+    std::string szRoot = FindTmpfsDir();
+    char szCwd[PATH_MAX];
+    if (szRoot.empty() && getcwd(szCwd, sizeof(szCwd)) != nullptr) {
+        szRoot = szCwd;
+    }
+    const std::string szTrash = szRoot + "/" + TRASH_DIR_NAME;
+    const std::string szPath = szRoot + "/test_async." + std::to_string(getpid());
+
+    FixtureOptions options;
+    options.iFanout = 10;
+    options.iDepth = 3;
+    options.iFiles = 10;
+
+    // No process has that pid, pid_max is at most 2^22
+    CreateDir(szTrash);
+    FixtureOptions crashed = options;
+    crashed.iDepth = 1;
+    CreateFixture(szTrash + "/999999999.0", crashed);
+    TrashReclaimer::Instance().setTrashDir(szRoot);
+    TrashReclaimer::Instance().wait();
+    std::cout << "  recovered: " << (access((szTrash + "/999999999.0").c_str(), F_OK) != 0 ? "yes" : "no")
+              << std::endl;
+
+    FixtureStats stats;
+    CreateFixture(szPath, options, &stats);
+    auto start = std::chrono::steady_clock::now();
+    bool bRemoved = RemoveDir(szPath, false);
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "  RemoveDir: " << stats.getEntries() << " entries, "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << " us"
+              << (bRemoved ? "" : ", failed") << std::endl;
+
+    CreateFixture(szPath, options);
+    start = std::chrono::steady_clock::now();
+    std::future<bool> future = RemoveDirAsync(szPath);
+    auto returned = std::chrono::steady_clock::now() - start;
+    bool bGone = access(szPath.c_str(), F_OK) != 0;
+    bRemoved = future.get();
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "  RemoveDirAsync: returned after "
+              << std::chrono::duration_cast<std::chrono::microseconds>(returned).count() << " us, deleted after "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count() << " us"
+              << (bGone && bRemoved ? "" : ", failed") << std::endl;
+
+    // 200 entries per second
+    options.iFanout = 4;
+    options.iDepth = 1;
+    TrashOptions throttled;
+    throttled.ulMaxEntriesPerSec = 200;
+    TrashReclaimer::Instance().configure(throttled);
+    CreateFixture(szPath, options, &stats);
+    start = std::chrono::steady_clock::now();
+    bRemoved = RemoveDirAsync(szPath).get();
+    elapsed = std::chrono::steady_clock::now() - start;
+    std::cout << "  RemoveDirAsync at 200 entries/s: " << stats.getEntries() << " entries, "
+              << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms"
+              << (bRemoved ? "" : ", failed") << std::endl;
+    TrashReclaimer::Instance().configure(TrashOptions());
+
+    TrashReclaimer::Instance().wait();
+    uint64_t ulLeft = CountEntries(szTrash);
+    std::cout << "  trash entries left: " << ulLeft << std::endl;
+    if (ulLeft == 0) {
+        rmdir(szTrash.c_str());
+    }
+}
+
+// CopyDir against cp -r on the same fixture, on the working directory's file
+// system and on tmpfs. The copies must match the source in entries and bytes.
+void TestCopyDir() {
+    std::cout << "Testing CopyDir..." << std::endl;
+    FixtureOptions options;
+    options.iFanout = 10;
+    options.iDepth = 2;
+    options.iFiles = 10;
+    options.ulFileSize = 4096;
+
+    char szCwd[PATH_MAX];
+    if (getcwd(szCwd, sizeof(szCwd)) == nullptr) {
+        std::cerr << "Failed to get the working directory" << std::endl;
+        return;
+    }
+    const struct {
+        const char* szName;
+        std::string szRoot;
+    } locations[] = {
+        { "cwd", szCwd },
+        { "tmpfs", FindTmpfsDir() },
+    };
+
+    for (const auto& location : locations) {
+        if (location.szRoot.empty()) {
+            continue;
+        }
+        const std::string szSrc = location.szRoot + "/test_copy_src." + std::to_string(getpid());
+        const std::string szDst = location.szRoot + "/test_copy_dst." + std::to_string(getpid());
+        FixtureStats fixture;
+        if (!CreateFixture(szSrc, options, &fixture)) {
+            std::cerr << "Failed to create fixture: " << szSrc << std::endl;
+            continue;
+        }
+        std::unique_ptr<ScanDirResult> pSrcScan = ScanDir(szSrc);
+        const ScanEntry* pSrcTotal = ScanDirResult::GetEntry(pSrcScan->pRoot);
+
+        for (int iCopier = 0; iCopier < 2; ++iCopier) {
+            CopyDirStats stats;
+            bool bCopied;
+            auto start = std::chrono::steady_clock::now();
+            if (iCopier == 0) {
+                bCopied = system(("cp -r " + szSrc + " " + szDst).c_str()) == 0;
+            } else {
+                bCopied = CopyDir(szSrc, szDst, CopyDirOptions(), &stats);
+            }
+            auto elapsed = std::chrono::steady_clock::now() - start;
+
+            std::unique_ptr<ScanDirResult> pDstScan = ScanDir(szDst);
+            const ScanEntry* pDstTotal = pDstScan ? ScanDirResult::GetEntry(pDstScan->pRoot) : nullptr;
+            std::cout << "  " << location.szName << ", " << (iCopier == 0 ? "cp -r" : "CopyDir") << ": "
+                      << fixture.getEntries() << " entries, "
+                      << std::chrono::duration_cast<std::chrono::milliseconds>(elapsed).count() << " ms";
+            if (iCopier == 1) {
+                std::cout << " (ficlone " << stats.ulCloned << ", copy_file_range " << stats.ulCopyRange
+                          << ", sendfile " << stats.ulSendfile << ")";
+            }
+            bool bConsistent =
+                bCopied && pDstTotal && pDstTotal->ulTotalEntries == pSrcTotal->ulTotalEntries &&
+                pDstTotal->ulTotalSize - pDstTotal->ulSize == pSrcTotal->ulTotalSize - pSrcTotal->ulSize &&
+                (iCopier == 0 || stats.ulDirs + stats.ulFiles + stats.ulSymlinks == fixture.getEntries());
+            std::cout << CheckResult(bConsistent) << std::endl;
+            RemoveDir(szDst, false);
+        }
+        RemoveDir(szSrc, false);
+    }
+
+    // A chain deeper than the fd limit: only directories still being filled
+    // may hold the fd of their copy, the rest are reopened through ".."
+    const std::string szRoot = locations[1].szRoot.empty() ? locations[0].szRoot : locations[1].szRoot;
+    const std::string szSrc = szRoot + "/test_copy_chain_src." + std::to_string(getpid());
+    const std::string szDst = szRoot + "/test_copy_chain_dst." + std::to_string(getpid());
+    FixtureOptions chain;
+    chain.eShape = FixtureShape::DeepChain;
+    chain.iDepth = 2000;
+    chain.iFiles = 1;
+    chain.dSymlinkRatio = 0;
+    FixtureStats fixture;
+    struct rlimit limit;
+    if (!CreateFixture(szSrc, chain, &fixture) || getrlimit(RLIMIT_NOFILE, &limit) != 0) {
+        std::cerr << "Failed to create fixture: " << szSrc << std::endl;
+        RemoveDirStreaming(szSrc, false, 64);
+        return;
+    }
+    for (bool bPreserveTimes : { false, true }) {
+        struct rlimit lowered = limit;
+        lowered.rlim_cur = std::min<rlim_t>(limit.rlim_cur, 256);
+        setrlimit(RLIMIT_NOFILE, &lowered);
+        CopyDirOptions copyOptions;
+        copyOptions.bPreserveTimes = bPreserveTimes;
+        CopyDirStats stats;
+        bool bCopied = CopyDir(szSrc, szDst, copyOptions, &stats);
+        setrlimit(RLIMIT_NOFILE, &limit);
+
+        // The chain is longer than PATH_MAX, so both are walked with openat
+        // side by side: every level must be there, with the times preserved
+        int iSrcFd = open(szSrc.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int iDstFd = open(szDst.c_str(), O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        int iLevels = 0;
+        bool bSame = iSrcFd >= 0 && iDstFd >= 0;
+        while (bSame) {
+            struct stat srcSt, dstSt;
+            bSame = fstat(iSrcFd, &srcSt) == 0 && fstat(iDstFd, &dstSt) == 0 &&
+                    (!bPreserveTimes || (srcSt.st_mtim.tv_sec == dstSt.st_mtim.tv_sec &&
+                                         srcSt.st_mtim.tv_nsec == dstSt.st_mtim.tv_nsec));
+            int iSrcChildFd = openat(iSrcFd, "dir_0", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            int iDstChildFd = openat(iDstFd, "dir_0", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+            close(iSrcFd);
+            close(iDstFd);
+            iSrcFd = iSrcChildFd;
+            iDstFd = iDstChildFd;
+            if (iSrcFd < 0 || iDstFd < 0) {
+                bSame = bSame && iSrcFd < 0 && iDstFd < 0;
+                break;
+            }
+            ++iLevels;
+        }
+        if (iSrcFd >= 0) {
+            close(iSrcFd);
+        }
+        if (iDstFd >= 0) {
+            close(iDstFd);
+        }
+
+        std::cout << "  chain of " << chain.iDepth << ", fd limit " << lowered.rlim_cur
+                  << (bPreserveTimes ? ", times preserved" : "") << ": " << stats.ulDirs << " dirs, "
+                  << stats.ulFiles << " files";
+        std::cout << CheckResult(bCopied && bSame && iLevels == chain.iDepth &&
+                                 stats.ulDirs + stats.ulFiles == fixture.getEntries())
+                  << std::endl;
+        RemoveDirStreaming(szDst, false, 64);
+    }
+    RemoveDirStreaming(szSrc, false, 64);
+}
+
+// Prune a fixture to a third of its usage with every policy, and once with
+// a candidate heap too small to finish in one traversal. The usage left and
+// the reclaimed bytes are checked with ScanDir.
+void TestPruneDir() {
+    std::cout << "Testing PruneDir..." << std::endl;
+    std::string szRoot = FindTmpfsDir();
+    char szCwd[PATH_MAX];
+    if (szRoot.empty() && getcwd(szCwd, sizeof(szCwd)) != nullptr) {
+        szRoot = szCwd;
+    }
+    const std::string szPath = szRoot + "/test_prune." + std::to_string(getpid());
+
+    FixtureOptions options;
+    options.iFanout = 10;
+    options.iDepth = 2;
+    options.iFiles = 10;
+    options.ulFileSize = 4096;
+
+    const struct {
+        const char* szName;
+        PrunePolicy ePolicy;
+        size_t ulMaxCandidates;
+    } runs[] = {
+        { "LeastRecentlyUsed", PrunePolicy::LeastRecentlyUsed, 1 << 20 },
+        { "OldestModified", PrunePolicy::OldestModified, 1 << 20 },
+        { "LargestFirst", PrunePolicy::LargestFirst, 1 << 20 },
+        { "OldestModified, 100 candidates", PrunePolicy::OldestModified, 100 },
+    };
+    for (const auto& run : runs) {
+        if (!CreateFixture(szPath, options)) {
+            std::cerr << "Failed to create fixture: " << szPath << std::endl;
+            return;
+        }
+        uint64_t ulBefore = ScanDirResult::GetEntry(ScanDir(szPath)->pRoot)->ulTotalBlocks * 512;
+        uint64_t ulTarget = ulBefore / 3;
+
+        PruneDirStats stats;
+        bool bPruned = PruneDir(szPath, ulTarget, run.ePolicy, &stats, run.ulMaxCandidates);
+        uint64_t ulAfter = ScanDirResult::GetEntry(ScanDir(szPath)->pRoot)->ulTotalBlocks * 512;
+        std::cout << "  " << run.szName << ": " << stats.ulReclaimedBytes << " of " << ulBefore << " bytes, "
+                  << stats.ulRemovedFiles << " files, " << stats.ulRemovedDirs << " dirs, " << stats.nPasses
+                  << " pass(es), scan " << stats.ulScanNs / 1000 << " us, select " << stats.ulSelectNs / 1000
+                  << " us, remove " << stats.ulRemoveNs / 1000 << " us";
+        std::cout << CheckResult(bPruned && ulAfter <= ulTarget && ulBefore - ulAfter == stats.ulReclaimedBytes &&
+                                 stats.ulScannedBytes == ulBefore)
+                  << std::endl;
+        RemoveDir(szPath, false);
+    }
+}
+
+// Repeated CreateDir of existing directories with and without DirCache, then
+// changes made behind the cache's back: a removed subtree, a file in the way,
+// an event queue overflow and a spent watch budget
+void TestDirCache() {
+    std::cout << "Testing DirCache..." << std::endl;
+    std::string szRoot = FindTmpfsDir();
+    char szCwd[PATH_MAX];
+    if (szRoot.empty() && getcwd(szCwd, sizeof(szCwd)) != nullptr) {
+        szRoot = szCwd;
+    }
+    const std::string szPath = szRoot + "/test_dircache." + std::to_string(getpid());
+    FixtureOptions options;
+    options.iFanout = 10;
+    options.iDepth = 3;
+    options.iFiles = 0;
+    if (!CreateFixture(szPath, options)) {
+        std::cerr << "Failed to create fixture: " << szPath << std::endl;
+        return;
+    }
+    std::vector<std::string> vDirs;
+    for (int i = 0; i < 1000; ++i) {
+        vDirs.push_back(szPath + "/dir_" + std::to_string(i / 100) + "/dir_" + std::to_string(i / 10 % 10) +
+                        "/dir_" + std::to_string(i % 10));
+    }
+    if (!DirCache::Instance().watch(szPath)) {
+        RemoveDir(szPath, false);
+        return;
+    }
+
+    for (CreateDirMode eMode : { CreateDirMode::StatFirst, CreateDirMode::Cached }) {
+        bool bCreated = true;
+        auto start = std::chrono::steady_clock::now();
+        for (int iRound = 0; iRound < 10; ++iRound) {
+            for (const auto& szDir : vDirs) {
+                bCreated = CreateDir(szDir, eMode) && bCreated;
+            }
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        double dSeconds = std::chrono::duration<double>(elapsed).count();
+        std::cout << "  " << (eMode == CreateDirMode::Cached ? "Cached" : "StatFirst") << ": "
+                  << static_cast<uint64_t>(vDirs.size() * 10 / dSeconds) << " existing dirs/s"
+                  << (bCreated ? "" : ", failed") << std::endl;
+    }
+    for (CreateDirMode eMode : { CreateDirMode::StatFirst, CreateDirMode::Cached }) {
+        const char* szName = eMode == CreateDirMode::Cached ? "Cached" : "StatFirst";
+        bool bCreated = true;
+        auto start = std::chrono::steady_clock::now();
+        for (const auto& szDir : vDirs) {
+            bCreated = CreateDir(szDir + "/new_" + szName + "/leaf", eMode) && bCreated;
+        }
+        auto elapsed = std::chrono::steady_clock::now() - start;
+        double dSeconds = std::chrono::duration<double>(elapsed).count();
+        std::cout << "  " << szName << ": " << static_cast<uint64_t>(vDirs.size() * 2 / dSeconds)
+                  << " new dirs/s" << (bCreated ? "" : ", failed") << std::endl;
+    }
+
+    // Cost of lookup alone against one stat, by the depth below the root
+    std::string szChain = szPath;
+    for (int iDepth = 1; iDepth <= 9; ++iDepth) {
+        szChain += "/chain_" + std::to_string(iDepth);
+    }
+    CreateDir(szChain);
+    DirCache::Instance().sync();
+    std::cout << "  ns per call, lookup vs stat:";
+    for (int iDepth : { 1, 3, 6, 9 }) {
+        std::string szDir = szPath;
+        for (int i = 1; i <= iDepth; ++i) {
+            szDir += "/chain_" + std::to_string(i);
+        }
+        struct stat st;
+        int iSink = 0;
+        double dLookup = MeasureNs(100000, [&] {
+            for (int i = 0; i < 100000; ++i) {
+                iSink += DirCache::Instance().lookup(szDir);
+            }
+        });
+        double dStat = MeasureNs(100000, [&] {
+            for (int i = 0; i < 100000; ++i) {
+                iSink += stat(szDir.c_str(), &st);
+            }
+        });
+        std::cout << " depth " << iDepth << " " << dLookup << " vs " << dStat << (iSink == 0 ? " (empty)" : "");
+    }
+    std::cout << std::endl;
+
+    // Applied by the background thread without anyone asking
+    struct stat st;
+    int iChainDepth = DirCache::Instance().lookup(szChain);
+    rmdir(szChain.c_str());
+    auto start = std::chrono::steady_clock::now();
+    while (DirCache::Instance().lookup(szChain) == iChainDepth &&
+           std::chrono::steady_clock::now() - start < std::chrono::seconds(1)) {
+        std::this_thread::yield();
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+    bool bApplied = DirCache::Instance().lookup(szChain) == iChainDepth - 1;
+    std::cout << "  rmdir seen after " << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+              << " us" << CheckResult(bApplied) << std::endl;
+
+    // Removed and at once recreated without a sync(): every removal call of
+    // the library has to leave the mirror up to date. Then a file where a
+    // directory goes.
+    RemoveDir(szPath + "/dir_3", false);
+    bool bRecreated = CreateDir(vDirs[345], CreateDirMode::Cached) && stat(vDirs[345].c_str(), &st) == 0;
+    for (int i = 0; i < 100 && bRecreated; ++i) {
+        const std::string& szDir = vDirs[100 + i];
+        bool bRemoved = i % 3 == 0   ? RemoveDir(szDir, false)
+                        : i % 3 == 1 ? RemoveDirStreaming(szDir, false, 64)
+                                     : RemoveDirParallel(szDir, false, 2);
+        bRecreated = bRemoved && CreateDir(szDir, CreateDirMode::Cached) && stat(szDir.c_str(), &st) == 0;
+    }
+    std::ofstream(szPath + "/dir_4/dir_5/file").put('x');
+    bool bRejected = !CreateDir(szPath + "/dir_4/dir_5/file/dir", CreateDirMode::Cached) && errno == ENOTDIR;
+    std::cout << "  external changes" << CheckResult(bRecreated && bRejected) << std::endl;
+
+    // Often more events than the queue holds, whether it overflows depends on
+    // how far the thread keeps up. Either way the mirror has to match after.
+    for (int i = 0; i < 20000; ++i) {
+        std::string szDir = szPath + "/flood_" + std::to_string(i);
+        mkdir(szDir.c_str(), 0755);
+        rmdir(szDir.c_str());
+    }
+    DirCache::Instance().sync();
+    std::string szAfter = szPath + "/dir_0/after_overflow";
+    bool bAnswered = CreateDir(szAfter, CreateDirMode::Cached) && stat(szAfter.c_str(), &st) == 0 &&
+                     DirCache::Instance().lookup(szPath + "/flood_19999") == iChainDepth - 9;
+    DirCacheStats stats = DirCache::Instance().getStats();
+    std::cout << "  flood: " << stats.ulRescans << " rescan(s), " << stats.ulDirs << " dirs, "
+              << stats.ulWatches << " watches" << CheckResult(bAnswered) << std::endl;
+
+    // Only the top levels fit the budget, lookups below fall back to syscalls
+    DirCache::Instance().watch(szPath, 5);
+    bool bCreated = true;
+    for (const auto& szDir : vDirs) {
+        bCreated = CreateDir(szDir + "/budget", CreateDirMode::Cached) && bCreated;
+    }
+    stats = DirCache::Instance().getStats();
+    std::cout << "  budget of 5: " << stats.ulWatches << " watches, " << stats.ulUnknown << " of "
+              << stats.ulLookups << " lookups unknown" << CheckResult(bCreated) << std::endl;
+
+    DirCache::Instance().unwatch();
+    RemoveDir(szPath, false);
+}
+
+#ifdef TRACE_ENABLE
+__attribute__((noinline)) void TracedNop(int* pCounter) {
+    TRACE_FUNCTION();
+    ++*pCounter;
+}
+
+__attribute__((noinline)) void TracedPairNop(int* pCounter) {
+    TRACE_B("TracedPairNop");
+    ++*pCounter;
+    TRACE_E("TracedPairNop");
+}
+
+__attribute__((noinline)) void UntracedNop(int* pCounter) {
+    ++*pCounter;
+}
+
+// Extra cost of one fnTraced call, a TRACE_FUNCTION scope or a TRACE_B /
+// TRACE_E pair, over an untraced one
+double MeasureTraceOverhead(void (*fnTraced)(int*)) {
+    const int iBatch = 50000;
+    const int iRounds = 20;
+    int iCounter = 0;
+    double dTraced = 0;
+    double dUntraced = 0;
+    for (int r = 0; r < iRounds; ++r) {
+        dUntraced += MeasureNs(iBatch, [&] {
+            for (int i = 0; i < iBatch; ++i) {
+                UntracedNop(&iCounter);
+            }
+        });
+        dTraced += MeasureNs(iBatch, [&] {
+            for (int i = 0; i < iBatch; ++i) {
+                fnTraced(&iCounter);
+            }
+        });
+        // Batches stay below the ring size, so every event is recorded
+        if (Tracer::IsEnabled() && Tracer::GetBackend() == TraceBackend::Ring) {
+            TraceRing::Instance().flush();
+        }
+    }
+    return (dTraced - dUntraced) / iRounds;
+}
+
+// Overhead with tracing switched off at runtime, then with each backend
+// switched on through the API. The original state is restored afterwards.
+void TestTraceOverhead() {
+    std::cout << "Testing trace overhead..." << std::endl;
+    bool bWasEnabled = Tracer::IsEnabled();
+    TraceBackend eWasBackend = Tracer::GetBackend();
+
+    Tracer::Disable();
+    std::cout << "  disabled: " << MeasureTraceOverhead(TracedNop) << " ns per scope, "
+              << MeasureTraceOverhead(TracedPairNop) << " ns per B/E pair" << std::endl;
+    const struct {
+        const char* szName;
+        TraceBackend eBackend;
+    } backends[] = {
+        { "ftrace", TraceBackend::Ftrace },
+        { "ring", TraceBackend::Ring },
+        { "stats", TraceBackend::Stats },
+        { "perf", TraceBackend::Perf },
+    };
+    for (const auto& backend : backends) {
+        // Without access to trace_marker the ftrace backend would only drop events
+        if (backend.eBackend == TraceBackend::Ftrace && access(TRACE_MARKER, W_OK) != 0) {
+            continue;
+        }
+        Tracer::Enable(backend.eBackend);
+        std::cout << "  " << backend.szName << ": " << MeasureTraceOverhead(TracedNop) << " ns per scope, "
+                  << MeasureTraceOverhead(TracedPairNop) << " ns per B/E pair" << std::endl;
+    }
+
+    Tracer::Disable();
+    Tracer::SetBackend(eWasBackend);
+    if (bWasEnabled) {
+        Tracer::Enable();
+    }
+}
+#endif
+
+// trace_convert and convert.py on a capture both must parse alike: names
+// outside [A-Za-z0-9_], several markers on a line, no CPU, trailing bytes
+// after the timestamp. The two outputs must be byte for byte the same.
+void TestTraceConvert() {
+    std::cout << "Testing trace_convert..." << std::endl;
+    if (system("python3 -c '' > /dev/null 2>&1") != 0) {
+        std::cout << "  python3 not found, skipped" << std::endl;
+        return;
+    }
+    std::string szRoot = FindTmpfsDir();
+    char szCwd[PATH_MAX];
+    if (szRoot.empty() && getcwd(szCwd, sizeof(szCwd)) != nullptr) {
+        szRoot = szCwd;
+    }
+    const std::string szBase = szRoot + "/test_trace_convert." + std::to_string(getpid());
+    {
+        std::ofstream capture(szBase + ".txt");
+        capture << "# tracer: nop\n"
+                << " TestFileIO-7  [001] .....  10.000001: tracing_mark_write: B|7|7|CreateDir|1000\n"
+                << " TestFileIO-7  [001] .....  10.000002: tracing_mark_write: E|7|7|CreateDir|1500\n"
+                << " TestFileIO-8  [002] .....  10.000003: tracing_mark_write: X|7|8|Scan_2|1600\n"
+                << " TestFileIO-8  [002] .....  10.000004: tracing_mark_write: B|7|8|caf\xc3\xa9|1700\n"
+                << " TestFileIO-8  [002] .....  10.000005: tracing_mark_write: B|7|8|a\"b|1800\n"
+                << " TestFileIO-8  [002] .....  10.000006: tracing_mark_write: B|7|8|a-b|1900\n"
+                << " TestFileIO-8  [002] .....  10.000007: tracing_mark_write: C|7|8|count|2000\n"
+                << " TestFileIO-8  [002] .....  10.000008: tracing_mark_write: B|7|8|outer|2100"
+                << " [003] tracing_mark_write: E|7|8|inner|2200\n"
+                << " TestFileIO-8  [002] .....  10.000009: tracing_mark_write: B|7|8|last|2300"
+                << " tracing_mark_write: E|7|8|bad-name|2400\n"
+                << " TestFileIO-9  ..... 10.000010: tracing_mark_write: B|7|9|nocpu|2500\n"
+                << " TestFileIO-9  [004] .....  10.000011: tracing_mark_write: E|7|9|tail|2600us\n"
+                << " TestFileIO-9  [004] .....  10.000012: tracing_mark_write: E|7|9|unterminated|2700";
+    }
+    const std::string szCommand = std::string(TRACE_CONVERT_BIN) + " -i " + szBase + ".txt -o " + szBase +
+                                  ".bin.json > /dev/null && python3 " + TRACE_CONVERT_PY + " -i " + szBase +
+                                  ".txt -o " + szBase + ".py.json > /dev/null";
+    bool bConverted = system(szCommand.c_str()) == 0;
+
+    auto readFile = [](const std::string& szPath) {
+        std::ifstream file(szPath, std::ios::binary);
+        return std::string(std::istreambuf_iterator<char>(file), std::istreambuf_iterator<char>());
+    };
+    std::string szBin = readFile(szBase + ".bin.json");
+    std::string szPy = readFile(szBase + ".py.json");
+    std::cout << "  " << std::count(szBin.begin(), szBin.end(), '{') / 2 << " events, "
+              << szBin.size() << " bytes";
+    std::cout << CheckResult(bConverted && !szBin.empty() && szBin == szPy) << std::endl;
+    for (const char* szSuffix : { ".txt", ".bin.json", ".py.json" }) {
+        unlink((szBase + szSuffix).c_str());
+    }
+}
+
+// Counters of single CreateDir and RemoveDir calls. Events refused by the
+// kernel are printed as n/a, the syscall tally needs SYSCALL_STATS_ENABLE.
+void TestPerfCounters() {
+    std::cout << "Testing PerfCounters (perf_event_paranoid: " << PerfCounters::GetParanoid() << ")..." << std::endl;
+    const std::string szRootPath = "test_perf";
+    const std::string szDirPath = szRootPath + "/a/b/c/d/e/f/g/h";
+
+    std::cout << "  CreateDir, new path:" << std::endl;
+    MeasurePerf([&] { CreateDir(szDirPath); }).print(std::cout);
+
+    std::cout << "  CreateDir, existing path:" << std::endl;
+    MeasurePerf([&] { CreateDir(szDirPath); }).print(std::cout);
+
+    CreateFilesAndLinks(szDirPath, 10, 5, 5);
+    char absPath[PATH_MAX];
+    if (realpath(szRootPath.c_str(), absPath) == nullptr) {
+        std::cerr << "Failed to resolve absolute path for: " << szRootPath << std::endl;
+        return;
+    }
+    std::cout << "  RemoveDir:" << std::endl;
+    PerfStats stats = MeasurePerf([&] {
+        if (!RemoveDir(absPath, false)) {
+            std::cerr << "Failed to remove directory: " << szRootPath << std::endl;
+        }
+    });
+    stats.print(std::cout);
+#ifdef SYSCALL_STATS_ENABLE
+    SyscallStats::Instance().reset();
+#endif
+}
+
+// Remove the same fixture with RemoveDirParallel and report the elapsed time
+void TestRemoveDirParallel(unsigned int nThreads) {
+    const std::string szRootPath = "test_parallel";
+    for (int i = 0; i < TEST_ENTRIES_NUM; ++i) {
+        std::string szDirPath = szRootPath + "/test_dir_" + std::to_string(i);
+        CreateDir(szDirPath);
+        CreateFilesAndLinks(szDirPath, 10, 5, 5);
+    }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!RemoveDirParallel(szRootPath, false, nThreads)) {
+        std::cerr << "Failed to remove directory: " << szRootPath << std::endl;
+    }
+    auto elapsed = std::chrono::steady_clock::now() - start;
+
+    std::cout << "    threads: " << nThreads << ", elapsed: "
+              << std::chrono::duration_cast<std::chrono::microseconds>(elapsed).count()
+              << " us" << std::endl;
+}
+
 int main() {
-    // Test CreateDir
-    std::cout << "Testing CreateDir..." << std::endl;
-    TestCreateDir();
+    const struct {
+        const char* szName;
+        CreateDirMode eCreateMode;
+        RemoveDirMode eRemoveMode;
+    } modes[] = {
+        { "PathBased", CreateDirMode::StatFirst, RemoveDirMode::PathBased },
+        { "FdRelative", CreateDirMode::StatFirst, RemoveDirMode::FdRelative },
+        { "IoUring", CreateDirMode::IoUring, RemoveDirMode::IoUring },
+        { "Streaming", CreateDirMode::StatFirst, RemoveDirMode::Streaming },
+    };
+
+    for (const auto& mode : modes) {
+        // Test CreateDir
+        std::cout << "Testing CreateDir (" << mode.szName << ")..." << std::endl;
+        TestCreateDir(mode.eCreateMode);
+        ReportSyscallStats();
+
+        std::cout << "Preparing RemoveDir..." << std::endl;
+        PrepareRemoveDir();
+        ReportSyscallStats();
+
+        // Test RemoveDir
+        std::cout << "Testing RemoveDir (" << mode.szName << ")..." << std::endl;
+        TestRemoveDir(mode.eRemoveMode);
+        ReportSyscallStats();
+    }
+
+    // Compare CreateDir modes
+    TestCreateDirWorkloads("StatFirst", CreateDirMode::StatFirst);
+    TestCreateDirWorkloads("MkdirFirst", CreateDirMode::MkdirFirst);
+    TestCreateDirWorkloads("IoUring", CreateDirMode::IoUring);
+
+    // Test CreateDirs
+    std::cout << "Testing CreateDirs..." << std::endl;
+    TestCreateDirs();
+    ReportSyscallStats();
+    TestRemoveDir(RemoveDirMode::FdRelative);
+#ifdef SYSCALL_STATS_ENABLE
+    SyscallStats::Instance().reset();
+#endif
+
+    TestPerfCounters();
+    TestTraceConvert();
+#ifdef TRACE_ENABLE
+    TestTraceOverhead();
+#endif
+    TestPathTrie();
+    std::cout << "Testing TrieSnapshot..." << std::endl;
+    TestTrieSnapshot(PathTrieMode::Arena, "Arena");
+    TestTrieSnapshot(PathTrieMode::Radix, "Radix");
 
-    // Test RemoveDir
-    std::cout << "Testing RemoveDir..." << std::endl;
-    TestRemoveDir();
+    // Scale from 1 thread up to every hardware thread
+    unsigned int nMaxThreads = std::max(1u, std::thread::hardware_concurrency());
+    std::vector<unsigned int> vThreads;
+    for (unsigned int n = 1; n < nMaxThreads; n *= 2) {
+        vThreads.push_back(n);
+    }
+    vThreads.push_back(nMaxThreads);
+    TestConcurrentPathTrie(vThreads);
+    TestTrieWalker(6);
+    TestScanDir(vThreads);
+    TestTreeFixture();
+    TestRemoveDirAsync();
+    TestCopyDir();
+    TestPruneDir();
+    TestDirCache();
+
+    std::cout << "Testing RemoveDirParallel..." << std::endl;
+    for (unsigned int nThreads : vThreads) {
+        TestRemoveDirParallel(nThreads);
+    }
 
+    if (s_nInconsistent != 0) {
+        std::cerr << s_nInconsistent << " inconsistent result(s)" << std::endl;
+        return 1;
+    }
     return 0;
 }
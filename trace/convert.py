@@ -21,8 +21,8 @@ import argparse
 # Trace log for parsing
 # <...>-40950   [006] .....  8219.402419: tracing_mark_write: E|40950|40950|main|1737333169285502
 def parse_trace_line(line):
-    # Reg expression
-    match = re.match(r'.*\[(\d+)\].*tracing_mark_write: (B|E|X)\|(\d+)\|(\d+)\|(\w+)\|(\d+)', line)
+    # Reg expression, ASCII only like trace_convert: names are [A-Za-z0-9_]
+    match = re.match(r'.*\[(\d+)\].*tracing_mark_write: (B|E|X)\|(\d+)\|(\d+)\|(\w+)\|(\d+)', line, re.ASCII)
     if match:
         cpu_id, event_type, pid, tid, event_name, timestamp = match.groups()
         return int(cpu_id), event_type, int(pid), int(tid), event_name, int(timestamp)
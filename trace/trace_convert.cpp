@@ -0,0 +1,498 @@
+/* Copyright (C) 
+ * 2025 - Clay Cheng
+ * This program is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License
+ * as published by the Free Software Foundation; either version 2
+ * of the License, or (at your option) any later version.
+ * 
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ * 
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place - Suite 330, Boston, MA  02111-1307, USA.
+ * 
+ */
+
+// Streaming replacement of convert.py for large trace_pipe captures.
+//
+//   trace_convert -i <input_file> -o <output_file> [--threads N] [--block-mb M]
+//
+// The capture is mapped, cut into blocks at line boundaries and the blocks
+// are scanned in parallel. Every block is rendered to Chrome Trace JSON on
+// its own and written out in file order, so at most a few blocks are held
+// in memory whatever the size of the capture. The same pass pairs B and E
+// events per thread and prints a per-event summary table to stdout.
+//
+// Accepted records, anything else is skipped:
+// <...>-40950   [006] .....  8219.402419: tracing_mark_write: E|40950|40950|main|1737333169285502
+// Records are matched as convert.py does: event names of [A-Za-z0-9_], and
+// of several markers on a line, the last one that parses. Both tools write
+// the same JSON for the same capture.
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <charconv>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <thread>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+
+#define TRACE_MARK                  "tracing_mark_write: "
+#define DEFAULT_BLOCK_MB            4
+#define BLOCKS_PER_THREAD           2           // blocks in flight per thread
+
+namespace {
+struct Options {
+    std::string szInput;
+    std::string szOutput;
+    unsigned int nThreads = 0;
+    size_t ulBlockSize = static_cast<size_t>(DEFAULT_BLOCK_MB) << 20;
+};
+
+// One parsed record, the name points into the mapped capture
+struct TraceRecord {
+    const char* pName;
+    uint32_t uNameLen;
+    uint32_t uTid;
+    uint64_t ulTs;
+    char cPhase;
+};
+
+// A block in flight. Reserved for block ulBlock, filled by a worker and
+// drained by the writer, the buffers keep their capacity for the next block.
+struct Slot {
+    uint64_t ulBlock;
+    bool bDone = false;
+    std::string szJson;
+    std::vector<TraceRecord> vRecords;
+    uint64_t ulSkipped = 0;
+};
+
+struct Summary {
+    uint64_t ulCount = 0;
+    uint64_t ulTotalUs = 0;
+    uint64_t ulMaxUs = 0;
+};
+
+struct OpenSpan {
+    std::string_view szName;
+    uint64_t ulTs;
+};
+
+bool ParseUInt(const char*& p, const char* pEnd, uint64_t& ulValue)
+{
+    const char* pStart = p;
+    ulValue = 0;
+    while (p < pEnd && *p >= '0' && *p <= '9') {
+        ulValue = ulValue * 10 + (*p - '0');
+        ++p;
+    }
+    return p != pStart;
+}
+
+// CPU id of the last "[digits]" before the marker, -1 if there is none
+long ParseCpu(const char* pLine, const char* pMark)
+{
+    const char* pEnd = pMark;
+    while (const char* pClose = static_cast<const char*>(memrchr(pLine, ']', pEnd - pLine))) {
+        const char* p = pClose;
+        while (p > pLine && p[-1] >= '0' && p[-1] <= '9') {
+            --p;
+        }
+        if (p < pClose && p > pLine && p[-1] == '[') {
+            uint64_t ulCpu;
+            ParseUInt(p, pClose, ulCpu);
+            return static_cast<long>(ulCpu);
+        }
+        pEnd = pClose;
+    }
+    return -1;
+}
+
+void AppendUInt(std::string& sz, uint64_t ulValue)
+{
+    char szBuf[24];
+    auto result = std::to_chars(szBuf, szBuf + sizeof(szBuf), ulValue);
+    sz.append(szBuf, result.ptr - szBuf);
+}
+
+bool IsNameChar(char c)
+{
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || (c >= '0' && c <= '9') || c == '_';
+}
+
+// Parse one marker line, false if it is not a B/E/X record
+bool ParseRecord(const char* pLine, const char* pMark, const char* pEnd, TraceRecord& record,
+                 uint64_t& ulPid, long& lCpu)
+{
+    const char* p = pMark + sizeof(TRACE_MARK) - 1;
+    if (pEnd - p < 2 || (*p != 'B' && *p != 'E' && *p != 'X') || p[1] != '|') {
+        return false;
+    }
+    record.cPhase = *p;
+    p += 2;
+
+    uint64_t ulTid;
+    if (!ParseUInt(p, pEnd, ulPid) || p == pEnd || *p++ != '|' ||
+        !ParseUInt(p, pEnd, ulTid) || p == pEnd || *p++ != '|') {
+        return false;
+    }
+    const char* pName = p;
+    while (p < pEnd && IsNameChar(*p)) {
+        ++p;
+    }
+    if (p == pName || p == pEnd || *p != '|') {
+        return false;
+    }
+    record.pName = pName;
+    record.uNameLen = static_cast<uint32_t>(p - pName);
+    ++p;
+    if (!ParseUInt(p, pEnd, record.ulTs)) {
+        return false;
+    }
+    record.uTid = static_cast<uint32_t>(ulTid);
+
+    lCpu = ParseCpu(pLine, pMark);
+    return lCpu >= 0;
+}
+
+// Render [pBegin, pEnd) into the slot, every event is preceded by ",\n"
+void ScanBlock(const char* pBegin, const char* pEnd, Slot& slot)
+{
+    slot.szJson.clear();
+    slot.vRecords.clear();
+    slot.ulSkipped = 0;
+
+    const char* pCur = pBegin;
+    while (pCur < pEnd) {
+        const char* pMark = static_cast<const char*>(memmem(pCur, pEnd - pCur, TRACE_MARK, sizeof(TRACE_MARK) - 1));
+        if (pMark == nullptr) {
+            break;
+        }
+        const char* pLine = static_cast<const char*>(memrchr(pCur, '\n', pMark - pCur));
+        pLine = pLine ? pLine + 1 : pCur;
+        const char* pLineEnd = static_cast<const char*>(memchr(pMark, '\n', pEnd - pMark));
+        if (pLineEnd == nullptr) {
+            pLineEnd = pEnd;
+        }
+        pCur = pLineEnd + 1;
+
+        // The last marker of the line that parses wins, like the greedy
+        // ".*" of convert.py
+        TraceRecord record;
+        uint64_t ulPid;
+        long lCpu;
+        bool bParsed = false;
+        while (pMark != nullptr) {
+            TraceRecord next;
+            uint64_t ulNextPid;
+            long lNextCpu;
+            if (ParseRecord(pLine, pMark, pLineEnd, next, ulNextPid, lNextCpu)) {
+                record = next;
+                ulPid = ulNextPid;
+                lCpu = lNextCpu;
+                bParsed = true;
+            }
+            pMark = static_cast<const char*>(
+                memmem(pMark + 1, pLineEnd - pMark - 1, TRACE_MARK, sizeof(TRACE_MARK) - 1));
+        }
+        if (!bParsed) {
+            ++slot.ulSkipped;
+            continue;
+        }
+        slot.vRecords.push_back(record);
+
+        // Names need no escaping, they are [A-Za-z0-9_]
+        std::string& sz = slot.szJson;
+        sz.append(",\n{\"name\":\"");
+        sz.append(record.pName, record.uNameLen);
+        sz.append("\",\"ph\":\"");
+        sz.push_back(record.cPhase);
+        sz.append("\",\"pid\":");
+        AppendUInt(sz, ulPid);
+        sz.append(",\"tid\":");
+        AppendUInt(sz, record.uTid);
+        sz.append(",\"ts\":");
+        AppendUInt(sz, record.ulTs);
+        sz.append(",\"args\":{\"cpu_id\":");
+        AppendUInt(sz, static_cast<uint64_t>(lCpu));
+        sz.append("}}");
+    }
+}
+
+// Offset of the first line starting at or after ulOffset
+size_t AlignToLine(const char* pData, size_t ulSize, size_t ulOffset)
+{
+    if (ulOffset == 0 || ulOffset >= ulSize) {
+        return std::min(ulOffset, ulSize);
+    }
+    const char* pNewline = static_cast<const char*>(memchr(pData + ulOffset - 1, '\n', ulSize - ulOffset + 1));
+    return pNewline ? pNewline - pData + 1 : ulSize;
+}
+
+bool WriteAll(int iFd, const char* p, size_t ulLen)
+{
+    while (ulLen > 0) {
+        ssize_t iWritten = write(iFd, p, ulLen);
+        if (iWritten < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return false;
+        }
+        p += iWritten;
+        ulLen -= iWritten;
+    }
+    return true;
+}
+
+// Pair B and E per thread, an E closes the innermost open B
+class SummaryBuilder {
+public:
+    void add(const TraceRecord& record) {
+        std::string_view szName(record.pName, record.uNameLen);
+        if (record.cPhase == 'B') {
+            m_open[record.uTid].push_back({ szName, record.ulTs });
+        } else if (record.cPhase == 'X') {
+            m_summaries[szName].ulCount++;
+        } else {
+            auto it = m_open.find(record.uTid);
+            if (it == m_open.end() || it->second.empty()) {
+                ++m_ulUnmatched;
+                return;
+            }
+            OpenSpan span = it->second.back();
+            it->second.pop_back();
+            uint64_t ulUs = record.ulTs >= span.ulTs ? record.ulTs - span.ulTs : 0;
+            Summary& summary = m_summaries[span.szName];
+            summary.ulCount++;
+            summary.ulTotalUs += ulUs;
+            summary.ulMaxUs = std::max(summary.ulMaxUs, ulUs);
+        }
+    }
+
+    void print(std::ostream& os) const {
+        std::vector<std::pair<std::string_view, Summary>> vRows(m_summaries.begin(), m_summaries.end());
+        std::sort(vRows.begin(), vRows.end(), [](const auto& a, const auto& b) {
+            return a.second.ulTotalUs > b.second.ulTotalUs;
+        });
+
+        size_t ulWidth = 5;
+        for (const auto& row : vRows) {
+            ulWidth = std::max(ulWidth, row.first.size());
+        }
+        os << std::left << std::setw(ulWidth + 2) << "event" << std::right << std::setw(12) << "count"
+           << std::setw(16) << "total(us)" << std::setw(14) << "mean(us)" << std::setw(14) << "max(us)" << std::endl;
+        for (const auto& row : vRows) {
+            const Summary& summary = row.second;
+            os << std::left << std::setw(ulWidth + 2) << row.first << std::right << std::setw(12) << summary.ulCount
+               << std::setw(16) << summary.ulTotalUs << std::setw(14) << std::fixed << std::setprecision(1)
+               << (summary.ulCount ? static_cast<double>(summary.ulTotalUs) / summary.ulCount : 0.0)
+               << std::setw(14) << summary.ulMaxUs << std::endl;
+        }
+
+        uint64_t ulOpen = 0;
+        for (const auto& open : m_open) {
+            ulOpen += open.second.size();
+        }
+        if (ulOpen != 0 || m_ulUnmatched != 0) {
+            os << "unclosed B: " << ulOpen << ", unmatched E: " << m_ulUnmatched << std::endl;
+        }
+    }
+
+private:
+    std::unordered_map<uint32_t, std::vector<OpenSpan>> m_open;
+    std::unordered_map<std::string_view, Summary> m_summaries;
+    uint64_t m_ulUnmatched = 0;
+};
+
+void Usage(const char* szProg)
+{
+    std::cerr << "usage: " << szProg << " -i <input_file> -o <output_file> [--threads N] [--block-mb M]" << std::endl;
+}
+
+bool ParseArgs(int argc, char* argv[], Options& options)
+{
+    for (int i = 1; i < argc; ++i) {
+        std::string szArg = argv[i];
+        if (i + 1 >= argc) {
+            return false;
+        }
+        const char* szValue = argv[++i];
+        if (szArg == "-i" || szArg == "--input") {
+            options.szInput = szValue;
+        } else if (szArg == "-o" || szArg == "--output") {
+            options.szOutput = szValue;
+        } else if (szArg == "--threads") {
+            options.nThreads = static_cast<unsigned int>(strtoul(szValue, nullptr, 10));
+        } else if (szArg == "--block-mb") {
+            options.ulBlockSize = std::max(1ul, strtoul(szValue, nullptr, 10)) << 20;
+        } else {
+            return false;
+        }
+    }
+    return !options.szInput.empty() && !options.szOutput.empty();
+}
+}
+
+int main(int argc, char* argv[])
+{
+    Options options;
+    if (!ParseArgs(argc, argv, options)) {
+        Usage(argv[0]);
+        return 2;
+    }
+    if (options.nThreads == 0) {
+        options.nThreads = std::max(1u, std::thread::hardware_concurrency());
+    }
+
+    int iInFd = open(options.szInput.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (iInFd < 0 || fstat(iInFd, &st) != 0) {
+        std::cerr << "Failed to open " << options.szInput << ", err: " << strerror(errno) << std::endl;
+        return 1;
+    }
+    size_t ulSize = static_cast<size_t>(st.st_size);
+    const char* pData = nullptr;
+    if (ulSize != 0) {
+        void* pMap = mmap(nullptr, ulSize, PROT_READ, MAP_PRIVATE, iInFd, 0);
+        if (pMap == MAP_FAILED) {
+            std::cerr << "Failed to map " << options.szInput << ", err: " << strerror(errno) << std::endl;
+            return 1;
+        }
+        madvise(pMap, ulSize, MADV_SEQUENTIAL);
+        pData = static_cast<const char*>(pMap);
+    }
+    close(iInFd);
+
+    int iOutFd = open(options.szOutput.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (iOutFd < 0) {
+        std::cerr << "Failed to open " << options.szOutput << ", err: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    const uint64_t ulBlocks = (ulSize + options.ulBlockSize - 1) / options.ulBlockSize;
+    const size_t ulSlots = static_cast<size_t>(options.nThreads) * BLOCKS_PER_THREAD;
+    std::vector<Slot> vSlots(ulSlots);
+    for (size_t i = 0; i < ulSlots; ++i) {
+        vSlots[i].ulBlock = i;
+    }
+    std::mutex mutex;
+    std::condition_variable cvFilled;
+    std::condition_variable cvFree;
+    std::atomic<uint64_t> ulNextBlock(0);
+
+    auto worker = [&]() {
+        while (true) {
+            uint64_t ulBlock = ulNextBlock.fetch_add(1);
+            if (ulBlock >= ulBlocks) {
+                return;
+            }
+            Slot& slot = vSlots[ulBlock % ulSlots];
+            {
+                std::unique_lock<std::mutex> lock(mutex);
+                cvFree.wait(lock, [&] { return slot.ulBlock == ulBlock; });
+            }
+            size_t ulBegin = AlignToLine(pData, ulSize, ulBlock * options.ulBlockSize);
+            size_t ulEnd = AlignToLine(pData, ulSize, (ulBlock + 1) * options.ulBlockSize);
+            ScanBlock(pData + ulBegin, pData + ulEnd, slot);
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                slot.bDone = true;
+            }
+            cvFilled.notify_one();
+        }
+    };
+    std::vector<std::thread> vThreads;
+    for (unsigned int i = 0; i < options.nThreads; ++i) {
+        vThreads.emplace_back(worker);
+    }
+
+    // Write the blocks in file order, the summary needs them in order too
+    bool bOk = WriteAll(iOutFd, "[", 1);
+    bool bFirst = true;
+    uint64_t ulEvents = 0;
+    uint64_t ulSkipped = 0;
+    SummaryBuilder summary;
+    const size_t ulPageSize = static_cast<size_t>(sysconf(_SC_PAGESIZE));
+    size_t ulReleased = 0;
+    for (uint64_t ulBlock = 0; ulBlock < ulBlocks; ++ulBlock) {
+        Slot& slot = vSlots[ulBlock % ulSlots];
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            cvFilled.wait(lock, [&] { return slot.ulBlock == ulBlock && slot.bDone; });
+        }
+
+        // The first event of the file goes without the leading comma
+        const char* pJson = slot.szJson.data();
+        size_t ulLen = slot.szJson.size();
+        if (bFirst && ulLen != 0) {
+            pJson += 1;
+            ulLen -= 1;
+            bFirst = false;
+        }
+        bOk = bOk && WriteAll(iOutFd, pJson, ulLen);
+        for (const TraceRecord& record : slot.vRecords) {
+            summary.add(record);
+        }
+        ulEvents += slot.vRecords.size();
+        ulSkipped += slot.ulSkipped;
+
+        // Drop the pages behind us from the resident set, they are reread
+        // from the file if the summary touches a name in them again
+        size_t ulDone = AlignToLine(pData, ulSize, (ulBlock + 1) * options.ulBlockSize) & ~(ulPageSize - 1);
+        if (ulDone > ulReleased) {
+            madvise(const_cast<char*>(pData) + ulReleased, ulDone - ulReleased, MADV_DONTNEED);
+            ulReleased = ulDone;
+        }
+
+        {
+            std::lock_guard<std::mutex> lock(mutex);
+            slot.bDone = false;
+            slot.ulBlock = ulBlock + ulSlots;
+        }
+        cvFree.notify_all();
+    }
+    for (auto& thread : vThreads) {
+        thread.join();
+    }
+    if (bFirst) {
+        bOk = bOk && WriteAll(iOutFd, "\n", 1);
+    }
+    bOk = bOk && WriteAll(iOutFd, "\n]", 2);
+    if (close(iOutFd) != 0) {
+        bOk = false;
+    }
+    if (!bOk) {
+        std::cerr << "Failed to write " << options.szOutput << ", err: " << strerror(errno) << std::endl;
+        return 1;
+    }
+
+    summary.print(std::cout);
+    std::cout << "Chrome trace file generated: " << options.szOutput << " (" << ulEvents << " events";
+    if (ulSkipped != 0) {
+        std::cout << ", " << ulSkipped << " marker lines skipped";
+    }
+    std::cout << ")" << std::endl;
+
+    if (pData) {
+        munmap(const_cast<char*>(pData), ulSize);
+    }
+    return 0;
+}